@@ -0,0 +1,44 @@
+// Measure startup cost: loading the module, then the first enumeration, each in a fresh process.
+//
+// Usage: node bench/startup.js [runs]
+//
+// Loading should not initialise libusb; the first getDeviceList() pays for libusb_init, the event thread and the bus scan.
+// Run `yarn compile` first, since this loads the package from dist.
+
+const { execFileSync } = require('child_process');
+const path = require('path');
+
+const runs = parseInt(process.argv[2], 10) || 20;
+const root = path.join(__dirname, '..');
+
+const child = `
+const { performance } = require('perf_hooks');
+const loadStart = performance.now();
+const { usb } = require(${JSON.stringify(root)});
+const loaded = performance.now();
+const devices = usb.getDeviceList();
+const enumerated = performance.now();
+process.stdout.write(JSON.stringify({
+    boot: loadStart,
+    load: loaded - loadStart,
+    enumerate: enumerated - loaded,
+    devices: devices.length
+}));
+`;
+
+const stats = values => {
+    const sorted = [...values].sort((a, b) => a - b);
+    const median = sorted[Math.floor(sorted.length / 2)];
+    return `median ${median.toFixed(2)} ms, min ${sorted[0].toFixed(2)} ms, max ${sorted[sorted.length - 1].toFixed(2)} ms`;
+};
+
+const results = [];
+for (let i = 0; i < runs; i++) {
+    results.push(JSON.parse(execFileSync(process.execPath, ['-e', child], { encoding: 'utf8' })));
+}
+
+console.log(`${runs} runs, ${results[0].devices} devices`);
+console.log(`node boot:         ${stats(results.map(result => result.boot))}`);
+console.log(`require('usb'):    ${stats(results.map(result => result.load))}`);
+console.log(`first enumeration: ${stats(results.map(result => result.enumerate))}`);
+console.log(`load + enumerate:  ${stats(results.map(result => result.load + result.enumerate))}`);
@@ -30,7 +30,16 @@
         'src/device.cc',
         'src/transfer.cc',
         'src/thread_name.cc',
-        'src/hotplug.cc'
+        'src/hotplug.cc',
+        'src/capture.cc',
+        'src/native_poll.cc',
+        'src/latest_poll.cc',
+        'src/framer.cc',
+        'src/framed_poll.cc',
+        'src/hid_report.cc',
+        'src/hid_poll.cc',
+        'src/fd_pump.cc',
+        'src/bot_engine.cc'
       ],
       'cflags_cc': [
         '-std=c++17'
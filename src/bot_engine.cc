@@ -0,0 +1,586 @@
+#include "node_usb.h"
+#include "capture.h"
+#include <string.h>
+#include <algorithm>
+
+extern "C" void LIBUSB_CALL botCompletionCb(libusb_transfer *transfer);
+void handleBotNotify(BotEngine* self);
+
+// USB Mass Storage Class Bulk-Only Transport 1.0
+static const uint32_t CBW_SIGNATURE = 0x43425355;  // "USBC"
+static const uint32_t CSW_SIGNATURE = 0x53425355;  // "USBS"
+static const uint8_t BULK_ONLY_RESET = 0xff;
+static const uint8_t REQUEST_SENSE = 0x03;
+static const uint8_t SENSE_LENGTH = 18;
+
+static inline void writeLE32(uint8_t* p, uint32_t value) {
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+static inline uint32_t readLE32(const uint8_t* p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline bool isNoDevice(int error) {
+    return error == LIBUSB_TRANSFER_NO_DEVICE || error == LIBUSB_ERROR_NO_DEVICE;
+}
+
+BotEngine::BotEngine(const Napi::CallbackInfo& info)
+    : Napi::ObjectWrap<BotEngine>(info), instanceData(info.Env().GetInstanceData<ModuleData>()), notifyQueue(handleBotNotify),
+      cbwTransfer(NULL), cswTransfer(NULL), resetTransfer(NULL), pending(0), notifyPending(false), tag(0),
+      phase(IDLE), sensing(false), runCdb(NULL), runCdbLength(0), runData(NULL), runLength(0), runIn(false),
+      nextOffset(0), transferred(0), dataInFlight(0), dataStatus(LIBUSB_TRANSFER_COMPLETED), shortSeen(false), cswCaptured(false),
+      phaseError(false), cswAttempts(0), resetError(0), haltCount(0), haltRequested(false), afterHalt(HALT_THEN_STATUS), commands(0), bytes(0), resets(0), clearHalts(0) {
+    DEBUG_LOG("Created BotEngine %p", this);
+    Constructor(info);
+}
+
+BotEngine::~BotEngine() {
+    DEBUG_LOG("Freed BotEngine %p", this);
+    libusb_free_transfer(cbwTransfer);
+    libusb_free_transfer(cswTransfer);
+    libusb_free_transfer(resetTransfer);
+    for (auto transfer : dataTransfers) {
+        libusb_free_transfer(transfer);
+    }
+}
+
+// new BotEngine(device, interfaceNumber, inEndpoint, outEndpoint, maxTransferSize, depth, timeout)
+Napi::Value BotEngine::Constructor(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    ENTER_CONSTRUCTOR(7);
+    UNWRAP_ARG(Device, device, 0);
+    int interfaceNumber, inEndpoint, outEndpoint, maxTransferSize, depth, timeout;
+    INT_ARG(interfaceNumber, 1);
+    INT_ARG(inEndpoint, 2);
+    INT_ARG(outEndpoint, 3);
+    INT_ARG(maxTransferSize, 4);
+    INT_ARG(depth, 5);
+    INT_ARG(timeout, 6);
+    if (maxTransferSize <= 0 || depth <= 0 || timeout < 0) {
+        THROW_BAD_ARGS("maxTransferSize and depth must be positive");
+    }
+
+    info.This().As<Napi::Object>().DefineProperty(Napi::PropertyDescriptor::Value(std::string("device"), info[0], CONST_PROP));
+    this->device = device;
+    this->interfaceNumber = interfaceNumber;
+    this->inEndpoint = (unsigned char) inEndpoint;
+    this->outEndpoint = (unsigned char) outEndpoint;
+    this->maxTransferSize = (uint32_t) maxTransferSize;
+    this->timeout = (unsigned int) timeout;
+
+    cbwTransfer = libusb_alloc_transfer(0);
+    libusb_fill_bulk_transfer(cbwTransfer, NULL, this->outEndpoint, cbw, sizeof(cbw), botCompletionCb, this, this->timeout);
+    cswTransfer = libusb_alloc_transfer(0);
+    libusb_fill_bulk_transfer(cswTransfer, NULL, this->inEndpoint, csw, sizeof(csw), botCompletionCb, this, this->timeout);
+    resetTransfer = libusb_alloc_transfer(0);
+    libusb_fill_control_setup(resetSetup, LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE | LIBUSB_ENDPOINT_OUT,
+        BULK_ONLY_RESET, 0, (uint16_t) interfaceNumber, 0);
+    libusb_fill_control_transfer(resetTransfer, NULL, resetSetup, botCompletionCb, this, this->timeout);
+
+    for (int i = 0; i < depth; i++) {
+        libusb_transfer* transfer = libusb_alloc_transfer(0);
+        libusb_fill_bulk_transfer(transfer, NULL, this->inEndpoint, NULL, 0, botCompletionCb, this, this->timeout);
+        dataTransfers.push_back(transfer);
+    }
+
+    memset(senseCdb, 0, sizeof(senseCdb));
+    senseCdb[0] = REQUEST_SENSE;
+    senseCdb[4] = SENSE_LENGTH;
+    return info.This();
+}
+
+// BotEngine.submit(lun, cdb, dataIn, data, callback)
+Napi::Value BotEngine::Submit(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(BotEngine, 5);
+    int lun;
+    INT_ARG(lun, 0);
+    if (!info[1].IsBuffer()) {
+        THROW_BAD_ARGS("CDB must be a Buffer");
+    }
+    Napi::Buffer<uint8_t> cdb = info[1].As<Napi::Buffer<uint8_t>>();
+    bool in = info[2].ToBoolean().Value();
+    if (!info[3].IsUndefined() && !info[3].IsBuffer()) {
+        THROW_BAD_ARGS("Data must be a Buffer or undefined");
+    }
+    CALLBACK_ARG(4);
+    if (lun < 0 || lun > 15 || cdb.Length() == 0 || cdb.Length() > 16) {
+        THROW_BAD_ARGS("LUN must be 0 to 15 and the CDB 1 to 16 bytes");
+    }
+    if (!self->device->device_handle) {
+        THROW_ERROR("Device is not open");
+    }
+
+    BotCommand* command = new BotCommand();
+    command->lun = (uint8_t) lun;
+    memset(command->cdb, 0, sizeof(command->cdb));
+    memcpy(command->cdb, cdb.Data(), cdb.Length());
+    command->cdbLength = (uint8_t) cdb.Length();
+    command->in = in;
+    command->buffer = NULL;
+    command->length = 0;
+    if (info[3].IsBuffer()) {
+        Napi::Buffer<uint8_t> data = info[3].As<Napi::Buffer<uint8_t>>();
+        if (data.Length() > UINT32_MAX) {
+            delete command;
+            THROW_BAD_ARGS("Data must be less than 4 GiB");
+        }
+        command->buffer = data.Data();
+        command->length = (uint32_t) data.Length();
+        command->data.Reset(data, 1);
+    }
+    command->callback.Reset(callback, 1);
+    command->asyncContext.reset(new Napi::AsyncContext(env, "USBMassStorage", info.This().As<Napi::Object>()));
+
+    // Keep the engine, and the notify queue it posts to, alive until every command has been called back
+    if (self->pending++ == 0) {
+        self->notifyQueue.start(env);
+        self->Ref();
+        self->device->ref();
+    }
+
+    std::lock_guard<std::mutex> guard(self->lock);
+    self->queue.push_back(command);
+    self->startNextLocked();
+    return env.Undefined();
+}
+
+// BotEngine.stats() -> { commands, bytes, resets, clearHalts, queued }
+Napi::Value BotEngine::Stats(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(BotEngine, 0);
+    Napi::Object result = Napi::Object::New(env);
+    std::lock_guard<std::mutex> guard(self->lock);
+    result.Set("commands", Napi::Number::New(env, (double) self->commands));
+    result.Set("bytes", Napi::Number::New(env, (double) self->bytes));
+    result.Set("resets", Napi::Number::New(env, (double) self->resets));
+    result.Set("clearHalts", Napi::Number::New(env, (double) self->clearHalts));
+    result.Set("queued", Napi::Number::New(env, (double) self->queue.size()));
+    return result;
+}
+
+// The methods below are called with the lock held, on the libusb event
+// thread except when Submit starts an idle engine or the halts have been
+// cleared.
+
+void BotEngine::startNextLocked() {
+    while (phase == IDLE && !queue.empty()) {
+        BotCommand* command = queue.front();
+        sensing = false;
+        runCdb = command->cdb;
+        runCdbLength = command->cdbLength;
+        runData = command->buffer;
+        runLength = command->length;
+        runIn = command->in;
+        commands++;
+        beginLocked();
+    }
+}
+
+int BotEngine::submitLocked(libusb_transfer* transfer) {
+    transfer->dev_handle = device->device_handle;
+    if (!transfer->dev_handle) {
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+    captureTransfer(instanceData, 'S', transfer);
+    int r = libusb_submit_transfer(transfer);
+    if (r < LIBUSB_SUCCESS) {
+        captureTransfer(instanceData, 'E', transfer, r);
+    }
+    return r;
+}
+
+// Command phase: send the CBW
+void BotEngine::beginLocked() {
+    BotCommand* command = queue.front();
+    phase = CBW;
+    cswAttempts = 0;
+
+    memset(cbw, 0, sizeof(cbw));
+    writeLE32(&cbw[0], CBW_SIGNATURE);
+    writeLE32(&cbw[4], ++tag);
+    writeLE32(&cbw[8], runLength);
+    cbw[12] = runIn && runLength ? 0x80 : 0x00;
+    cbw[13] = command->lun;
+    cbw[14] = runCdbLength;
+    memcpy(&cbw[15], runCdb, runCdbLength);
+
+    int r = submitLocked(cbwTransfer);
+    if (r < LIBUSB_SUCCESS) {
+        finishLocked(r);
+    }
+}
+
+// Cancel the data transfers still in flight
+void BotEngine::cancelData() {
+    for (auto transfer : dataTransfers) {
+        if (transfer->dev_handle) {
+            libusb_cancel_transfer(transfer);
+        }
+    }
+}
+
+// Data phase: keep up to `depth` chunks of at most maxTransferSize in flight
+void BotEngine::submitChunkLocked(libusb_transfer* transfer) {
+    uint32_t length = std::min(maxTransferSize, runLength - nextOffset);
+    transfer->endpoint = runIn ? inEndpoint : outEndpoint;
+    transfer->buffer = runData + nextOffset;
+    transfer->length = (int) length;
+
+    int r = submitLocked(transfer);
+    if (r < LIBUSB_SUCCESS) {
+        if (dataStatus == LIBUSB_TRANSFER_COMPLETED) {
+            dataStatus = r;
+        }
+        cancelData();
+        return;
+    }
+    nextOffset += length;
+    dataInFlight++;
+}
+
+void BotEngine::dataCompletedLocked(libusb_transfer* transfer) {
+    dataInFlight--;
+
+    if (shortSeen) {
+        // Queued after the short transfer: the device has moved on to the CSW
+        if (transfer->status == LIBUSB_TRANSFER_COMPLETED && transfer->actual_length > 0) {
+            if (runIn && !cswCaptured && transfer->actual_length == (int) sizeof(csw)) {
+                memcpy(csw, transfer->buffer, sizeof(csw));
+                cswCaptured = true;
+            } else {
+                phaseError = true;
+            }
+        }
+    } else {
+        transferred += transfer->actual_length;
+        if (transfer->status == LIBUSB_TRANSFER_COMPLETED && transfer->actual_length < transfer->length) {
+            // The device ended the data phase early
+            shortSeen = true;
+            cancelData();
+        } else if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+            if (dataStatus == LIBUSB_TRANSFER_COMPLETED && nextOffset < runLength) {
+                submitChunkLocked(transfer);
+            }
+        } else if (dataStatus == LIBUSB_TRANSFER_COMPLETED) {
+            dataStatus = transfer->status;
+            cancelData();
+        }
+    }
+
+    if (dataInFlight == 0) {
+        dataEndedLocked();
+    }
+}
+
+void BotEngine::dataEndedLocked() {
+    if (phaseError) {
+        resetLocked(LIBUSB_ERROR_IO);
+    } else if (dataStatus == LIBUSB_TRANSFER_STALL) {
+        // The device refused the rest of the data: clear the halt and read the CSW
+        clearHaltsLocked({ runIn ? inEndpoint : outEndpoint }, HALT_THEN_STATUS);
+    } else if (dataStatus != LIBUSB_TRANSFER_COMPLETED) {
+        resetLocked(dataStatus);
+    } else if (cswCaptured) {
+        cswReceivedLocked();
+    } else {
+        startCswLocked();
+    }
+}
+
+// Status phase: read the CSW
+void BotEngine::startCswLocked() {
+    phase = CSW;
+    int r = submitLocked(cswTransfer);
+    if (r < LIBUSB_SUCCESS) {
+        resetLocked(r);
+    }
+}
+
+void BotEngine::cswCompletedLocked(libusb_transfer* transfer) {
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+        if (transfer->actual_length == (int) sizeof(csw)) {
+            cswReceivedLocked();
+        } else {
+            resetLocked(LIBUSB_ERROR_IO);
+        }
+    } else if (transfer->status == LIBUSB_TRANSFER_STALL && cswAttempts++ == 0) {
+        // A STALL instead of the CSW is cleared and the CSW read once more
+        clearHaltsLocked({ inEndpoint }, HALT_THEN_CSW);
+    } else {
+        resetLocked(transfer->status);
+    }
+}
+
+void BotEngine::cswReceivedLocked() {
+    BotCommand* command = queue.front();
+    uint32_t cswTag = readLE32(&csw[4]);
+    uint32_t residue = readLE32(&csw[8]);
+    uint8_t status = csw[12];
+    if (readLE32(&csw[0]) != CSW_SIGNATURE || cswTag != tag || status > 2) {
+        resetLocked(LIBUSB_ERROR_IO);
+        return;
+    }
+    if (status == 2) {
+        // Phase error: only reset recovery gets the device back in step
+        if (sensing) {
+            command->sense.clear();
+        } else {
+            command->status = 2;
+        }
+        resetLocked(LIBUSB_TRANSFER_COMPLETED);
+        return;
+    }
+
+    uint32_t missing = std::min(runLength, std::max(residue, runLength - transferred));
+    if (sensing) {
+        // Sense data for the failed command, which keeps its own status and residue
+        command->sense.resize(status == 0 ? SENSE_LENGTH - std::min(missing, (uint32_t) SENSE_LENGTH) : 0);
+        finishLocked(LIBUSB_TRANSFER_COMPLETED);
+        return;
+    }
+
+    bytes += transferred;
+    command->status = status;
+    command->residue = missing;
+    if (status == 1 && runCdb[0] != REQUEST_SENSE) {
+        sensing = true;
+        command->sense.assign(SENSE_LENGTH, 0);
+        runCdb = senseCdb;
+        runCdbLength = sizeof(senseCdb);
+        runData = command->sense.data();
+        runLength = SENSE_LENGTH;
+        runIn = true;
+        beginLocked();
+        return;
+    }
+    finishLocked(LIBUSB_TRANSFER_COMPLETED);
+}
+
+// Clear halts, one endpoint after the other, then go on as `then` says.
+// libusb_clear_halt resets the host side of the endpoint (its data toggle)
+// as well as the device side, as reset recovery needs, but blocks until the
+// device answers; so it runs on the thread pool, queued from the JS thread.
+void BotEngine::clearHaltsLocked(std::initializer_list<unsigned char> endpoints, AfterHalt then) {
+    phase = CLEAR_HALT;
+    haltCount = 0;
+    for (unsigned char endpoint : endpoints) {
+        halts[haltCount++] = endpoint;
+    }
+    clearHalts += haltCount;
+    afterHalt = then;
+    haltRequested = true;
+    notifyLocked();
+}
+
+// Clears the halts of a BotEngine on the thread pool. A halt that cannot be
+// cleared is left for the next transfer on the endpoint to report.
+struct BotEngine_ClearHalts: Napi::AsyncWorker {
+    BotEngine* engine;
+    libusb_device_handle* handle;
+    unsigned char halts[2];
+    int haltCount;
+    int error;
+
+    BotEngine_ClearHalts(BotEngine* engine)
+        : Napi::AsyncWorker(engine->Env(), "USBMassStorage"), engine(engine), handle(engine->device->device_handle),
+          haltCount(engine->haltCount), error(LIBUSB_SUCCESS) {
+        std::copy(engine->halts, engine->halts + haltCount, halts);
+    }
+
+    void Execute() override {
+        for (int i = 0; i < haltCount; i++) {
+            int r = handle ? libusb_clear_halt(handle, halts[i]) : (int) LIBUSB_ERROR_NO_DEVICE;
+            if (isNoDevice(r)) {
+                error = r;
+                return;
+            }
+            if (r < LIBUSB_SUCCESS) {
+                DEBUG_LOG("clear halt failed %p %i", engine, r);
+            }
+        }
+    }
+
+    void OnOK() override {
+        std::lock_guard<std::mutex> guard(engine->lock);
+        engine->haltsClearedLocked(error);
+        engine->startNextLocked();
+    }
+};
+
+void BotEngine::haltsClearedLocked(int error) {
+    if (isNoDevice(error)) {
+        finishLocked(error);
+    } else if (afterHalt == HALT_THEN_FINISH) {
+        finishLocked(resetError);
+    } else if (afterHalt == HALT_THEN_STATUS && cswCaptured) {
+        cswReceivedLocked();
+    } else {
+        startCswLocked();
+    }
+}
+
+// Reset recovery: Bulk-Only Mass Storage Reset, then clear both halts (BOT 5.3.4)
+void BotEngine::resetLocked(int error) {
+    if (isNoDevice(error)) {
+        finishLocked(error);
+        return;
+    }
+    phase = RESET;
+    resetError = error;
+    int r = submitLocked(resetTransfer);
+    if (r < LIBUSB_SUCCESS) {
+        finishLocked(isNoDevice(r) ? r : error);
+    }
+}
+
+void BotEngine::resetCompletedLocked(libusb_transfer* transfer) {
+    resets++;
+    if (isNoDevice(transfer->status)) {
+        finishLocked(transfer->status);
+        return;
+    }
+    clearHaltsLocked({ inEndpoint, outEndpoint }, HALT_THEN_FINISH);
+}
+
+// Hand the running command to JS. Once the device is gone, the queued ones fail with it.
+void BotEngine::finishLocked(int error) {
+    BotCommand* command = queue.front();
+    queue.pop_front();
+    if (error != LIBUSB_TRANSFER_COMPLETED) {
+        if (sensing) {
+            command->sense.clear();
+        } else {
+            command->error = error;
+        }
+    }
+    done.push_back(command);
+    phase = IDLE;
+
+    if (isNoDevice(error)) {
+        while (!queue.empty()) {
+            queue.front()->error = error;
+            done.push_back(queue.front());
+            queue.pop_front();
+        }
+    }
+
+    notifyLocked();
+}
+
+// Posted with the lock held, so JS cannot see the last command and stop the queue before this post
+void BotEngine::notifyLocked() {
+    if (!notifyPending) {
+        notifyPending = true;
+        notifyQueue.post(this);
+    }
+}
+
+void BotEngine::completed(libusb_transfer* transfer) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (transfer == cbwTransfer) {
+        if (transfer->status == LIBUSB_TRANSFER_COMPLETED && transfer->actual_length == (int) sizeof(cbw)) {
+            if (runLength) {
+                phase = DATA;
+                nextOffset = 0;
+                transferred = 0;
+                dataInFlight = 0;
+                dataStatus = LIBUSB_TRANSFER_COMPLETED;
+                shortSeen = cswCaptured = phaseError = false;
+                for (auto t : dataTransfers) {
+                    if (nextOffset >= runLength || dataStatus != LIBUSB_TRANSFER_COMPLETED) {
+                        break;
+                    }
+                    submitChunkLocked(t);
+                }
+                if (dataInFlight == 0) {
+                    dataEndedLocked();
+                }
+            } else {
+                transferred = 0;
+                startCswLocked();
+            }
+        } else {
+            // Per BOT 5.3.1 a CBW that is not accepted calls for reset recovery
+            resetLocked(transfer->status == LIBUSB_TRANSFER_COMPLETED ? (int) LIBUSB_ERROR_IO : (int) transfer->status);
+        }
+    } else if (transfer == cswTransfer) {
+        cswCompletedLocked(transfer);
+    } else if (transfer == resetTransfer) {
+        resetCompletedLocked(transfer);
+    } else {
+        dataCompletedLocked(transfer);
+    }
+    startNextLocked();
+}
+
+extern "C" void LIBUSB_CALL botCompletionCb(libusb_transfer *transfer) {
+    BotEngine* self = static_cast<BotEngine*>(transfer->user_data);
+    captureTransfer(self->instanceData, 'C', transfer);
+    self->completed(transfer);
+}
+
+void handleBotNotify(BotEngine* self) {
+    Napi::Env env = self->Env();
+    Napi::HandleScope scope(env);
+
+    std::vector<BotCommand*> finished;
+    {
+        std::lock_guard<std::mutex> guard(self->lock);
+        self->notifyPending = false;
+        finished.swap(self->done);
+        if (self->haltRequested) {
+            self->haltRequested = false;
+            (new BotEngine_ClearHalts(self))->Queue();
+        }
+    }
+
+    // Run every callback even if one throws, then rethrow the first error
+    Napi::Error thrown;
+    for (BotCommand* command : finished) {
+        Napi::Value error = env.Undefined();
+        if (command->error != 0) {
+            error = libusbException(env, command->error).Value();
+        }
+        Napi::Value sense = env.Undefined();
+        if (!command->sense.empty()) {
+            sense = Napi::Buffer<uint8_t>::Copy(env, command->sense.data(), command->sense.size());
+        }
+
+        try {
+            command->callback.MakeCallback(self->Value(), {
+                error, Napi::Number::New(env, command->status), Napi::Number::New(env, command->residue), sense
+            }, *command->asyncContext);
+        }
+        catch (const Napi::Error& e) {
+            if (thrown.IsEmpty()) {
+                thrown = e;
+            }
+        }
+        delete command;
+        self->pending--;
+    }
+
+    if (!finished.empty() && self->pending == 0) {
+        self->notifyQueue.stop();
+        self->device->unref();
+        self->Unref();
+    }
+    if (!thrown.IsEmpty()) {
+        thrown.ThrowAsJavaScriptException();
+    }
+}
+
+Napi::Object BotEngine::Init(Napi::Env env, Napi::Object exports) {
+    exports.Set("BotEngine", BotEngine::DefineClass(
+        env,
+        "BotEngine",
+        {
+            BotEngine::InstanceMethod("submit", &BotEngine::Submit),
+            BotEngine::InstanceMethod("stats", &BotEngine::Stats),
+        }));
+
+    return exports;
+}
@@ -0,0 +1,368 @@
+#include "capture.h"
+#include "thread_name.h"
+
+#include <chrono>
+#include <errno.h>
+#include <string.h>
+
+// Binary usbmon record header, see Documentation/usb/usbmon.rst in Linux
+struct UsbmonHeader {
+    uint64_t id;
+    uint8_t type;
+    uint8_t xfer_type;
+    uint8_t epnum;
+    uint8_t devnum;
+    uint16_t busnum;
+    char flag_setup;
+    char flag_data;
+    int64_t ts_sec;
+    int32_t ts_usec;
+    int32_t status;
+    uint32_t length;
+    uint32_t len_cap;
+    uint8_t setup[8];
+    int32_t interval;
+    int32_t start_frame;
+    uint32_t xfer_flags;
+    uint32_t ndesc;
+};
+static_assert(sizeof(UsbmonHeader) == 64, "usbmon header must be 64 bytes");
+
+struct PcapFileHeader {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t network;
+};
+
+struct PcapRecordHeader {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+};
+
+#define LINKTYPE_USB_LINUX_MMAPPED 220
+
+// usbmon reports Linux errno values, whatever the host platform
+#define USBMON_EINPROGRESS -115
+#define USBMON_ENOENT -2
+#define USBMON_EIO -5
+#define USBMON_ENODEV -19
+#define USBMON_EBUSY -16
+#define USBMON_EINVAL -22
+#define USBMON_EPIPE -32
+#define USBMON_EPROTO -71
+#define USBMON_EOVERFLOW -75
+#define USBMON_ETIMEDOUT -110
+
+static int usbmonTransferStatus(int status) {
+    switch (status) {
+        case LIBUSB_TRANSFER_COMPLETED: return 0;
+        case LIBUSB_TRANSFER_TIMED_OUT: return USBMON_ETIMEDOUT;
+        case LIBUSB_TRANSFER_CANCELLED: return USBMON_ENOENT;
+        case LIBUSB_TRANSFER_STALL: return USBMON_EPIPE;
+        case LIBUSB_TRANSFER_NO_DEVICE: return USBMON_ENODEV;
+        case LIBUSB_TRANSFER_OVERFLOW: return USBMON_EOVERFLOW;
+        default: return USBMON_EPROTO;
+    }
+}
+
+static int usbmonSubmitError(int error) {
+    switch (error) {
+        case LIBUSB_ERROR_NO_DEVICE: return USBMON_ENODEV;
+        case LIBUSB_ERROR_BUSY: return USBMON_EBUSY;
+        case LIBUSB_ERROR_INVALID_PARAM: return USBMON_EINVAL;
+        default: return USBMON_EIO;
+    }
+}
+
+static uint8_t usbmonTransferType(uint8_t type) {
+    switch (type) {
+        case LIBUSB_TRANSFER_TYPE_ISOCHRONOUS: return 0;
+        case LIBUSB_TRANSFER_TYPE_INTERRUPT: return 1;
+        case LIBUSB_TRANSFER_TYPE_CONTROL: return 2;
+        default: return 3;
+    }
+}
+
+CaptureRing::CaptureRing(size_t size) : head(0), tail(0) {
+    size_t capacity = 1;
+    while (capacity < size) {
+        capacity <<= 1;
+    }
+    data.resize(capacity);
+    mask = capacity - 1;
+}
+
+void CaptureRing::copyIn(size_t pos, const void* src, size_t len) {
+    size_t offset = pos & mask;
+    size_t first = std::min(len, data.size() - offset);
+    memcpy(&data[offset], src, first);
+    memcpy(&data[0], static_cast<const uint8_t*>(src) + first, len - first);
+}
+
+void CaptureRing::copyOut(size_t pos, void* dst, size_t len) const {
+    size_t offset = pos & mask;
+    size_t first = std::min(len, data.size() - offset);
+    memcpy(dst, &data[offset], first);
+    memcpy(static_cast<uint8_t*>(dst) + first, &data[0], len - first);
+}
+
+bool CaptureRing::write(const void* a, size_t alen, const void* b, size_t blen) {
+    uint32_t length = (uint32_t)(alen + blen);
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t t = tail.load(std::memory_order_acquire);
+    if (data.size() - (h - t) < sizeof(length) + length) {
+        return false;
+    }
+    copyIn(h, &length, sizeof(length));
+    copyIn(h + sizeof(length), a, alen);
+    copyIn(h + sizeof(length) + alen, b, blen);
+    head.store(h + sizeof(length) + length, std::memory_order_release);
+    return true;
+}
+
+bool CaptureRing::peek(std::vector<uint8_t>& record) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+    if (h == t) {
+        return false;
+    }
+    uint32_t length;
+    copyOut(t, &length, sizeof(length));
+    record.resize(length);
+    copyOut(t + sizeof(length), record.data(), length);
+    return true;
+}
+
+void CaptureRing::consume(size_t recordLength) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    tail.store(t + sizeof(uint32_t) + recordLength, std::memory_order_release);
+}
+
+Capture::Capture(FILE* file, uint32_t snaplen, size_t bufferSize, std::thread::id eventThread)
+    : file(file), snaplen(snaplen), jsThread(std::this_thread::get_id()), eventThread(eventThread),
+      rings{CaptureRing(bufferSize), CaptureRing(bufferSize)}, stopping(false), packetCount(0), droppedCount(0) {
+    writer = std::thread(&Capture::writerFn, this);
+}
+
+Capture* Capture::open(const std::string& path, uint32_t snaplen, size_t bufferSize, std::thread::id eventThread, int* error) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        *error = errno;
+        return nullptr;
+    }
+
+    PcapFileHeader header = { 0xa1b2c3d4, 2, 4, 0, 0, (uint32_t) sizeof(UsbmonHeader) + snaplen, LINKTYPE_USB_LINUX_MMAPPED };
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        *error = errno;
+        fclose(file);
+        return nullptr;
+    }
+
+    return new Capture(file, snaplen, bufferSize, eventThread);
+}
+
+// Only called once no producer can still be inside record()
+Capture::~Capture() {
+    stopping = true;
+    wake.notify_one();
+    writer.join();
+    fclose(file);
+}
+
+void Capture::record(char event, const libusb_transfer* transfer, int error) {
+    // Each ring has exactly one producer thread
+    CaptureRing* ring;
+    std::thread::id self = std::this_thread::get_id();
+    if (self == eventThread.load()) {
+        ring = &rings[1];
+    } else if (self == jsThread) {
+        ring = &rings[0];
+    } else {
+        droppedCount++;
+        return;
+    }
+
+    UsbmonHeader h;
+    memset(&h, 0, sizeof(h));
+
+    int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    h.ts_sec = now / 1000000;
+    h.ts_usec = (int32_t)(now % 1000000);
+
+    h.id = (uint64_t)(uintptr_t) transfer;
+    h.type = (uint8_t) event;
+    h.xfer_type = usbmonTransferType(transfer->type);
+    h.epnum = transfer->endpoint;
+    if (transfer->dev_handle) {
+        libusb_device* device = libusb_get_device(transfer->dev_handle);
+        h.busnum = libusb_get_bus_number(device);
+        h.devnum = libusb_get_device_address(device);
+    }
+
+    const unsigned char* payload = transfer->buffer;
+    int length = event == 'C' ? transfer->actual_length : transfer->length;
+    h.flag_setup = '-';
+
+    if (transfer->type == LIBUSB_TRANSFER_TYPE_CONTROL && transfer->buffer && transfer->length >= LIBUSB_CONTROL_SETUP_SIZE) {
+        // The direction of a control transfer is in bmRequestType
+        h.epnum = (transfer->buffer[0] & LIBUSB_ENDPOINT_IN) | (transfer->endpoint & 0x7f);
+        payload += LIBUSB_CONTROL_SETUP_SIZE;
+        if (event != 'C') {
+            length -= LIBUSB_CONTROL_SETUP_SIZE;
+        }
+        if (event == 'S') {
+            memcpy(h.setup, transfer->buffer, LIBUSB_CONTROL_SETUP_SIZE);
+            h.flag_setup = 0;
+        }
+    }
+
+    bool in = (h.epnum & LIBUSB_ENDPOINT_IN) != 0;
+    switch (event) {
+        case 'S': h.status = USBMON_EINPROGRESS; break;
+        case 'C': h.status = usbmonTransferStatus(transfer->status); break;
+        default: h.status = usbmonSubmitError(error); break;
+    }
+    h.length = length > 0 ? length : 0;
+
+    // OUT data is captured on submit, IN data on completion
+    bool hasData = payload && h.length > 0 && ((event == 'S' && !in) || (event == 'C' && in));
+    if (hasData) {
+        h.len_cap = std::min(h.length, snaplen);
+        h.flag_data = 0;
+    } else {
+        h.flag_data = in ? '<' : '>';
+    }
+
+    if (ring->write(&h, sizeof(h), payload, h.len_cap)) {
+        packetCount++;
+    } else {
+        droppedCount++;
+    }
+}
+
+void Capture::writerFn() {
+    SetThreadName("node-usb capture");
+    std::vector<uint8_t> front[2];
+    bool have[2] = { false, false };
+
+    while (true) {
+        bool stop = stopping;
+        for (int i = 0; i < 2; i++) {
+            if (!have[i]) {
+                have[i] = rings[i].peek(front[i]);
+            }
+        }
+
+        if (!have[0] && !have[1]) {
+            if (stop) {
+                break;
+            }
+            // Producers never signal, so that recording stays cheap; poll instead
+            fflush(file);
+            std::unique_lock<std::mutex> guard(wakeLock);
+            wake.wait_for(guard, std::chrono::milliseconds(10));
+            continue;
+        }
+
+        // Merge the two rings in timestamp order
+        int next = have[0] ? 0 : 1;
+        if (have[0] && have[1]) {
+            const UsbmonHeader* a = reinterpret_cast<const UsbmonHeader*>(front[0].data());
+            const UsbmonHeader* b = reinterpret_cast<const UsbmonHeader*>(front[1].data());
+            if (b->ts_sec < a->ts_sec || (b->ts_sec == a->ts_sec && b->ts_usec < a->ts_usec)) {
+                next = 1;
+            }
+        }
+
+        const UsbmonHeader* h = reinterpret_cast<const UsbmonHeader*>(front[next].data());
+        PcapRecordHeader record = {
+            (uint32_t) h->ts_sec,
+            (uint32_t) h->ts_usec,
+            (uint32_t) front[next].size(),
+            (uint32_t) sizeof(UsbmonHeader) + (h->flag_data == 0 ? h->length : 0)
+        };
+        fwrite(&record, sizeof(record), 1, file);
+        fwrite(front[next].data(), front[next].size(), 1, file);
+
+        rings[next].consume(front[next].size());
+        have[next] = false;
+    }
+
+    fflush(file);
+}
+
+void captureTransferSlow(ModuleData* instanceData, char event, const libusb_transfer* transfer, int error) {
+    // Counted so that stopCapture can wait for recorders before freeing the capture
+    instanceData->captureUsers++;
+    Capture* capture = instanceData->capture.load();
+    if (capture) {
+        capture->record(event, transfer, error);
+    }
+    instanceData->captureUsers--;
+}
+
+// Stop recording and wait until no thread is still inside record(). The
+// caller then owns the capture; deleting it flushes and closes the file.
+Capture* ModuleData::detachCapture() {
+    Capture* current = capture.exchange(nullptr);
+    while (captureUsers.load() > 0) {
+        std::this_thread::yield();
+    }
+    return current;
+}
+
+// startCapture(path, snaplen, bufferSize)
+Napi::Value StartCapture(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::HandleScope scope(env);
+    CHECK_N_ARGS(3);
+    if (!info[0].IsString()) {
+        THROW_BAD_ARGS("Parameter path (0) should be string");
+    }
+    std::string path = info[0].As<Napi::String>().Utf8Value();
+    int snaplen, bufferSize;
+    INT_ARG(snaplen, 1);
+    INT_ARG(bufferSize, 2);
+    if (snaplen < 0 || bufferSize <= 0) {
+        THROW_BAD_ARGS("snaplen must not be negative and bufferSize must be positive");
+    }
+
+    ModuleData* instanceData = env.GetInstanceData<ModuleData>();
+    if (instanceData->capture.load()) {
+        THROW_ERROR("Capture is already running");
+    }
+
+    int error = 0;
+    // Room for at least one full record per ring
+    size_t ringSize = std::max((size_t) bufferSize, sizeof(UsbmonHeader) + snaplen + sizeof(uint32_t));
+    Capture* capture = Capture::open(path, snaplen, ringSize, instanceData->usb_thread.get_id(), &error);
+    if (!capture) {
+        THROW_ERROR(std::string("Cannot open capture file: ") + strerror(error));
+    }
+    instanceData->capture.store(capture);
+    return env.Undefined();
+}
+
+// stopCapture() -> { packets, dropped } or undefined if not capturing
+Napi::Value StopCapture(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::HandleScope scope(env);
+
+    Capture* capture = env.GetInstanceData<ModuleData>()->detachCapture();
+    if (!capture) {
+        return env.Undefined();
+    }
+
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("packets", Napi::Number::New(env, (double) capture->packets()));
+    result.Set("dropped", Napi::Number::New(env, (double) capture->dropped()));
+    delete capture;
+    return result;
+}
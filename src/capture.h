@@ -0,0 +1,81 @@
+#ifndef SRC_CAPTURE_H
+#define SRC_CAPTURE_H
+
+#include "node_usb.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <stdio.h>
+
+// Single producer / single consumer byte ring of length-prefixed records.
+class CaptureRing {
+public:
+    explicit CaptureRing(size_t size);
+
+    // Producer: append one record made of two parts, or return false if full
+    bool write(const void* a, size_t alen, const void* b, size_t blen);
+
+    // Consumer: copy out the oldest record without consuming it
+    bool peek(std::vector<uint8_t>& record);
+    void consume(size_t recordLength);
+
+private:
+    void copyIn(size_t pos, const void* src, size_t len);
+    void copyOut(size_t pos, void* dst, size_t len) const;
+
+    std::vector<uint8_t> data;
+    size_t mask;
+    std::atomic<size_t> head; // written by the producer
+    std::atomic<size_t> tail; // written by the consumer
+};
+
+// Records transfer submits and completions to a pcap file in the
+// LINKTYPE_USB_LINUX_MMAPPED format (usbmon's binary interface), as read by
+// Wireshark. Each producing thread (the JS thread and the libusb event thread)
+// has its own lock-free ring; a writer thread merges them by timestamp.
+class Capture {
+public:
+    static Capture* open(const std::string& path, uint32_t snaplen, size_t bufferSize, std::thread::id eventThread, int* error);
+    ~Capture();
+
+    // event is 'S' (submit), 'C' (complete) or 'E' (submit error)
+    void record(char event, const libusb_transfer* transfer, int error);
+
+    uint64_t packets() const { return packetCount; }
+    uint64_t dropped() const { return droppedCount; }
+
+    // The event thread may start after capture does
+    void setEventThread(std::thread::id id) { eventThread.store(id); }
+
+private:
+    Capture(FILE* file, uint32_t snaplen, size_t bufferSize, std::thread::id eventThread);
+    void writerFn();
+
+    FILE* file;
+    uint32_t snaplen;
+    std::thread::id jsThread;
+    std::atomic<std::thread::id> eventThread;
+    CaptureRing rings[2];
+
+    std::atomic<bool> stopping;
+    std::thread writer;
+    std::mutex wakeLock;
+    std::condition_variable wake;
+
+    std::atomic<uint64_t> packetCount;
+    std::atomic<uint64_t> droppedCount;
+};
+
+Napi::Value StartCapture(const Napi::CallbackInfo& info);
+Napi::Value StopCapture(const Napi::CallbackInfo& info);
+
+void captureTransferSlow(ModuleData* instanceData, char event, const libusb_transfer* transfer, int error);
+
+// Hook for submit and completion paths: a single branch when capture is off.
+inline void captureTransfer(ModuleData* instanceData, char event, const libusb_transfer* transfer, int error = 0) {
+    if (instanceData->capture.load(std::memory_order_relaxed)) {
+        captureTransferSlow(instanceData, event, transfer, error);
+    }
+}
+
+#endif
@@ -60,6 +60,7 @@ Napi::Value Device::Constructor(const Napi::CallbackInfo& info) {
     auto obj = info.This().As<Napi::Object>();
     obj.DefineProperty(Napi::PropertyDescriptor::Value("busNumber", Napi::Number::New(env, libusb_get_bus_number(self->device)), CONST_PROP));
     obj.DefineProperty(Napi::PropertyDescriptor::Value("deviceAddress", Napi::Number::New(env, libusb_get_device_address(self->device)), CONST_PROP));
+    obj.DefineProperty(Napi::PropertyDescriptor::Value("speed", Napi::Number::New(env, libusb_get_device_speed(self->device)), CONST_PROP));
 
     Napi::Object v8dd = Napi::Object::New(env);
     obj.DefineProperty(Napi::PropertyDescriptor::Value("deviceDescriptor", v8dd, CONST_PROP));
@@ -95,6 +96,7 @@ Napi::Value Device::Constructor(const Napi::CallbackInfo& info) {
 }
 
 Napi::Object Device::cdesc2V8(Napi::Env env, libusb_config_descriptor * cdesc) {
+    libusb_context* context = env.GetInstanceData<ModuleData>()->context();
     Napi::Object v8cdesc = Napi::Object::New(env);
 
     STRUCT_TO_V8(v8cdesc, *cdesc, bLength)
@@ -163,6 +165,19 @@ Napi::Object Device::cdesc2V8(Napi::Env env, libusb_config_descriptor * cdesc) {
                     ? Napi::Buffer<const char>::Copy(env, (const char*)edesc.extra, edesc.extra_length)
                     : Napi::Buffer<const char>::New(env, 0);
                 v8edesc.DefineProperty(Napi::PropertyDescriptor::Value("extra", endpoint_extras, CONST_PROP));
+
+                // SuperSpeed endpoints carry their burst size in a companion descriptor
+                libusb_ss_endpoint_companion_descriptor* ep_comp;
+                if (libusb_get_ss_endpoint_companion_descriptor(context, &edesc, &ep_comp) == LIBUSB_SUCCESS) {
+                    Napi::Object v8comp = Napi::Object::New(env);
+                    STRUCT_TO_V8(v8comp, *ep_comp, bLength)
+                    STRUCT_TO_V8(v8comp, *ep_comp, bDescriptorType)
+                    STRUCT_TO_V8(v8comp, *ep_comp, bMaxBurst)
+                    STRUCT_TO_V8(v8comp, *ep_comp, bmAttributes)
+                    STRUCT_TO_V8(v8comp, *ep_comp, wBytesPerInterval)
+                    v8edesc.DefineProperty(Napi::PropertyDescriptor::Value("companion", v8comp, CONST_PROP));
+                    libusb_free_ss_endpoint_companion_descriptor(ep_comp);
+                }
             }
         }
     }
@@ -203,29 +218,6 @@ Napi::Value Device::GetParent(const Napi::CallbackInfo& info) {
         return env.Null();
 }
 
-Napi::Value Device::Open(const Napi::CallbackInfo& info) {
-    ENTER_METHOD(Device, 0);
-    if (!self->device_handle){
-        CHECK_USB(libusb_open(self->device, &self->device_handle));
-        completionQueue.start(info.Env());
-    }
-    return env.Undefined();
-}
-
-Napi::Value Device::Close(const Napi::CallbackInfo& info) {
-    ENTER_METHOD(Device, 0);
-    if (self->canClose()){
-        if (self->device_handle){
-            libusb_close(self->device_handle);
-            self->device_handle = NULL;
-            completionQueue.stop();
-        }
-    }else{
-        THROW_ERROR("Can't close device with a pending request");
-    }
-    return env.Undefined();
-}
-
 struct Req: Napi::AsyncWorker {
     Device* device;
     int errcode;
@@ -253,6 +245,88 @@ struct Req: Napi::AsyncWorker {
     }
 };
 
+// Adopt a handle opened on a worker thread. Another open may have won the
+// race, in which case the spare handle is closed again.
+void Device::attachHandle(libusb_device_handle* handle) {
+    if (device_handle) {
+        libusb_close(handle);
+        return;
+    }
+    device_handle = handle;
+    completionQueue.start(env);
+}
+
+struct Device_Open: Req {
+    Device_Open(Device* d, Napi::Function& callback): Req(d, callback), alreadyOpen(d->device_handle != NULL), handle(NULL) {}
+
+    bool alreadyOpen;
+    libusb_device_handle* handle;
+
+    virtual void Execute() {
+        errcode = alreadyOpen ? LIBUSB_SUCCESS : libusb_open(device->device, &handle);
+    }
+
+    void OnOK() override {
+        if (handle) {
+            device->attachHandle(handle);
+        }
+        Req::OnOK();
+    }
+};
+
+struct Device_Close: Req {
+    Device_Close(Device* d, Napi::Function& callback): Req(d, callback), handle(NULL) {}
+
+    libusb_device_handle* handle;
+
+    virtual void Execute() {
+        if (handle) {
+            libusb_close(handle);
+        }
+        errcode = LIBUSB_SUCCESS;
+    }
+};
+
+Napi::Value Device::Open(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(Device, 0);
+    CALLBACK_ARG(0);
+    if (!callback.IsEmpty()) {
+        auto baton = new Device_Open(self, callback);
+        baton->Queue();
+        return env.Undefined();
+    }
+    if (!self->device_handle){
+        CHECK_USB(libusb_open(self->device, &self->device_handle));
+        completionQueue.start(info.Env());
+    }
+    return env.Undefined();
+}
+
+Napi::Value Device::Close(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(Device, 0);
+    CALLBACK_ARG(0);
+    if (self->canClose()){
+        if (!callback.IsEmpty()) {
+            // Detach the handle now so the device reads as closed straight away,
+            // then let the worker do the (potentially slow) libusb_close.
+            auto baton = new Device_Close(self, callback);
+            baton->handle = self->device_handle;
+            if (self->device_handle){
+                self->device_handle = NULL;
+                completionQueue.stop();
+            }
+            baton->Queue();
+        } else if (self->device_handle){
+            libusb_close(self->device_handle);
+            self->device_handle = NULL;
+            completionQueue.stop();
+        }
+    }else{
+        THROW_ERROR("Can't close device with a pending request");
+    }
+    return env.Undefined();
+}
+
 struct Device_Reset: Req {
     Device_Reset(Device* d, Napi::Function& callback): Req(d, callback) {}
 
@@ -302,11 +376,28 @@ Napi::Value Device::IsKernelDriverActive(const Napi::CallbackInfo& info) {
     return Napi::Boolean::New(env, r);
 }
 
+struct Device_DetachKernelDriver: Req {
+    Device_DetachKernelDriver(Device* d, Napi::Function& callback): Req(d, callback) {}
+
+    int interface;
+
+    virtual void Execute() {
+        errcode = libusb_detach_kernel_driver(device->device_handle, interface);
+    }
+};
+
 Napi::Value Device::DetachKernelDriver(const Napi::CallbackInfo& info) {
     ENTER_METHOD(Device, 1);
     CHECK_OPEN();
     int interface;
     INT_ARG(interface, 0);
+    CALLBACK_ARG(1);
+    if (!callback.IsEmpty()) {
+        auto baton = new Device_DetachKernelDriver(self, callback);
+        baton->interface = interface;
+        baton->Queue();
+        return env.Undefined();
+    }
     CHECK_USB(libusb_detach_kernel_driver(self->device_handle, interface));
     return env.Undefined();
 }
@@ -320,24 +411,142 @@ Napi::Value Device::AttachKernelDriver(const Napi::CallbackInfo& info) {
     return env.Undefined();
 }
 
+struct Device_SetAutoDetachKernelDriver: Req {
+    Device_SetAutoDetachKernelDriver(Device* d, Napi::Function& callback): Req(d, callback) {}
+
+    int enable;
+
+    virtual void Execute() {
+        errcode = libusb_set_auto_detach_kernel_driver(device->device_handle, enable);
+    }
+};
+
 Napi::Value Device::SetAutoDetachKernelDriver(const Napi::CallbackInfo& info) {
     ENTER_METHOD(Device, 1);
     CHECK_OPEN();
     int enable;
     INT_ARG(enable, 0);
+    CALLBACK_ARG(1);
+    if (!callback.IsEmpty()) {
+        auto baton = new Device_SetAutoDetachKernelDriver(self, callback);
+        baton->enable = enable;
+        baton->Queue();
+        return env.Undefined();
+    }
     CHECK_USB(libusb_set_auto_detach_kernel_driver(self->device_handle, enable));
     return env.Undefined();
 }
 
+struct Device_ClaimInterface: Req {
+    Device_ClaimInterface(Device* d, Napi::Function& callback): Req(d, callback) {}
+
+    int interface;
+
+    virtual void Execute() {
+        errcode = libusb_claim_interface(device->device_handle, interface);
+    }
+};
+
 Napi::Value Device::ClaimInterface(const Napi::CallbackInfo& info) {
     ENTER_METHOD(Device, 1);
     CHECK_OPEN();
     int interface;
     INT_ARG(interface, 0);
+    CALLBACK_ARG(1);
+    if (!callback.IsEmpty()) {
+        auto baton = new Device_ClaimInterface(self, callback);
+        baton->interface = interface;
+        baton->Queue();
+        return env.Undefined();
+    }
     CHECK_USB(libusb_claim_interface(self->device_handle, interface));
     return env.Undefined();
 }
 
+// Open the device (if needed) and claim a set of interfaces as one unit of
+// work on the thread pool, so bringing up many devices doesn't serialise on
+// the JS thread. On failure, anything done here is rolled back.
+struct Device_OpenAndClaim: Req {
+    Device_OpenAndClaim(Device* d, Napi::Function& callback): Req(d, callback), handle(d->device_handle), opened(false), autoDetach(-1) {}
+
+    libusb_device_handle* handle;
+    bool opened;
+    int autoDetach;
+    std::vector<int> interfaces;
+
+    virtual void Execute() {
+        if (!handle) {
+            errcode = libusb_open(device->device, &handle);
+            if (errcode < LIBUSB_SUCCESS) {
+                handle = NULL;
+                return;
+            }
+            opened = true;
+        }
+
+        if (autoDetach >= 0) {
+            errcode = libusb_set_auto_detach_kernel_driver(handle, autoDetach);
+            // Not all platforms support this, which shouldn't fail the bring-up
+            if (errcode < LIBUSB_SUCCESS && errcode != LIBUSB_ERROR_NOT_SUPPORTED) {
+                rollback(0);
+                return;
+            }
+        }
+
+        for (size_t i = 0; i < interfaces.size(); i++) {
+            errcode = libusb_claim_interface(handle, interfaces[i]);
+            if (errcode < LIBUSB_SUCCESS) {
+                rollback(i);
+                return;
+            }
+        }
+        errcode = LIBUSB_SUCCESS;
+    }
+
+    void rollback(size_t claimed) {
+        for (size_t i = 0; i < claimed; i++) {
+            libusb_release_interface(handle, interfaces[i]);
+        }
+        if (opened) {
+            libusb_close(handle);
+            handle = NULL;
+            opened = false;
+        }
+    }
+
+    void OnOK() override {
+        if (opened) {
+            device->attachHandle(handle);
+        }
+        Req::OnOK();
+    }
+};
+
+// __openAndClaim(interfaces, autoDetachKernelDriver, callback)
+Napi::Value Device::OpenAndClaim(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(Device, 3);
+    if (!info[0].IsArray()) {
+        THROW_BAD_ARGS("Parameter interfaces (0) should be array");
+    }
+    Napi::Array interfaces = info[0].As<Napi::Array>();
+    int autoDetach;
+    INT_ARG(autoDetach, 1);
+    CALLBACK_ARG(2);
+    std::vector<int> numbers;
+    for (uint32_t i = 0; i < interfaces.Length(); i++) {
+        Napi::Value value = interfaces.Get(i);
+        if (!value.IsNumber()) {
+            THROW_BAD_ARGS("Interface numbers should be numbers");
+        }
+        numbers.push_back(value.As<Napi::Number>().Int32Value());
+    }
+    auto baton = new Device_OpenAndClaim(self, callback);
+    baton->autoDetach = autoDetach;
+    baton->interfaces = numbers;
+    baton->Queue();
+    return env.Undefined();
+}
+
 struct Device_ReleaseInterface: Req {
     Device_ReleaseInterface(Device* d, Napi::Function& callback): Req(d, callback) {}
 
@@ -409,6 +618,65 @@ Napi::Value Device::SetConfiguration(const Napi::CallbackInfo& info) {
     return env.Undefined();
 }
 
+// __setTransferBudget(maxTransfers, maxBytes, queue)
+Napi::Value Device::SetTransferBudget(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(Device, 3);
+    self->budget.set(env, info);
+    env.GetInstanceData<ModuleData>()->drainPendingTransfers();
+    return env.Undefined();
+}
+
+Napi::Value Device::GetTransferBudget(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(Device, 0);
+    return self->budget.toObject(env, self->scheduler.queued);
+}
+
+// __setClassLimit(priority, maxTransfers)
+Napi::Value Device::SetClassLimit(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(Device, 2);
+    int priority, limit;
+    INT_ARG(priority, 0);
+    INT_ARG(limit, 1);
+    if (priority < 0 || priority >= PRIORITY_CLASSES || limit < 0) {
+        THROW_BAD_ARGS("Invalid scheduler limit");
+    }
+    self->scheduler.classLimit[priority] = limit;
+    env.GetInstanceData<ModuleData>()->drainPendingTransfers();
+    return env.Undefined();
+}
+
+// __setEndpointLimit(endpointAddr, maxTransfers)
+Napi::Value Device::SetEndpointLimit(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(Device, 2);
+    int endpoint, limit;
+    INT_ARG(endpoint, 0);
+    INT_ARG(limit, 1);
+    if (endpoint < 0 || endpoint > 0xff || limit < 0) {
+        THROW_BAD_ARGS("Invalid scheduler limit");
+    }
+    self->scheduler.endpointLimit[SubmitScheduler::endpointIndex(endpoint)] = limit;
+    env.GetInstanceData<ModuleData>()->drainPendingTransfers();
+    return env.Undefined();
+}
+
+Napi::Value Device::GetSchedulerStats(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(Device, 0);
+    return self->scheduler.toObject(env);
+}
+
+// __getMaxPacketSize(endpointAddr, iso)
+Napi::Value Device::GetMaxPacketSize(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(Device, 2);
+    int endpoint;
+    INT_ARG(endpoint, 0);
+    bool iso = info[1].ToBoolean();
+    int size = iso
+        ? libusb_get_max_iso_packet_size(self->device, endpoint)
+        : libusb_get_max_packet_size(self->device, endpoint);
+    CHECK_USB(size);
+    return Napi::Number::New(env, size);
+}
+
 Napi::Object Device::Init(Napi::Env env, Napi::Object exports) {
     auto func = Device::DefineClass(
         env,
@@ -429,6 +697,13 @@ Napi::Object Device::Init(Napi::Env env, Napi::Object exports) {
             Device::InstanceMethod("__detachKernelDriver", &Device::DetachKernelDriver),
             Device::InstanceMethod("__attachKernelDriver", &Device::AttachKernelDriver),
             Device::InstanceMethod("__setAutoDetachKernelDriver", &Device::SetAutoDetachKernelDriver),
+            Device::InstanceMethod("__openAndClaim", &Device::OpenAndClaim),
+            Device::InstanceMethod("__setTransferBudget", &Device::SetTransferBudget),
+            Device::InstanceMethod("__getTransferBudget", &Device::GetTransferBudget),
+            Device::InstanceMethod("__setClassLimit", &Device::SetClassLimit),
+            Device::InstanceMethod("__setEndpointLimit", &Device::SetEndpointLimit),
+            Device::InstanceMethod("__getSchedulerStats", &Device::GetSchedulerStats),
+            Device::InstanceMethod("__getMaxPacketSize", &Device::GetMaxPacketSize),
         });
     exports.Set("Device", func);
 
@@ -0,0 +1,414 @@
+#include "node_usb.h"
+#include "thread_name.h"
+#include <errno.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#endif
+
+#ifndef _WIN32
+// Wait for `fd` to be ready for `events` or for the wake pipe to be signalled.
+// Returns 0 when `fd` is ready (or has failed, which the next read or write
+// reports), ECANCELED when woken, or an errno value.
+static int waitFd(int fd, short events, int wakeFd) {
+    struct pollfd fds[2] = {{fd, events, 0}, {wakeFd, POLLIN, 0}};
+    for (;;) {
+        if (::poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        return fds[0].revents ? 0 : ECANCELED;
+    }
+}
+#endif
+
+// Write all of `data`, returning 0, ECANCELED if the pump was stopped while
+// `fd` was not writable, or an errno value
+static int writeAll(int fd, const unsigned char* data, size_t length, int wakeFd) {
+    while (length > 0) {
+#ifdef _WIN32
+        long n = _write(fd, data, (unsigned int) length);
+#else
+        long n = ::write(fd, data, length);
+#endif
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+#ifdef _WIN32
+            if (_doserrno == ERROR_OPERATION_ABORTED) {
+                return ECANCELED;
+            }
+#else
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                int r = waitFd(fd, POLLOUT, wakeFd);
+                if (r) {
+                    return r;
+                }
+                continue;
+            }
+#endif
+            return errno;
+        }
+        data += n;
+        length -= (size_t) n;
+    }
+    return 0;
+}
+
+// Read up to `length` bytes, returning the count, 0 at end of file, -ECANCELED
+// if the pump was stopped while there was nothing to read, or -errno
+static long readSome(int fd, unsigned char* data, size_t length, int wakeFd) {
+    for (;;) {
+#ifdef _WIN32
+        long n = _read(fd, data, (unsigned int) length);
+#else
+        long n = ::read(fd, data, length);
+#endif
+        if (n >= 0) {
+            return n;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+#ifdef _WIN32
+        if (_doserrno == ERROR_OPERATION_ABORTED) {
+            return -ECANCELED;
+        }
+#else
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            int r = waitFd(fd, POLLIN, wakeFd);
+            if (r) {
+                return -r;
+            }
+            continue;
+        }
+#endif
+        return -errno;
+    }
+}
+
+FdPump::FdPump(const Napi::CallbackInfo& info)
+    : Napi::ObjectWrap<FdPump>(info), NativePoll(info.Env().GetInstanceData<ModuleData>(), "USBPump", "Pump already started"),
+      fd(-1), isIn(false), transferSize(0), limit(0), fdFlags(-1), finished(false), ioError(0),
+      bytes(0), transfersDone(0), maxQueued(0), idleSince(0), idleTime(0) {
+    DEBUG_LOG("Created FdPump %p", this);
+    wakeFds[0] = wakeFds[1] = -1;
+    Constructor(info);
+}
+
+FdPump::~FdPump() {
+    DEBUG_LOG("Freed FdPump %p", this);
+    // Normally joined once the pump has ended; never destroy a joinable thread
+    join();
+#ifndef _WIN32
+    if (wakeFds[0] >= 0) {
+        ::close(wakeFds[0]);
+        ::close(wakeFds[1]);
+    }
+#endif
+}
+
+// new FdPump(device, endpointAddr, type, fd, nTransfers, transferSize, limit, callback)
+Napi::Value FdPump::Constructor(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    ENTER_CONSTRUCTOR(8);
+    UNWRAP_ARG(Device, device, 0);
+    int endpoint, type, fd, nTransfers, transferSize;
+    INT_ARG(endpoint, 1);
+    INT_ARG(type, 2);
+    INT_ARG(fd, 3);
+    INT_ARG(nTransfers, 4);
+    INT_ARG(transferSize, 5);
+    if (!info[6].IsNumber()) {
+        THROW_BAD_ARGS("Parameter limit (6) should be number");
+    }
+    double limit = info[6].As<Napi::Number>().DoubleValue();
+    CALLBACK_ARG(7);
+    if (fd < 0) {
+        THROW_BAD_ARGS("Invalid file descriptor");
+    }
+    if (nTransfers <= 0 || transferSize <= 0 || limit < 0) {
+        THROW_BAD_ARGS("nTransfers and transferSize must be positive");
+    }
+
+    info.This().As<Napi::Object>().DefineProperty(Napi::PropertyDescriptor::Value(std::string("device"), info[0], CONST_PROP));
+    this->fd = fd;
+    this->isIn = (endpoint & LIBUSB_ENDPOINT_IN) != 0;
+    this->transferSize = transferSize;
+    this->limit = (uint64_t) limit;
+    init(device, endpoint, type, nTransfers, transferSize, callback);
+    return info.This();
+}
+
+// IN transfers start straight away; the pump thread fills and submits the OUT
+// ones. The fd is switched to non-blocking mode while pumping, so that the
+// pump thread waits for it in poll() along with the wake pipe, which stop()
+// signals.
+void FdPump::startLocked(Napi::Env env) {
+#ifndef _WIN32
+    if (wakeFds[0] < 0) {
+        if (::pipe(wakeFds) < 0) {
+            throw Napi::Error::New(env, std::string("Cannot create the pump wake pipe: ") + strerror(errno));
+        }
+        for (int wakeFd : wakeFds) {
+            ::fcntl(wakeFd, F_SETFL, ::fcntl(wakeFd, F_GETFL) | O_NONBLOCK);
+            ::fcntl(wakeFd, F_SETFD, FD_CLOEXEC);
+        }
+    }
+#endif
+
+    if (isIn) {
+        NativePoll::startLocked(env);
+    } else {
+        for (auto transfer : transfers) {
+            transfer->dev_handle = device->device_handle;
+            ready.push_back(transfer);
+        }
+    }
+
+#ifndef _WIN32
+    fdFlags = ::fcntl(fd, F_GETFL);
+    if (fdFlags >= 0 && !(fdFlags & O_NONBLOCK)) {
+        ::fcntl(fd, F_SETFL, fdFlags | O_NONBLOCK);
+    }
+#endif
+    // The pump thread must not outlive the environment: stop and join it on teardown
+    napi_add_env_cleanup_hook(env, FdPump::cleanup, this);
+    thread = std::thread(&FdPump::run, this);
+}
+
+// Called with the lock held. Wakes the pump thread, also out of a read or
+// write on the fd.
+void FdPump::stopLocked() {
+    bool wasStopping = stopping;
+    NativePoll::stopLocked();
+    wake.notify_all();
+    if (wasStopping) {
+        return;
+    }
+#ifdef _WIN32
+    // There is no waiting on a CRT fd; abort the read or write in progress
+    // instead. One that has not started yet still runs to completion.
+    if (thread.joinable() && thread.get_id() != std::this_thread::get_id()) {
+        CancelSynchronousIo((HANDLE) thread.native_handle());
+    }
+#else
+    if (wakeFds[1] >= 0) {
+        char c = 0;
+        while (::write(wakeFds[1], &c, 1) < 0 && errno == EINTR) {}
+    }
+#endif
+}
+
+// Stop the pump and wait for its thread
+void FdPump::join() {
+    if (!thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopLocked();
+    }
+    thread.join();
+}
+
+// Environment teardown with the pump still running
+void FdPump::cleanup(void* arg) {
+    static_cast<FdPump*>(arg)->join();
+}
+
+// Called with the lock held
+bool FdPump::submitLocked(libusb_transfer* transfer) {
+    if (!NativePoll::submitLocked(transfer)) {
+        return false;
+    }
+    if (idleSince) {
+        idleTime += uv_hrtime() - idleSince;
+        idleSince = 0;
+    }
+    return true;
+}
+
+// Called with the lock held
+Napi::Object FdPump::statsObject(Napi::Env env) {
+    uint64_t idle = idleTime + (idleSince ? uv_hrtime() - idleSince : 0);
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("bytes", Napi::Number::New(env, (double) bytes));
+    result.Set("transfers", Napi::Number::New(env, (double) transfersDone));
+    result.Set("inFlight", Napi::Number::New(env, inFlight));
+    result.Set("queued", Napi::Number::New(env, isIn ? (double) ready.size() : 0));
+    result.Set("maxQueued", Napi::Number::New(env, (double) maxQueued));
+    result.Set("idleTime", Napi::Number::New(env, idle / 1e6));
+    return result;
+}
+
+// FdPump.stats() -> { bytes, transfers, inFlight, queued, maxQueued, idleTime }
+Napi::Value FdPump::Stats(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(FdPump, 0);
+    std::lock_guard<std::mutex> guard(self->lock);
+    return self->statsObject(env);
+}
+
+// On the libusb event thread. Completed transfers wait in `ready` for the
+// pump thread, which resubmits them.
+bool FdPump::receivedLocked(libusb_transfer* transfer) {
+    transfersDone++;
+    if (!isIn) {
+        bytes += transfer->actual_length;
+    }
+    ready.push_back(transfer);
+    if (isIn && ready.size() > maxQueued) {
+        maxQueued = ready.size();
+    }
+    return false;
+}
+
+void FdPump::completedLocked(libusb_transfer* transfer) {
+    if (inFlight == 0 && !stopping) {
+        idleSince = uv_hrtime();
+    }
+    wake.notify_all();
+}
+
+// Endpoint to fd: write out completed transfers in order, resubmitting each once written
+void FdPump::runIn() {
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        wake.wait(guard, [this] { return !ready.empty() || (stopping && inFlight == 0); });
+        if (ready.empty()) {
+            break;
+        }
+        libusb_transfer* transfer = ready.front();
+        ready.pop_front();
+        if (ioError) {
+            continue;
+        }
+
+        size_t length = transfer->actual_length;
+        if (limit && bytes + length > limit) {
+            length = (size_t) (limit - bytes);
+        }
+        guard.unlock();
+        int error = writeAll(fd, transfer->buffer, length, wakeFds[0]);
+        guard.lock();
+
+        if (error == ECANCELED) {
+            // Stopped while the fd was not writable: drop what is left
+            continue;
+        }
+        if (error) {
+            ioError = error;
+            stopLocked();
+            continue;
+        }
+        bytes += length;
+        if (limit && bytes >= limit) {
+            stopLocked();
+        } else if (!stopping) {
+            submitLocked(transfer);
+        }
+    }
+}
+
+// Fd to endpoint: fill free transfers from the fd and submit them, until end of file
+void FdPump::runOut() {
+    std::unique_lock<std::mutex> guard(lock);
+    uint64_t requested = 0;
+    for (;;) {
+        wake.wait(guard, [this] { return !ready.empty() || stopping; });
+        if (stopping) {
+            break;
+        }
+        libusb_transfer* transfer = ready.front();
+        ready.pop_front();
+
+        size_t length = transferSize;
+        if (limit && requested + length > limit) {
+            length = (size_t) (limit - requested);
+        }
+        guard.unlock();
+        long n = readSome(fd, transfer->buffer, length, wakeFds[0]);
+        guard.lock();
+
+        if (n == -ECANCELED) {
+            // Stopped while there was nothing to read
+            ready.push_back(transfer);
+            break;
+        }
+        if (n < 0) {
+            ioError = (int) -n;
+            stopLocked();
+            break;
+        }
+        if (n == 0) {
+            ready.push_back(transfer);
+            break;
+        }
+        requested += n;
+        transfer->length = (int) n;
+        if (!submitLocked(transfer) || (limit && requested >= limit)) {
+            break;
+        }
+    }
+
+    // Let the transfers in flight finish
+    wake.wait(guard, [this] { return inFlight == 0; });
+}
+
+// On the pump thread
+void FdPump::run() {
+    SetThreadName("node-usb pump");
+    if (isIn) {
+        runIn();
+    } else {
+        runOut();
+    }
+#ifndef _WIN32
+    if (fdFlags >= 0 && !(fdFlags & O_NONBLOCK)) {
+        ::fcntl(fd, F_SETFL, fdFlags);
+    }
+#endif
+    std::lock_guard<std::mutex> guard(lock);
+    finished = true;
+    notifyLocked();
+}
+
+Napi::Value FdPump::errorLocked(Napi::Env env) {
+    if (ioError) {
+        Napi::Error e = Napi::Error::New(env, std::string("Pump I/O error: ") + strerror(ioError));
+        e.Value().Set("errno", Napi::Number::New(env, ioError));
+        return e.Value();
+    }
+    return NativePoll::errorLocked(env);
+}
+
+void FdPump::ending() {
+    thread.join();
+    napi_remove_env_cleanup_hook(Env(), FdPump::cleanup, this);
+}
+
+std::vector<napi_value> FdPump::callbackArgs(Napi::Env env, Napi::Value error, bool ended) {
+    std::lock_guard<std::mutex> guard(lock);
+    return { error, statsObject(env) };
+}
+
+Napi::Object FdPump::Init(Napi::Env env, Napi::Object exports) {
+    exports.Set("FdPump", FdPump::DefineClass(
+        env,
+        "FdPump",
+        {
+            FdPump::InstanceMethod("start", &FdPump::Start),
+            FdPump::InstanceMethod("stop", &FdPump::Stop),
+            FdPump::InstanceMethod("stats", &FdPump::Stats),
+        }));
+
+    return exports;
+}
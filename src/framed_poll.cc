@@ -0,0 +1,245 @@
+#include "node_usb.h"
+#include "framer.h"
+#include <string.h>
+#include <math.h>
+
+// Frames handed to JS, only touched on the JS thread. Swapped with the
+// poll's vectors so that neither side reallocates in the steady state.
+static thread_local std::vector<uint8_t> jsFrames;
+static thread_local std::vector<uint32_t> jsEnds;
+static thread_local uint64_t jsFrameTime;
+
+static FramerConfig framerConfig(Napi::Env env, Napi::Object options) {
+    // Sizes and offsets: a non-negative integer that fits the 32-bit frame offsets
+    auto number = [&](const char* key, size_t fallback) {
+        Napi::Value value = options.Get(key);
+        if (value.IsUndefined()) {
+            return fallback;
+        }
+        double n = value.ToNumber().DoubleValue();
+        if (!(n >= 0 && n <= UINT32_MAX) || floor(n) != n) {
+            THROW_BAD_ARGS(std::string(key) + " must be a non-negative integer");
+        }
+        return (size_t) n;
+    };
+    auto flag = [&](const char* key, bool fallback) {
+        Napi::Value value = options.Get(key);
+        return value.IsUndefined() ? fallback : value.ToBoolean().Value();
+    };
+
+    FramerConfig config;
+    std::string mode = options.Get("mode").ToString().Utf8Value();
+    if (mode == "fixed") {
+        config.mode = FramerConfig::FIXED;
+    } else if (mode == "length") {
+        config.mode = FramerConfig::LENGTH;
+    } else if (mode == "delimiter") {
+        config.mode = FramerConfig::DELIMITER;
+    } else if (mode == "stream") {
+        config.mode = FramerConfig::STREAM;
+    } else {
+        THROW_BAD_ARGS("Framing mode must be 'fixed', 'length', 'delimiter' or 'stream'");
+    }
+
+    config.maxFrameSize = number("maxFrameSize", 65536);
+    config.size = number("size", 0);
+    config.lengthOffset = number("lengthOffset", 0);
+    config.lengthSize = number("lengthSize", 1);
+    config.littleEndian = flag("littleEndian", true);
+    config.lengthIncludesHeader = flag("lengthIncludesHeader", false);
+
+    Napi::Value crc = options.Get("crc");
+    if (!crc.IsUndefined()) {
+        std::string name = crc.ToString().Utf8Value();
+        if (name == "crc16-ccitt") {
+            config.crc = FramerConfig::CRC16_CCITT;
+        } else if (name == "crc16-modbus") {
+            config.crc = FramerConfig::CRC16_MODBUS;
+        } else if (name == "crc32") {
+            config.crc = FramerConfig::CRC32;
+        } else {
+            THROW_BAD_ARGS("CRC must be 'crc16-ccitt', 'crc16-modbus' or 'crc32'");
+        }
+        if (config.mode == FramerConfig::STREAM) {
+            THROW_BAD_ARGS("CRC cannot be used in stream mode");
+        }
+    }
+    // CCITT CRCs are conventionally sent big-endian, the others little-endian
+    config.crcLittleEndian = flag("crcLittleEndian", config.crc != FramerConfig::CRC16_CCITT);
+
+    Napi::Value delimiter = options.Get("delimiter");
+    if (delimiter.IsBuffer()) {
+        Napi::Buffer<uint8_t> buf = delimiter.As<Napi::Buffer<uint8_t>>();
+        config.delimiter.assign(buf.Data(), buf.Data() + buf.Length());
+    } else if (delimiter.IsString()) {
+        std::string str = delimiter.As<Napi::String>().Utf8Value();
+        config.delimiter.assign(str.begin(), str.end());
+    }
+
+    if (config.mode == FramerConfig::FIXED && (config.size == 0 || config.size > config.maxFrameSize)) {
+        THROW_BAD_ARGS("Fixed framing needs a size between 1 and maxFrameSize");
+    }
+    if (config.mode == FramerConfig::LENGTH && config.lengthSize != 1 && config.lengthSize != 2 && config.lengthSize != 4) {
+        THROW_BAD_ARGS("lengthSize must be 1, 2 or 4");
+    }
+    if (config.mode == FramerConfig::DELIMITER && config.delimiter.empty()) {
+        THROW_BAD_ARGS("Delimiter framing needs a non-empty delimiter");
+    }
+    return config;
+}
+
+FramerObject::FramerObject(const Napi::CallbackInfo& info) : Napi::ObjectWrap<FramerObject>(info) {
+    Constructor(info);
+}
+
+FramerObject::~FramerObject() {
+}
+
+// new Framer(framing)
+Napi::Value FramerObject::Constructor(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    ENTER_CONSTRUCTOR(1);
+    if (!info[0].IsObject()) {
+        THROW_BAD_ARGS("Framing options must be an object");
+    }
+    framer.reset(new Framer(framerConfig(env, info[0].As<Napi::Object>())));
+    return info.This();
+}
+
+// Framer.feed(data) -> [frame], the frames `data` completes
+Napi::Value FramerObject::Feed(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(FramerObject, 1);
+    if (!info[0].IsBuffer()) {
+        THROW_BAD_ARGS("Data must be a Buffer");
+    }
+    Napi::Buffer<uint8_t> buffer = info[0].As<Napi::Buffer<uint8_t>>();
+
+    std::vector<uint8_t> frames;
+    std::vector<uint32_t> ends;
+    self->framer->feed(buffer.Data(), buffer.Length(), frames, ends);
+
+    Napi::Array result = Napi::Array::New(env, ends.size());
+    uint32_t start = 0;
+    for (size_t i = 0; i < ends.size(); i++) {
+        result.Set(i, Napi::Buffer<uint8_t>::Copy(env, frames.data() + start, ends[i] - start));
+        start = ends[i];
+    }
+    return result;
+}
+
+// Framer.stats() -> { crcErrors, overflows }
+Napi::Value FramerObject::Stats(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(FramerObject, 0);
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("crcErrors", Napi::Number::New(env, (double) self->framer->crcErrors));
+    result.Set("overflows", Napi::Number::New(env, (double) self->framer->overflows));
+    return result;
+}
+
+Napi::Object FramerObject::Init(Napi::Env env, Napi::Object exports) {
+    exports.Set("Framer", FramerObject::DefineClass(
+        env,
+        "Framer",
+        {
+            FramerObject::InstanceMethod("feed", &FramerObject::Feed),
+            FramerObject::InstanceMethod("stats", &FramerObject::Stats),
+        }));
+
+    return exports;
+}
+
+FramedPoll::FramedPoll(const Napi::CallbackInfo& info)
+    : Napi::ObjectWrap<FramedPoll>(info), NativePoll(info.Env().GetInstanceData<ModuleData>(), "USBFramedPoll", "Polling already started"),
+      frameTime(0), frameCount(0) {
+    DEBUG_LOG("Created FramedPoll %p", this);
+    Constructor(info);
+}
+
+FramedPoll::~FramedPoll() {
+    DEBUG_LOG("Freed FramedPoll %p", this);
+}
+
+// new FramedPoll(device, endpointAddr, type, nTransfers, transferSize, framing, callback)
+Napi::Value FramedPoll::Constructor(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    ENTER_CONSTRUCTOR(7);
+    UNWRAP_ARG(Device, device, 0);
+    int endpoint, type, nTransfers, transferSize;
+    INT_ARG(endpoint, 1);
+    INT_ARG(type, 2);
+    INT_ARG(nTransfers, 3);
+    INT_ARG(transferSize, 4);
+    if (!info[5].IsObject()) {
+        THROW_BAD_ARGS("Framing options must be an object");
+    }
+    CALLBACK_ARG(6);
+    if (nTransfers <= 0 || transferSize <= 0) {
+        THROW_BAD_ARGS("nTransfers and transferSize must be positive");
+    }
+
+    framer.reset(new Framer(framerConfig(env, info[5].As<Napi::Object>())));
+
+    info.This().As<Napi::Object>().DefineProperty(Napi::PropertyDescriptor::Value(std::string("device"), info[0], CONST_PROP));
+    init(device, endpoint, type, nTransfers, transferSize, callback);
+    return info.This();
+}
+
+// FramedPoll.stats() -> { frames, crcErrors, overflows }
+Napi::Value FramedPoll::Stats(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(FramedPoll, 0);
+    Napi::Object result = Napi::Object::New(env);
+    std::lock_guard<std::mutex> guard(self->lock);
+    result.Set("frames", Napi::Number::New(env, (double) self->frameCount));
+    result.Set("crcErrors", Napi::Number::New(env, (double) self->framer->crcErrors));
+    result.Set("overflows", Napi::Number::New(env, (double) self->framer->overflows));
+    return result;
+}
+
+// On the libusb event thread
+bool FramedPoll::receivedLocked(libusb_transfer* transfer) {
+    size_t before = ends.size();
+    framer->feed(transfer->buffer, transfer->actual_length, frames, ends);
+    if (ends.size() != before) {
+        frameCount += ends.size() - before;
+        frameTime = uv_hrtime();
+    }
+    return true;
+}
+
+bool FramedPoll::pendingLocked() {
+    return !ends.empty();
+}
+
+bool FramedPoll::takeLocked() {
+    jsFrames.swap(frames);
+    jsEnds.swap(ends);
+    jsFrameTime = frameTime;
+    return !jsEnds.empty();
+}
+
+std::vector<napi_value> FramedPoll::callbackArgs(Napi::Env env, Napi::Value error, bool ended) {
+    Napi::Value data = env.Undefined();
+    Napi::Value v8ends = env.Undefined();
+    if (!jsEnds.empty()) {
+        data = Napi::Buffer<uint8_t>::Copy(env, jsFrames.data(), jsFrames.size());
+        Napi::Uint32Array offsets = Napi::Uint32Array::New(env, jsEnds.size());
+        memcpy(offsets.Data(), jsEnds.data(), jsEnds.size() * sizeof(uint32_t));
+        v8ends = offsets;
+    }
+    jsFrames.clear();
+    jsEnds.clear();
+    return { error, Napi::Boolean::New(env, ended), data, v8ends, Napi::Number::New(env, jsFrameTime / 1e6) };
+}
+
+Napi::Object FramedPoll::Init(Napi::Env env, Napi::Object exports) {
+    exports.Set("FramedPoll", FramedPoll::DefineClass(
+        env,
+        "FramedPoll",
+        {
+            FramedPoll::InstanceMethod("start", &FramedPoll::Start),
+            FramedPoll::InstanceMethod("stop", &FramedPoll::Stop),
+            FramedPoll::InstanceMethod("stats", &FramedPoll::Stats),
+        }));
+
+    return exports;
+}
@@ -0,0 +1,199 @@
+#include "framer.h"
+
+#include <algorithm>
+#include <array>
+
+typedef std::array<uint32_t, 256> CrcTable;
+
+// Table for a reflected (LSB first) CRC with polynomial `poly`
+static CrcTable reflectedTable(uint32_t poly) {
+    CrcTable table;
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int bit = 0; bit < 8; bit++) {
+            c = (c & 1) ? (c >> 1) ^ poly : c >> 1;
+        }
+        table[i] = c;
+    }
+    return table;
+}
+
+// CRC-16/CCITT-FALSE: polynomial 0x1021, MSB first, initial value 0xffff
+static uint32_t crc16Ccitt(const uint8_t* data, size_t length) {
+    static const CrcTable table = [] {
+        CrcTable t;
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i << 8;
+            for (int bit = 0; bit < 8; bit++) {
+                c = (c & 0x8000) ? (c << 1) ^ 0x1021 : c << 1;
+            }
+            t[i] = c & 0xffff;
+        }
+        return t;
+    }();
+
+    uint32_t crc = 0xffff;
+    for (size_t i = 0; i < length; i++) {
+        crc = ((crc << 8) ^ table[((crc >> 8) ^ data[i]) & 0xff]) & 0xffff;
+    }
+    return crc;
+}
+
+// CRC-16/MODBUS: polynomial 0x8005 reflected, initial value 0xffff
+static uint32_t crc16Modbus(const uint8_t* data, size_t length) {
+    static const CrcTable table = reflectedTable(0xa001);
+    uint32_t crc = 0xffff;
+    for (size_t i = 0; i < length; i++) {
+        crc = (crc >> 8) ^ table[(crc ^ data[i]) & 0xff];
+    }
+    return crc;
+}
+
+// CRC-32 as used by Ethernet and zlib
+static uint32_t crc32(const uint8_t* data, size_t length) {
+    static const CrcTable table = reflectedTable(0xedb88320);
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < length; i++) {
+        crc = (crc >> 8) ^ table[(crc ^ data[i]) & 0xff];
+    }
+    return ~crc;
+}
+
+static uint32_t readUInt(const uint8_t* p, size_t size, bool littleEndian) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < size; i++) {
+        size_t shift = littleEndian ? i : size - 1 - i;
+        value |= (uint32_t) p[i] << (8 * shift);
+    }
+    return value;
+}
+
+Framer::Framer(const FramerConfig& config)
+    : crcErrors(0), overflows(0), config(config), searched(0), discarding(false) {
+}
+
+void Framer::reset() {
+    partial.clear();
+    searched = 0;
+    discarding = false;
+}
+
+size_t Framer::crcSize() const {
+    switch (config.crc) {
+        case FramerConfig::CRC16_CCITT:
+        case FramerConfig::CRC16_MODBUS:
+            return 2;
+        case FramerConfig::CRC32:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+void Framer::feed(const uint8_t* data, size_t length, std::vector<uint8_t>& frames, std::vector<uint32_t>& ends) {
+    // Frame straight out of the transfer buffer, only copying what is left over
+    if (partial.empty()) {
+        size_t used = scan(data, length, frames, ends);
+        partial.assign(data + used, data + length);
+        return;
+    }
+
+    partial.insert(partial.end(), data, data + length);
+    size_t used = scan(partial.data(), partial.size(), frames, ends);
+    partial.erase(partial.begin(), partial.begin() + used);
+}
+
+// Emit the complete frames at the start of `data`, returning the number of bytes consumed
+size_t Framer::scan(const uint8_t* data, size_t length, std::vector<uint8_t>& frames, std::vector<uint32_t>& ends) {
+    size_t pos = 0;
+
+    switch (config.mode) {
+        case FramerConfig::FIXED:
+            while (length - pos >= config.size) {
+                emit(data + pos, config.size, frames, ends);
+                pos += config.size;
+            }
+            break;
+
+        case FramerConfig::LENGTH: {
+            size_t header = config.lengthOffset + config.lengthSize;
+            while (length - pos >= header) {
+                size_t value = readUInt(data + pos + config.lengthOffset, config.lengthSize, config.littleEndian);
+                size_t total = config.lengthIncludesHeader ? value : header + value + crcSize();
+                if (total < header + crcSize() || total > config.maxFrameSize) {
+                    // The stream is out of sync; drop what is buffered and start again with the next transfer
+                    overflows += length - pos;
+                    return length;
+                }
+                if (length - pos < total) {
+                    break;
+                }
+                emit(data + pos, total, frames, ends);
+                pos += total;
+            }
+            break;
+        }
+
+        case FramerConfig::DELIMITER: {
+            const std::vector<uint8_t>& delimiter = config.delimiter;
+            const uint8_t* end = data + length;
+            size_t from = searched;
+            for (;;) {
+                const uint8_t* found = std::search(data + from, end, delimiter.begin(), delimiter.end());
+                if (found == end) {
+                    break;
+                }
+                size_t frameLength = found - (data + pos);
+                if (discarding || frameLength > config.maxFrameSize) {
+                    overflows += frameLength;
+                    discarding = false;
+                } else if (frameLength > 0) {
+                    emit(data + pos, frameLength, frames, ends);
+                }
+                pos = from = (found - data) + delimiter.size();
+            }
+
+            size_t rest = length - pos;
+            if (discarding || rest > config.maxFrameSize) {
+                // Keep just enough to spot a delimiter split across transfers
+                size_t keep = std::min(rest, delimiter.size() - 1);
+                overflows += rest - keep;
+                pos = length - keep;
+                rest = keep;
+                discarding = true;
+            }
+            searched = rest >= delimiter.size() ? rest - delimiter.size() + 1 : 0;
+            break;
+        }
+
+        case FramerConfig::STREAM:
+            if (length > 0) {
+                emit(data, length, frames, ends);
+            }
+            pos = length;
+            break;
+    }
+
+    return pos;
+}
+
+void Framer::emit(const uint8_t* frame, size_t length, std::vector<uint8_t>& frames, std::vector<uint32_t>& ends) {
+    size_t n = crcSize();
+    if (n) {
+        if (length < n) {
+            crcErrors++;
+            return;
+        }
+        uint32_t expected = readUInt(frame + length - n, n, config.crcLittleEndian);
+        uint32_t actual = config.crc == FramerConfig::CRC32 ? crc32(frame, length - n)
+            : config.crc == FramerConfig::CRC16_MODBUS ? crc16Modbus(frame, length - n)
+            : crc16Ccitt(frame, length - n);
+        if (actual != expected) {
+            crcErrors++;
+            return;
+        }
+    }
+
+    frames.insert(frames.end(), frame, frame + length);
+    ends.push_back((uint32_t) frames.size());
+}
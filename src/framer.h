@@ -0,0 +1,48 @@
+#ifndef SRC_FRAMER_H
+#define SRC_FRAMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct FramerConfig {
+    enum Mode { FIXED, LENGTH, DELIMITER, STREAM };
+    enum Crc { CRC_NONE, CRC16_CCITT, CRC16_MODBUS, CRC32 };
+
+    Mode mode = FIXED;                 // STREAM: no framing, each transfer's data is passed on as it arrives
+    size_t size = 0;                   // FIXED: frame size
+    size_t lengthOffset = 0;           // LENGTH: bytes before the length field
+    size_t lengthSize = 1;             // LENGTH: width of the length field (1, 2 or 4)
+    bool littleEndian = true;          // LENGTH: byte order of the length field
+    bool lengthIncludesHeader = false; // LENGTH: the length counts the whole frame, not just the payload
+    std::vector<uint8_t> delimiter;    // DELIMITER: frame terminator, not included in frames
+    Crc crc = CRC_NONE;                // CRC in the last bytes of each frame, over the bytes before it
+    bool crcLittleEndian = false;
+    size_t maxFrameSize = 65536;
+};
+
+// Splits a byte stream into frames. Complete frames are appended back to back
+// to an output buffer with their end offsets; a trailing partial frame is kept
+// until more data arrives. Not thread safe.
+class Framer {
+public:
+    explicit Framer(const FramerConfig& config);
+
+    void feed(const uint8_t* data, size_t length, std::vector<uint8_t>& frames, std::vector<uint32_t>& ends);
+    void reset();
+
+    uint64_t crcErrors;  // frames dropped for a bad CRC
+    uint64_t overflows;  // bytes discarded for exceeding maxFrameSize or a bad length
+
+private:
+    size_t scan(const uint8_t* data, size_t length, std::vector<uint8_t>& frames, std::vector<uint32_t>& ends);
+    void emit(const uint8_t* frame, size_t length, std::vector<uint8_t>& frames, std::vector<uint32_t>& ends);
+    size_t crcSize() const;
+
+    FramerConfig config;
+    std::vector<uint8_t> partial;
+    size_t searched;  // DELIMITER: bytes of `partial` already searched
+    bool discarding;  // DELIMITER: dropping an oversized frame up to the next delimiter
+};
+
+#endif
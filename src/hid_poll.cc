@@ -0,0 +1,231 @@
+#include "node_usb.h"
+#include "hid_report.h"
+#include <string.h>
+
+// Reports handed to JS, only touched on the JS thread. Swapped with the
+// poll's vectors so that neither side reallocates in the steady state.
+static thread_local std::vector<int32_t> jsValues;
+static thread_local std::vector<uint8_t> jsIds;
+static thread_local std::vector<uint32_t> jsEnds;
+static thread_local uint64_t jsReportTime;
+
+static Napi::Object fieldObject(Napi::Env env, const HidField& field) {
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("valueIndex", Napi::Number::New(env, field.valueIndex));
+    result.Set("count", Napi::Number::New(env, field.count));
+    result.Set("bitOffset", Napi::Number::New(env, field.bitOffset));
+    result.Set("bitSize", Napi::Number::New(env, field.bitSize));
+    result.Set("flags", Napi::Number::New(env, field.flags));
+    result.Set("isArray", Napi::Boolean::New(env, field.isArray()));
+    result.Set("isRelative", Napi::Boolean::New(env, (field.flags & 0x04) != 0));
+    result.Set("usagePage", Napi::Number::New(env, field.usagePage));
+    Napi::Array usages = Napi::Array::New(env, field.usages.size());
+    for (size_t i = 0; i < field.usages.size(); i++) {
+        usages.Set(i, Napi::Number::New(env, field.usages[i]));
+    }
+    result.Set("usages", usages);
+    result.Set("logicalMinimum", Napi::Number::New(env, field.logicalMinimum));
+    result.Set("logicalMaximum", Napi::Number::New(env, field.logicalMaximum));
+    result.Set("physicalMinimum", Napi::Number::New(env, field.physicalMinimum));
+    result.Set("physicalMaximum", Napi::Number::New(env, field.physicalMaximum));
+    result.Set("unit", Napi::Number::New(env, field.unit));
+    result.Set("unitExponent", Napi::Number::New(env, field.unitExponent));
+    return result;
+}
+
+HidDecoder::HidDecoder(const Napi::CallbackInfo& info) : Napi::ObjectWrap<HidDecoder>(info) {
+    Constructor(info);
+}
+
+// new HidDecoder(reportDescriptor)
+Napi::Value HidDecoder::Constructor(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    ENTER_CONSTRUCTOR(1);
+    if (!info[0].IsBuffer()) {
+        THROW_BAD_ARGS("Report descriptor must be a Buffer");
+    }
+    Napi::Buffer<uint8_t> buffer = info[0].As<Napi::Buffer<uint8_t>>();
+
+    auto parsed = std::make_shared<HidReportDescriptor>();
+    std::string error = parsed->parse(buffer.Data(), buffer.Length());
+    if (!error.empty()) {
+        THROW_ERROR("Invalid HID report descriptor: " + error);
+    }
+    descriptor = parsed;
+    return info.This();
+}
+
+// HidDecoder.reports() -> [{ reportId, size, values, fields }]
+Napi::Value HidDecoder::Reports(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(HidDecoder, 0);
+    const HidReportDescriptor& descriptor = *self->descriptor;
+    Napi::Array result = Napi::Array::New(env, descriptor.reports.size());
+    for (size_t i = 0; i < descriptor.reports.size(); i++) {
+        const HidReportLayout& report = descriptor.reports[i];
+        Napi::Object v8report = Napi::Object::New(env);
+        v8report.Set("reportId", Napi::Number::New(env, report.id));
+        v8report.Set("size", Napi::Number::New(env, (double) (report.bytes() + (descriptor.numbered ? 1 : 0))));
+        v8report.Set("values", Napi::Number::New(env, report.values));
+        Napi::Array fields = Napi::Array::New(env, report.fields.size());
+        for (size_t j = 0; j < report.fields.size(); j++) {
+            fields.Set(j, fieldObject(env, report.fields[j]));
+        }
+        v8report.Set("fields", fields);
+        result.Set(i, v8report);
+    }
+    return result;
+}
+
+// HidDecoder.decode(report) -> { reportId, values } or undefined
+Napi::Value HidDecoder::Decode(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(HidDecoder, 1);
+    if (!info[0].IsBuffer()) {
+        THROW_BAD_ARGS("Report must be a Buffer");
+    }
+    Napi::Buffer<uint8_t> buffer = info[0].As<Napi::Buffer<uint8_t>>();
+
+    const HidReportLayout* layout = self->descriptor->layout(buffer.Data(), buffer.Length());
+    if (!layout) {
+        return env.Undefined();
+    }
+    Napi::Int32Array values = Napi::Int32Array::New(env, layout->values);
+    if (!self->descriptor->decode(buffer.Data(), buffer.Length(), values.Data(), &layout)) {
+        return env.Undefined();
+    }
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("reportId", Napi::Number::New(env, layout->id));
+    result.Set("values", values);
+    return result;
+}
+
+Napi::Object HidDecoder::Init(Napi::Env env, Napi::Object exports) {
+    exports.Set("HidDecoder", HidDecoder::DefineClass(
+        env,
+        "HidDecoder",
+        {
+            HidDecoder::InstanceMethod("reports", &HidDecoder::Reports),
+            HidDecoder::InstanceMethod("decode", &HidDecoder::Decode),
+        }));
+
+    return exports;
+}
+
+HidPoll::HidPoll(const Napi::CallbackInfo& info)
+    : Napi::ObjectWrap<HidPoll>(info), NativePoll(info.Env().GetInstanceData<ModuleData>(), "USBHidPoll", "Polling already started"),
+      reportTime(0), reportCount(0), dropped(0) {
+    DEBUG_LOG("Created HidPoll %p", this);
+    Constructor(info);
+}
+
+HidPoll::~HidPoll() {
+    DEBUG_LOG("Freed HidPoll %p", this);
+}
+
+// new HidPoll(device, endpointAddr, type, nTransfers, transferSize, decoder, callback)
+Napi::Value HidPoll::Constructor(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    ENTER_CONSTRUCTOR(7);
+    UNWRAP_ARG(Device, device, 0);
+    int endpoint, type, nTransfers, transferSize;
+    INT_ARG(endpoint, 1);
+    INT_ARG(type, 2);
+    INT_ARG(nTransfers, 3);
+    INT_ARG(transferSize, 4);
+    UNWRAP_ARG(HidDecoder, decoder, 5);
+    CALLBACK_ARG(6);
+    if (nTransfers <= 0 || transferSize <= 0) {
+        THROW_BAD_ARGS("nTransfers and transferSize must be positive");
+    }
+
+    info.This().As<Napi::Object>().DefineProperty(Napi::PropertyDescriptor::Value(std::string("device"), info[0], CONST_PROP));
+    this->descriptor = decoder->descriptor;
+    init(device, endpoint, type, nTransfers, transferSize, callback);
+    return info.This();
+}
+
+// HidPoll.stats() -> { reports, dropped }
+Napi::Value HidPoll::Stats(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(HidPoll, 0);
+    Napi::Object result = Napi::Object::New(env);
+    std::lock_guard<std::mutex> guard(self->lock);
+    result.Set("reports", Napi::Number::New(env, (double) self->reportCount));
+    result.Set("dropped", Napi::Number::New(env, (double) self->dropped));
+    return result;
+}
+
+// On the libusb event thread. A transfer may hold several reports sent back to back.
+bool HidPoll::receivedLocked(libusb_transfer* transfer) {
+    const uint8_t* data = transfer->buffer;
+    size_t length = transfer->actual_length;
+    size_t before = ends.size();
+    while (length > 0) {
+        const HidReportLayout* layout = descriptor->layout(data, length);
+        if (!layout) {
+            dropped++;
+            break;
+        }
+        size_t offset = values.size();
+        values.resize(offset + layout->values);
+        size_t used = descriptor->decode(data, length, values.data() + offset, &layout);
+        if (used == 0) {
+            values.resize(offset);
+            dropped++;
+            break;
+        }
+        ids.push_back(layout->id);
+        ends.push_back((uint32_t) values.size());
+        data += used;
+        length -= used;
+    }
+    if (ends.size() != before) {
+        reportCount += ends.size() - before;
+        reportTime = uv_hrtime();
+    }
+    return true;
+}
+
+bool HidPoll::pendingLocked() {
+    return !ends.empty();
+}
+
+bool HidPoll::takeLocked() {
+    jsValues.swap(values);
+    jsIds.swap(ids);
+    jsEnds.swap(ends);
+    jsReportTime = reportTime;
+    return !jsEnds.empty();
+}
+
+std::vector<napi_value> HidPoll::callbackArgs(Napi::Env env, Napi::Value error, bool ended) {
+    Napi::Value v8values = env.Undefined();
+    Napi::Value v8ids = env.Undefined();
+    Napi::Value v8ends = env.Undefined();
+    if (!jsEnds.empty()) {
+        Napi::Int32Array valueArray = Napi::Int32Array::New(env, jsValues.size());
+        memcpy(valueArray.Data(), jsValues.data(), jsValues.size() * sizeof(int32_t));
+        v8values = valueArray;
+        Napi::Uint8Array idArray = Napi::Uint8Array::New(env, jsIds.size());
+        memcpy(idArray.Data(), jsIds.data(), jsIds.size());
+        v8ids = idArray;
+        Napi::Uint32Array endArray = Napi::Uint32Array::New(env, jsEnds.size());
+        memcpy(endArray.Data(), jsEnds.data(), jsEnds.size() * sizeof(uint32_t));
+        v8ends = endArray;
+    }
+    jsValues.clear();
+    jsIds.clear();
+    jsEnds.clear();
+    return { error, Napi::Boolean::New(env, ended), v8values, v8ids, v8ends, Napi::Number::New(env, jsReportTime / 1e6) };
+}
+
+Napi::Object HidPoll::Init(Napi::Env env, Napi::Object exports) {
+    exports.Set("HidPoll", HidPoll::DefineClass(
+        env,
+        "HidPoll",
+        {
+            HidPoll::InstanceMethod("start", &HidPoll::Start),
+            HidPoll::InstanceMethod("stop", &HidPoll::Stop),
+            HidPoll::InstanceMethod("stats", &HidPoll::Stats),
+        }));
+
+    return exports;
+}
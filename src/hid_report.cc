@@ -0,0 +1,308 @@
+#include "hid_report.h"
+
+#include <algorithm>
+
+// Item types and tags of short items, HID 1.11 section 6.2.2
+enum { ITEM_MAIN = 0, ITEM_GLOBAL = 1, ITEM_LOCAL = 2 };
+
+enum {
+    MAIN_INPUT = 0x8, MAIN_OUTPUT = 0x9, MAIN_COLLECTION = 0xa, MAIN_FEATURE = 0xb, MAIN_END_COLLECTION = 0xc
+};
+
+enum {
+    GLOBAL_USAGE_PAGE = 0x0, GLOBAL_LOGICAL_MINIMUM = 0x1, GLOBAL_LOGICAL_MAXIMUM = 0x2, GLOBAL_PHYSICAL_MINIMUM = 0x3,
+    GLOBAL_PHYSICAL_MAXIMUM = 0x4, GLOBAL_UNIT_EXPONENT = 0x5, GLOBAL_UNIT = 0x6, GLOBAL_REPORT_SIZE = 0x7,
+    GLOBAL_REPORT_ID = 0x8, GLOBAL_REPORT_COUNT = 0x9, GLOBAL_PUSH = 0xa, GLOBAL_POP = 0xb
+};
+
+enum { LOCAL_USAGE = 0x0, LOCAL_USAGE_MINIMUM = 0x1, LOCAL_USAGE_MAXIMUM = 0x2 };
+
+// Limits that keep a malformed descriptor from allocating without bound
+static const uint32_t MAX_REPORT_COUNT = 4096;
+static const uint32_t MAX_REPORT_BITS = 64 * 1024 * 8;
+static const size_t MAX_USAGES = 65536;
+static const size_t MAX_STACK = 32;
+
+struct GlobalState {
+    uint32_t usagePage = 0;
+    int32_t logicalMinimum = 0;
+    int32_t logicalMaximum = 0;
+    int32_t physicalMinimum = 0;
+    int32_t physicalMaximum = 0;
+    int32_t unitExponent = 0;
+    uint32_t unit = 0;
+    uint32_t reportSize = 0;
+    uint32_t reportCount = 0;
+    uint8_t reportId = 0;
+    size_t logicalMaximumSize = 0; // bytes the Logical Maximum was given in
+};
+
+struct LocalUsage {
+    uint32_t value;
+    bool extended;  // 4 byte usage with its own page
+};
+
+struct LocalState {
+    std::vector<LocalUsage> usages;
+    uint32_t usageMinimum = 0;
+    bool haveMinimum = false;
+    bool minimumExtended = false;
+};
+
+static uint32_t unsignedData(const uint8_t* data, size_t size) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < size; i++) {
+        value |= (uint32_t) data[i] << (8 * i);
+    }
+    return value;
+}
+
+static int32_t signedData(const uint8_t* data, size_t size) {
+    uint32_t value = unsignedData(data, size);
+    if (size > 0 && size < 4 && (value & (1u << (8 * size - 1)))) {
+        value |= ~0u << (8 * size);
+    }
+    return (int32_t) value;
+}
+
+// Add a usage, resolving a short usage against the usage page in effect at the main item
+static bool addUsage(std::vector<uint32_t>& usages, uint32_t value, bool extended, uint32_t usagePage) {
+    if (usages.size() >= MAX_USAGES) {
+        return false;
+    }
+    usages.push_back(extended ? value : (usagePage << 16) | (value & 0xffff));
+    return true;
+}
+
+std::string HidReportDescriptor::parse(const uint8_t* data, size_t length) {
+    reports.clear();
+    numbered = false;
+    maxValues = 0;
+    std::fill(std::begin(index), std::end(index), -1);
+
+    GlobalState global;
+    std::vector<GlobalState> stack;
+    LocalState local;
+    int collectionDepth = 0;
+
+    for (size_t pos = 0; pos < length;) {
+        uint8_t prefix = data[pos];
+
+        // Long items carry no report data: skip them
+        if (prefix == 0xfe) {
+            if (pos + 2 >= length) {
+                return "Truncated long item";
+            }
+            pos += 3 + data[pos + 1];
+            continue;
+        }
+
+        size_t size = prefix & 0x03;
+        if (size == 3) {
+            size = 4;
+        }
+        int type = (prefix >> 2) & 0x03;
+        int tag = prefix >> 4;
+        if (pos + 1 + size > length) {
+            return "Truncated item";
+        }
+        const uint8_t* item = &data[pos + 1];
+        pos += 1 + size;
+
+        if (type == ITEM_MAIN) {
+            if (tag == MAIN_COLLECTION) {
+                collectionDepth++;
+            } else if (tag == MAIN_END_COLLECTION) {
+                if (--collectionDepth < 0) {
+                    return "End Collection without Collection";
+                }
+            } else if (tag == MAIN_INPUT) {
+                uint32_t flags = unsignedData(item, size);
+                if (global.reportSize == 0 || global.reportSize > 32) {
+                    return "Input item with a Report Size outside 1 to 32 bits";
+                }
+                if (global.reportCount > MAX_REPORT_COUNT) {
+                    return "Input item with too large a Report Count";
+                }
+                // Also keeps the bit offsets from wrapping, which would let decode() read past a short report
+                uint32_t fieldBits = global.reportSize * global.reportCount;
+                int existing = index[global.reportId];
+                if ((existing < 0 ? 0 : reports[existing].bits) > MAX_REPORT_BITS - fieldBits) {
+                    return "Report longer than 64 KiB";
+                }
+
+                int& slot = index[global.reportId];
+                if (slot < 0) {
+                    slot = (int) reports.size();
+                    reports.emplace_back();
+                    reports.back().id = global.reportId;
+                }
+                HidReportLayout& report = reports[slot];
+
+                HidField field;
+                field.bitOffset = report.bits;
+                field.bitSize = global.reportSize;
+                field.count = global.reportCount;
+                field.flags = flags;
+                field.logicalMinimum = global.logicalMinimum;
+                field.logicalMaximum = global.logicalMaximum;
+                // A maximum that only fits unsigned, e.g. 0xff in one byte with a minimum of 0
+                if (field.logicalMaximum < field.logicalMinimum && global.logicalMaximumSize > 0 && global.logicalMaximumSize < 4) {
+                    field.logicalMaximum = (int32_t) (field.logicalMaximum & ((1u << (8 * global.logicalMaximumSize)) - 1));
+                }
+                field.isSigned = field.logicalMinimum < 0;
+                field.physicalMinimum = global.physicalMinimum;
+                field.physicalMaximum = global.physicalMaximum;
+                field.unit = global.unit;
+                field.unitExponent = global.unitExponent;
+                field.usagePage = global.usagePage;
+
+                for (auto& usage : local.usages) {
+                    if (!addUsage(field.usages, usage.value, usage.extended, global.usagePage)) {
+                        return "Too many usages";
+                    }
+                }
+                report.bits += fieldBits;
+
+                // Constant fields are padding: they take up bits but no values
+                if (!(flags & 0x01) && field.count > 0) {
+                    field.valueIndex = report.values;
+                    report.values += field.count;
+                    report.fields.push_back(std::move(field));
+                }
+            }
+            // Output and Feature reports are not decoded, but consume their local state too
+            local = LocalState();
+        } else if (type == ITEM_GLOBAL) {
+            switch (tag) {
+            case GLOBAL_USAGE_PAGE: global.usagePage = unsignedData(item, size) & 0xffff; break;
+            case GLOBAL_LOGICAL_MINIMUM: global.logicalMinimum = signedData(item, size); break;
+            case GLOBAL_LOGICAL_MAXIMUM:
+                global.logicalMaximum = signedData(item, size);
+                global.logicalMaximumSize = size;
+                break;
+            case GLOBAL_PHYSICAL_MINIMUM: global.physicalMinimum = signedData(item, size); break;
+            case GLOBAL_PHYSICAL_MAXIMUM: global.physicalMaximum = signedData(item, size); break;
+            case GLOBAL_UNIT_EXPONENT: {
+                // A 4-bit signed nibble in practice
+                uint32_t value = unsignedData(item, size);
+                global.unitExponent = size == 1 && value < 16 ? (value & 0x8 ? (int32_t) value - 16 : (int32_t) value) : signedData(item, size);
+                break;
+            }
+            case GLOBAL_UNIT: global.unit = unsignedData(item, size); break;
+            case GLOBAL_REPORT_SIZE: global.reportSize = unsignedData(item, size); break;
+            case GLOBAL_REPORT_COUNT: global.reportCount = unsignedData(item, size); break;
+            case GLOBAL_REPORT_ID: {
+                uint32_t id = unsignedData(item, size);
+                if (id == 0 || id > 255) {
+                    return "Report ID outside 1 to 255";
+                }
+                global.reportId = (uint8_t) id;
+                numbered = true;
+                break;
+            }
+            case GLOBAL_PUSH:
+                if (stack.size() >= MAX_STACK) {
+                    return "Push nested too deeply";
+                }
+                stack.push_back(global);
+                break;
+            case GLOBAL_POP:
+                if (stack.empty()) {
+                    return "Pop without Push";
+                }
+                global = stack.back();
+                stack.pop_back();
+                break;
+            }
+        } else if (type == ITEM_LOCAL) {
+            uint32_t value = unsignedData(item, size);
+            if (tag == LOCAL_USAGE) {
+                if (local.usages.size() >= MAX_USAGES) {
+                    return "Too many usages";
+                }
+                local.usages.push_back({ value, size == 4 });
+            } else if (tag == LOCAL_USAGE_MINIMUM) {
+                local.usageMinimum = value;
+                local.haveMinimum = true;
+                local.minimumExtended = size == 4;
+            } else if (tag == LOCAL_USAGE_MAXIMUM && local.haveMinimum) {
+                if (value < local.usageMinimum || value - local.usageMinimum >= MAX_USAGES - local.usages.size()) {
+                    return "Bad usage range";
+                }
+                // Count rather than compare against the maximum, which may be 0xFFFFFFFF
+                uint32_t count = value - local.usageMinimum + 1;
+                for (uint32_t i = 0; i < count; i++) {
+                    local.usages.push_back({ local.usageMinimum + i, local.minimumExtended || size == 4 });
+                }
+                local.haveMinimum = false;
+            }
+        }
+    }
+
+    if (collectionDepth != 0) {
+        return "Collection without End Collection";
+    }
+    if (numbered && index[0] >= 0) {
+        return "Input items both with and without a Report ID";
+    }
+    for (auto& report : reports) {
+        maxValues = std::max(maxValues, report.values);
+    }
+    return "";
+}
+
+const HidReportLayout* HidReportDescriptor::layout(const uint8_t* data, size_t length) const {
+    if (numbered && length == 0) {
+        return NULL;
+    }
+    int slot = index[numbered ? data[0] : 0];
+    return slot < 0 ? NULL : &reports[slot];
+}
+
+// Read `bitSize` bits starting `bitOffset` bits into `data`, least significant bit first
+static inline uint32_t extractBits(const uint8_t* data, uint32_t bitOffset, uint32_t bitSize) {
+    const uint8_t* p = data + bitOffset / 8;
+    uint32_t shift = bitOffset % 8;
+    uint32_t bytes = (shift + bitSize + 7) / 8;
+    uint64_t raw = 0;
+    for (uint32_t i = 0; i < bytes; i++) {
+        raw |= (uint64_t) p[i] << (8 * i);
+    }
+    raw >>= shift;
+    return bitSize == 32 ? (uint32_t) raw : (uint32_t) (raw & ((1ull << bitSize) - 1));
+}
+
+size_t HidReportDescriptor::decode(const uint8_t* data, size_t length, int32_t* values, const HidReportLayout** result) const {
+    const HidReportLayout* report = layout(data, length);
+    *result = report;
+    if (!report) {
+        return 0;
+    }
+    size_t header = numbered ? 1 : 0;
+    if (length < header + report->bytes()) {
+        return 0;
+    }
+    const uint8_t* payload = data + header;
+
+    for (const HidField& field : report->fields) {
+        uint32_t signBit = 1u << (field.bitSize - 1);
+        for (uint32_t i = 0; i < field.count; i++) {
+            uint32_t raw = extractBits(payload, field.bitOffset + i * field.bitSize, field.bitSize);
+            int32_t value = (int32_t) raw;
+            if (field.isSigned && field.bitSize < 32 && (raw & signBit)) {
+                value = (int32_t) (raw | ~((signBit << 1) - 1));
+            }
+
+            if (field.isArray()) {
+                // The value selects one of the field's usages
+                int64_t n = (int64_t) value - field.logicalMinimum;
+                value = (n >= 0 && n < (int64_t) field.usages.size() && value <= field.logicalMaximum)
+                    ? (int32_t) (field.usages[(size_t) n] & 0xffff)
+                    : 0;
+            }
+            values[field.valueIndex + i] = value;
+        }
+    }
+    return header + report->bytes();
+}
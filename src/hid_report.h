@@ -0,0 +1,64 @@
+#ifndef SRC_HID_REPORT_H
+#define SRC_HID_REPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// One Input main item of a HID report descriptor, compiled to the position
+// of its values in the report.
+struct HidField {
+    uint32_t bitOffset = 0;    // from the start of the report, after any report ID byte
+    uint32_t bitSize = 0;      // 1 to 32
+    uint32_t count = 0;        // values in the report
+    uint32_t valueIndex = 0;   // first slot of the field in the decoded values
+    uint32_t flags = 0;        // Input item data: bit 1 variable, bit 2 relative, ...
+    bool isSigned = false;     // logicalMinimum < 0, so values are sign-extended
+    int32_t logicalMinimum = 0;
+    int32_t logicalMaximum = 0;
+    int32_t physicalMinimum = 0;
+    int32_t physicalMaximum = 0;
+    uint32_t unit = 0;
+    int32_t unitExponent = 0;
+    uint32_t usagePage = 0;
+    std::vector<uint32_t> usages; // extended usages, (page << 16) | id
+
+    inline bool isArray() const { return !(flags & 0x02); }
+};
+
+struct HidReportLayout {
+    uint8_t id = 0;            // 0 when the descriptor does not use report IDs
+    uint32_t bits = 0;         // report length, excluding the report ID byte
+    uint32_t values = 0;       // decoded value slots
+    std::vector<HidField> fields;
+
+    inline size_t bytes() const { return (bits + 7) / 8; }
+};
+
+// Compiles the Input reports of a HID report descriptor, then extracts the
+// values of a report in one pass over its fields. Variable fields decode to
+// one value per control; array fields decode to the usage ID each slot
+// selects, or 0 for none. Not thread safe to parse; decoding is const.
+class HidReportDescriptor {
+public:
+    // Returns an empty string, or what is wrong with the descriptor
+    std::string parse(const uint8_t* data, size_t length);
+
+    // Layout of the report at the start of `data`, or NULL for an unknown report ID
+    const HidReportLayout* layout(const uint8_t* data, size_t length) const;
+
+    // Decode the report at the start of `data` into `values`, which must hold
+    // layout->values. Returns the bytes consumed, or 0 if the report is
+    // unknown or shorter than its layout.
+    size_t decode(const uint8_t* data, size_t length, int32_t* values, const HidReportLayout** layout) const;
+
+    std::vector<HidReportLayout> reports;
+    bool numbered = false;     // reports start with a report ID byte
+    uint32_t maxValues = 0;    // most values of any report
+
+private:
+    int index[256];            // reports[] entry by report ID, or -1
+};
+
+#endif
@@ -1,92 +1,235 @@
-#include "hotplug.h"
-
-struct HotPlug {
-    libusb_device* device;
-    libusb_hotplug_event event;
-    Napi::ObjectReference* hotplugThis;
-};
-
-int LIBUSB_CALL hotplug_callback(libusb_context* ctx, libusb_device* device, libusb_hotplug_event event, void* user_data) {
-    libusb_ref_device(device);
-    ModuleData* instanceData = (ModuleData*)user_data;
-    instanceData->hotplugQueue.post(new HotPlug {device, event, &instanceData->hotplugThis});
-    return 0;
-}
-
-class HotPlugManagerLibUsb: public HotPlugManager {
-    bool supportedHotplugEvents() {
-        int res = libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG);
-        return res > 0;
-    }
-
-    void enableHotplug(const Napi::Env& env, ModuleData* instanceData) {
-        libusb_context* usb_context = instanceData->usb_context;
+#include "hotplug.h"
+
+#include <algorithm>
+
+struct HotPlug {
+    std::vector<HotPlugEvent> events;
+    Napi::ObjectReference* hotplugThis;
+};
+
+// A burst of events, e.g. from a hub power cycling, is held back for at most this many settle windows
+static const int MAX_SETTLE_WINDOWS = 10;
+
+// Add an event to the batch held back for the settle window, coalesced per
+// device: a repeated event is dropped, and a device that arrives and leaves
+// again within the batch is dropped altogether. Every event pushes the
+// deadline back to a settle window from now, up to MAX_SETTLE_WINDOWS after
+// the first event of the batch. Returns the references to `device` the batch
+// does not keep, for the caller to give back.
+static int settleHotplugEvent(std::vector<HotPlugEvent>& pending, std::chrono::steady_clock::time_point& first,
+                              std::chrono::steady_clock::time_point& deadline, libusb_device* device, libusb_hotplug_event event,
+                              std::chrono::steady_clock::time_point now, int settleMs) {
+    if (pending.empty()) {
+        first = now;
+    }
+    deadline = std::min(now + std::chrono::milliseconds(settleMs), first + std::chrono::milliseconds(settleMs) * MAX_SETTLE_WINDOWS);
+
+    auto last = std::find_if(pending.rbegin(), pending.rend(), [device](const HotPlugEvent& e) { return e.device == device; });
+    if (last != pending.rend()) {
+        if (last->event == event) {
+            // Repeated event
+            return 1;
+        }
+        if (last->event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+            // Arrived and left within the window: JS never needs to see it
+            pending.erase(std::next(last).base());
+            return 2;
+        }
+    }
+    pending.push_back({ device, event });
+    return 0;
+}
+
+int LIBUSB_CALL hotplug_callback(libusb_context* ctx, libusb_device* device, libusb_hotplug_event event, void* user_data) {
+    libusb_ref_device(device);
+    ModuleData* instanceData = (ModuleData*)user_data;
+
+    int settleMs = instanceData->hotplugSettleMs;
+    if (settleMs <= 0) {
+        instanceData->hotplugQueue.post(new HotPlug { { { device, event } }, &instanceData->hotplugThis });
+        return 0;
+    }
+
+    // Hold the event until the window closes, see ModuleData::flushHotplug()
+    std::lock_guard<std::mutex> guard(instanceData->hotplugLock);
+    int released = settleHotplugEvent(instanceData->hotplugPending, instanceData->hotplugFirst, instanceData->hotplugDeadline,
+        device, event, std::chrono::steady_clock::now(), settleMs);
+    for (int i = 0; i < released; i++) {
+        libusb_unref_device(device);
+    }
+    return 0;
+}
+
+// _settleHotplugEvents(settleMs, [[timeMs, deviceId, arrived], ...]) -> batches of [deviceId, arrived]
+// Runs events through the settle window on a simulated clock, batching them
+// as the event thread would post them (each batch ends in one `change`), so
+// the coalescing rules can be tested without hotplugging devices.
+Napi::Value SettleHotplugEvents(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::HandleScope scope(env);
+    CHECK_N_ARGS(2);
+    int settleMs;
+    INT_ARG(settleMs, 0);
+    if (settleMs <= 0 || !info[1].IsArray()) {
+        THROW_BAD_ARGS("Expected a positive settle time and an array of events");
+    }
+    Napi::Array events = info[1].As<Napi::Array>();
+
+    std::vector<HotPlugEvent> pending;
+    std::chrono::steady_clock::time_point first, deadline;
+    Napi::Array batches = Napi::Array::New(env);
+    auto flush = [&]() {
+        Napi::Array batch = Napi::Array::New(env, pending.size());
+        for (size_t i = 0; i < pending.size(); i++) {
+            Napi::Array e = Napi::Array::New(env, 2);
+            e.Set((uint32_t) 0, Napi::Number::New(env, (double) reinterpret_cast<uintptr_t>(pending[i].device)));
+            e.Set((uint32_t) 1, Napi::Boolean::New(env, pending[i].event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED));
+            batch.Set(i, e);
+        }
+        batches.Set(batches.Length(), batch);
+        pending.clear();
+    };
+
+    for (uint32_t i = 0; i < events.Length(); i++) {
+        Napi::Array e = events.Get(i).As<Napi::Array>();
+        auto now = std::chrono::steady_clock::time_point() + std::chrono::milliseconds(e.Get((uint32_t) 0).ToNumber().Int64Value());
+        libusb_device* device = reinterpret_cast<libusb_device*>((uintptr_t) e.Get((uint32_t) 1).ToNumber().Int64Value());
+        libusb_hotplug_event event = e.Get((uint32_t) 2).ToBoolean() ? LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED : LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT;
+        if (!pending.empty() && now >= deadline) {
+            flush();
+        }
+        settleHotplugEvent(pending, first, deadline, device, event, now, settleMs);
+    }
+    if (!pending.empty()) {
+        flush();
+    }
+    return batches;
+}
+
+// On the libusb event thread: post the pending events as one batch once the settle window has passed
+void ModuleData::flushHotplug(struct timeval* nextTimeout) {
+    std::lock_guard<std::mutex> guard(hotplugLock);
+    if (hotplugPending.empty()) {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (now >= hotplugDeadline) {
+        hotplugQueue.post(new HotPlug { std::move(hotplugPending), &hotplugThis });
+        hotplugPending.clear();
+        return;
+    }
+
+    int64_t wait = std::chrono::duration_cast<std::chrono::microseconds>(hotplugDeadline - now).count();
+    if (wait < (int64_t) nextTimeout->tv_sec * 1000000 + nextTimeout->tv_usec) {
+        nextTimeout->tv_sec = (long) (wait / 1000000);
+        nextTimeout->tv_usec = (long) (wait % 1000000);
+    }
+}
+
+void ModuleData::discardHotplug() {
+    std::lock_guard<std::mutex> guard(hotplugLock);
+    for (auto& e : hotplugPending) {
+        libusb_unref_device(e.device);
+    }
+    hotplugPending.clear();
+}
+
+class HotPlugManagerLibUsb: public HotPlugManager {
+    bool supportedHotplugEvents() {
+        int res = libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG);
+        return res > 0;
+    }
+
+    void enableHotplug(const Napi::Env& env, ModuleData* instanceData) {
+        libusb_context* usb_context = instanceData->usb_context;
         CHECK_USB_CLEANUP(libusb_hotplug_register_callback(
             usb_context,
             (libusb_hotplug_event)(LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
             (libusb_hotplug_flag)0,
-            LIBUSB_HOTPLUG_MATCH_ANY,
-            LIBUSB_HOTPLUG_MATCH_ANY,
-            LIBUSB_HOTPLUG_MATCH_ANY,
+            LIBUSB_HOTPLUG_MATCH_ANY,
+            LIBUSB_HOTPLUG_MATCH_ANY,
+            LIBUSB_HOTPLUG_MATCH_ANY,
             hotplug_callback,
             instanceData,
             &hotplugHandle
         ), {
             instanceData->hotplugQueue.stop();
             instanceData->hotplugThis.Reset();
+            instanceData->hotplugContext.reset();
         });
     }
-
-    void disableHotplug(const Napi::Env& env, ModuleData* instanceData) {
-        libusb_context* usb_context = instanceData->usb_context;
-        libusb_hotplug_deregister_callback(usb_context, hotplugHandle);
-    }
-    
-    libusb_hotplug_callback_handle hotplugHandle;
-};
-
-std::unique_ptr<HotPlugManager> HotPlugManager::create() {
-    return std::make_unique<HotPlugManagerLibUsb>();
-}
-
-void handleHotplug(HotPlug* info) {
-    Napi::ObjectReference* hotplugThis = info->hotplugThis;
-    Napi::Env env = hotplugThis->Env();
-    Napi::HandleScope scope(env);
-
-    libusb_device* dev = info->device;
-    libusb_hotplug_event event = info->event;
-    delete info;
-
-    DEBUG_LOG("HandleHotplug %p %i", dev, event);
-
-    Napi::Object v8dev = Device::get(env, dev);
-    libusb_unref_device(dev);
-
-    Napi::Object v8VidPid = Napi::Object::New(env);
-    auto deviceDescriptor = v8dev.Get("deviceDescriptor");
-    if (deviceDescriptor.IsObject()) {
-        v8VidPid.Set("idVendor", deviceDescriptor.As<Napi::Object>().Get("idVendor"));
-        v8VidPid.Set("idProduct", deviceDescriptor.As<Napi::Object>().Get("idProduct"));
-    }
-
-    Napi::String eventName;
-    Napi::String changeEventName;
-    if (LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED == event) {
-        DEBUG_LOG("Device arrived");
-        eventName = Napi::String::New(env, "attach");
-        changeEventName = Napi::String::New(env, "attachIds");
-
-    } else if (LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT == event) {
-        DEBUG_LOG("Device left");
-        eventName = Napi::String::New(env, "detach");
-        changeEventName = Napi::String::New(env, "detachIds");
-
-    } else {
-        DEBUG_LOG("Unhandled hotplug event %d\n", event);
-        return;
-    }
-
-    hotplugThis->Get("emit").As<Napi::Function>().MakeCallback(hotplugThis->Value(), { eventName, v8dev });
-    hotplugThis->Get("emit").As<Napi::Function>().MakeCallback(hotplugThis->Value(), { changeEventName, v8VidPid });
-}
+
+    void disableHotplug(const Napi::Env& env, ModuleData* instanceData) {
+        libusb_context* usb_context = instanceData->usb_context;
+        libusb_hotplug_deregister_callback(usb_context, hotplugHandle);
+        instanceData->discardHotplug();
+    }
+    
+    libusb_hotplug_callback_handle hotplugHandle;
+};
+
+std::unique_ptr<HotPlugManager> HotPlugManager::create() {
+    return std::make_unique<HotPlugManagerLibUsb>();
+}
+
+void handleHotplug(HotPlug* info) {
+    Napi::ObjectReference* hotplugThis = info->hotplugThis;
+    Napi::Env env = hotplugThis->Env();
+    Napi::HandleScope scope(env);
+
+    std::vector<HotPlugEvent> events = std::move(info->events);
+    delete info;
+
+    Napi::Function emit = hotplugThis->Get("emit").As<Napi::Function>();
+    // Events still queued when hotplug was disabled are emitted without a context
+    ModuleData* instanceData = env.GetInstanceData<ModuleData>();
+    napi_async_context context = instanceData->hotplugContext ? (napi_async_context) *instanceData->hotplugContext : nullptr;
+    Napi::Array attached = Napi::Array::New(env);
+    Napi::Array detached = Napi::Array::New(env);
+
+    for (auto& e : events) {
+        libusb_device* dev = e.device;
+        libusb_hotplug_event event = e.event;
+
+        DEBUG_LOG("HandleHotplug %p %i", dev, event);
+
+        Napi::Object v8dev = Device::get(env, dev);
+        libusb_unref_device(dev);
+
+        Napi::Object v8VidPid = Napi::Object::New(env);
+        auto deviceDescriptor = v8dev.Get("deviceDescriptor");
+        if (deviceDescriptor.IsObject()) {
+            v8VidPid.Set("idVendor", deviceDescriptor.As<Napi::Object>().Get("idVendor"));
+            v8VidPid.Set("idProduct", deviceDescriptor.As<Napi::Object>().Get("idProduct"));
+        }
+
+        Napi::String eventName;
+        Napi::String changeEventName;
+        if (LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED == event) {
+            DEBUG_LOG("Device arrived");
+            eventName = Napi::String::New(env, "attach");
+            changeEventName = Napi::String::New(env, "attachIds");
+            attached.Set(attached.Length(), v8dev);
+
+        } else if (LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT == event) {
+            DEBUG_LOG("Device left");
+            eventName = Napi::String::New(env, "detach");
+            changeEventName = Napi::String::New(env, "detachIds");
+            detached.Set(detached.Length(), v8dev);
+
+        } else {
+            DEBUG_LOG("Unhandled hotplug event %d\n", event);
+            continue;
+        }
+
+        emit.MakeCallback(hotplugThis->Value(), { eventName, v8dev }, context);
+        emit.MakeCallback(hotplugThis->Value(), { changeEventName, v8VidPid }, context);
+    }
+
+    // One change set per batch
+    Napi::Object change = Napi::Object::New(env);
+    change.Set("attached", attached);
+    change.Set("detached", detached);
+    emit.MakeCallback(hotplugThis->Value(), { Napi::String::New(env, "change"), change }, context);
+}
@@ -0,0 +1,106 @@
+#include "node_usb.h"
+
+LatestPoll::LatestPoll(const Napi::CallbackInfo& info)
+    : Napi::ObjectWrap<LatestPoll>(info), NativePoll(info.Env().GetInstanceData<ModuleData>(), "USBLatestPoll", "Polling already started"),
+      latestTime(0), reports(0), dropped(0), unread(false), armed(false), signalled(false) {
+    DEBUG_LOG("Created LatestPoll %p", this);
+    Constructor(info);
+}
+
+LatestPoll::~LatestPoll() {
+    DEBUG_LOG("Freed LatestPoll %p", this);
+}
+
+// new LatestPoll(device, endpointAddr, type, nTransfers, transferSize, callback)
+Napi::Value LatestPoll::Constructor(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    ENTER_CONSTRUCTOR(6);
+    UNWRAP_ARG(Device, device, 0);
+    int endpoint, type, nTransfers, transferSize;
+    INT_ARG(endpoint, 1);
+    INT_ARG(type, 2);
+    INT_ARG(nTransfers, 3);
+    INT_ARG(transferSize, 4);
+    CALLBACK_ARG(5);
+    if (nTransfers <= 0 || transferSize <= 0) {
+        THROW_BAD_ARGS("nTransfers and transferSize must be positive");
+    }
+
+    info.This().As<Napi::Object>().DefineProperty(Napi::PropertyDescriptor::Value(std::string("device"), info[0], CONST_PROP));
+    latest.reserve(transferSize);
+    init(device, endpoint, type, nTransfers, transferSize, callback);
+    return info.This();
+}
+
+// LatestPoll.read() -> { data, completeTime, reports, dropped }
+Napi::Value LatestPoll::Read(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(LatestPoll, 0);
+    Napi::Object result = Napi::Object::New(env);
+    std::lock_guard<std::mutex> guard(self->lock);
+    if (self->reports > 0) {
+        result.Set("data", Napi::Buffer<unsigned char>::Copy(env, self->latest.data(), self->latest.size()));
+        result.Set("completeTime", Napi::Number::New(env, self->latestTime / 1e6));
+    }
+    result.Set("reports", Napi::Number::New(env, (double) self->reports));
+    result.Set("dropped", Napi::Number::New(env, (double) self->dropped));
+    self->unread = false;
+    return result;
+}
+
+// LatestPoll.arm(): call back once for the next report, or now if there is an unread one
+Napi::Value LatestPoll::Arm(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(LatestPoll, 0);
+    std::lock_guard<std::mutex> guard(self->lock);
+    if (self->unread && !self->stopping) {
+        self->armed = false;
+        self->signalled = true;
+        self->notifyLocked();
+    } else {
+        self->armed = true;
+    }
+    return env.Undefined();
+}
+
+// On the libusb event thread
+bool LatestPoll::receivedLocked(libusb_transfer* transfer) {
+    if (unread) {
+        dropped++;
+    }
+    latest.assign(transfer->buffer, transfer->buffer + transfer->actual_length);
+    latestTime = uv_hrtime();
+    reports++;
+    unread = true;
+    if (armed) {
+        armed = false;
+        signalled = true;
+    }
+    return true;
+}
+
+bool LatestPoll::pendingLocked() {
+    return signalled;
+}
+
+// The report itself is read with read(), so there is nothing to hand over
+bool LatestPoll::takeLocked() {
+    signalled = false;
+    return false;
+}
+
+std::vector<napi_value> LatestPoll::callbackArgs(Napi::Env env, Napi::Value error, bool ended) {
+    return { error, Napi::Boolean::New(env, ended) };
+}
+
+Napi::Object LatestPoll::Init(Napi::Env env, Napi::Object exports) {
+    exports.Set("LatestPoll", LatestPoll::DefineClass(
+        env,
+        "LatestPoll",
+        {
+            LatestPoll::InstanceMethod("start", &LatestPoll::Start),
+            LatestPoll::InstanceMethod("stop", &LatestPoll::Stop),
+            LatestPoll::InstanceMethod("read", &LatestPoll::Read),
+            LatestPoll::InstanceMethod("arm", &LatestPoll::Arm),
+        }));
+
+    return exports;
+}
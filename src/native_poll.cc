@@ -0,0 +1,198 @@
+#include "node_usb.h"
+#include "capture.h"
+
+extern "C" void LIBUSB_CALL nativePollCompletionCb(libusb_transfer *transfer);
+
+NativePoll::NativePoll(ModuleData* instanceData, const char* resourceName, const char* startedMessage)
+    : device(NULL), instanceData(instanceData), notifyQueue(NativePoll::handleNotify), resourceName(resourceName), startedMessage(startedMessage),
+      notifyPending(false), started(false), stopping(false), endReported(false),
+      inFlight(0), status(LIBUSB_TRANSFER_COMPLETED), submitError(0) {
+}
+
+NativePoll::~NativePoll() {
+    v8callback.Reset();
+    for (auto transfer : transfers) {
+        libusb_free_transfer(transfer);
+    }
+}
+
+// Allocate the transfers, with their buffers back to back
+void NativePoll::init(Device* device, int endpoint, int type, int nTransfers, int transferSize, Napi::Function callback) {
+    this->device = device;
+    buffers.resize((size_t) nTransfers * transferSize);
+
+    for (int i = 0; i < nTransfers; i++) {
+        libusb_transfer* transfer = libusb_alloc_transfer(0);
+        transfer->endpoint = endpoint;
+        transfer->type = type;
+        transfer->timeout = 0;
+        transfer->buffer = &buffers[(size_t) i * transferSize];
+        transfer->length = transferSize;
+        transfer->callback = nativePollCompletionCb;
+        transfer->user_data = this;
+        transfers.push_back(transfer);
+    }
+
+    v8callback.Reset(callback, 1);
+}
+
+// start()
+Napi::Value NativePoll::Start(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(NativePoll, 0);
+    if (self->started) {
+        THROW_ERROR(self->startedMessage);
+    }
+    if (!self->device->device_handle) {
+        THROW_ERROR("Device is not open");
+    }
+
+    {
+        // Completions wait for the lock, so cannot post before the queue is started
+        std::lock_guard<std::mutex> guard(self->lock);
+        self->startLocked(env);
+        self->started = true;
+        self->asyncContext.reset(new Napi::AsyncContext(env, self->resourceName, info.This().As<Napi::Object>()));
+        self->notifyQueue.start(env);
+        self->ref();
+        self->device->ref();
+    }
+    return env.Undefined();
+}
+
+void NativePoll::startLocked(Napi::Env env) {
+    for (auto transfer : transfers) {
+        transfer->dev_handle = device->device_handle;
+        if (!submitLocked(transfer)) {
+            if (inFlight == 0) {
+                // Nothing started: leave it as it was, to be started again
+                int r = submitError;
+                submitError = 0;
+                stopping = false;
+                throw libusbException(env, r);
+            }
+            break;
+        }
+    }
+}
+
+// Called with the lock held; a failure ends the poll
+bool NativePoll::submitLocked(libusb_transfer* transfer) {
+    captureTransfer(instanceData, 'S', transfer);
+    int r = libusb_submit_transfer(transfer);
+    if (r < LIBUSB_SUCCESS) {
+        captureTransfer(instanceData, 'E', transfer, r);
+        if (submitError == 0) {
+            submitError = r;
+        }
+        stopLocked();
+        return false;
+    }
+    inFlight++;
+    return true;
+}
+
+// Called with the lock held
+void NativePoll::stopLocked() {
+    if (stopping) {
+        return;
+    }
+    stopping = true;
+    for (auto transfer : transfers) {
+        libusb_cancel_transfer(transfer);
+    }
+}
+
+// stop()
+Napi::Value NativePoll::Stop(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(NativePoll, 0);
+    std::lock_guard<std::mutex> guard(self->lock);
+    self->stopLocked();
+    return env.Undefined();
+}
+
+// Called with the lock held. Whatever arrives before JS picks up the last
+// notification joins it; posting under the lock keeps JS from seeing the end
+// and stopping the queue before the post.
+void NativePoll::notifyLocked() {
+    if (!notifyPending) {
+        notifyPending = true;
+        notifyQueue.post(this);
+    }
+}
+
+// On the libusb event thread
+void NativePoll::completed(libusb_transfer* transfer) {
+    std::lock_guard<std::mutex> guard(lock);
+    inFlight--;
+
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+        if (receivedLocked(transfer) && !stopping) {
+            submitLocked(transfer);
+        }
+    } else if (!stopping || transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+        if (status == LIBUSB_TRANSFER_COMPLETED) {
+            status = transfer->status;
+        }
+        stopLocked();
+    }
+    completedLocked(transfer);
+
+    if (pendingLocked() || endedLocked()) {
+        notifyLocked();
+    }
+}
+
+extern "C" void LIBUSB_CALL nativePollCompletionCb(libusb_transfer *transfer) {
+    NativePoll* self = static_cast<NativePoll*>(transfer->user_data);
+    captureTransfer(self->instanceData, 'C', transfer);
+    self->completed(transfer);
+}
+
+Napi::Value NativePoll::errorLocked(Napi::Env env) {
+    if (submitError != 0) {
+        return libusbException(env, submitError).Value();
+    } else if (status != LIBUSB_TRANSFER_COMPLETED) {
+        return libusbException(env, status).Value();
+    }
+    return env.Undefined();
+}
+
+void NativePoll::handleNotify(NativePoll* self) {
+    Napi::Object object = self->wrapper();
+    Napi::Env env = object.Env();
+    Napi::HandleScope scope(env);
+
+    bool ended;
+    Napi::Value error = env.Undefined();
+    {
+        std::lock_guard<std::mutex> guard(self->lock);
+        self->notifyPending = false;
+        bool took = self->takeLocked();
+        ended = self->endedLocked();
+        if (ended && self->endReported && !took) {
+            return;
+        }
+        self->endReported = ended;
+        if (ended) {
+            error = self->errorLocked(env);
+        }
+    }
+
+    if (ended) {
+        self->ending();
+        self->notifyQueue.stop();
+        self->device->unref();
+    }
+
+    try {
+        self->v8callback.MakeCallback(object, self->callbackArgs(env, error, ended), *self->asyncContext);
+    }
+    catch (const Napi::Error& e) {
+        e.ThrowAsJavaScriptException();
+    }
+
+    if (ended) {
+        self->asyncContext.reset();
+        self->unref();
+    }
+}
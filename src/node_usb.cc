@@ -1,16 +1,24 @@
 #include "node_usb.h"
 #include "thread_name.h"
 #include "hotplug.h"
+#include "capture.h"
 
 Napi::Value SetDebugLevel(const Napi::CallbackInfo& info);
 Napi::Value UseUsbDkBackend(const Napi::CallbackInfo& info);
+Napi::Value UseNoDeviceDiscovery(const Napi::CallbackInfo& info);
+Napi::Value WrapSysDevice(const Napi::CallbackInfo& info);
 Napi::Value GetDeviceList(const Napi::CallbackInfo& info);
+Napi::Value GetDeviceListAsync(const Napi::CallbackInfo& info);
 Napi::Value GetLibusbCapability(const Napi::CallbackInfo& info);
 Napi::Value SupportedHotplugEvents(const Napi::CallbackInfo& info);
 Napi::Value EnableHotplugEvents(const Napi::CallbackInfo& info);
 Napi::Value DisableHotplugEvents(const Napi::CallbackInfo& info);
 Napi::Value RefHotplugEvents(const Napi::CallbackInfo& info);
 Napi::Value UnrefHotplugEvents(const Napi::CallbackInfo& info);
+Napi::Value SetHotplugSettleTime(const Napi::CallbackInfo& info);
+Napi::Value SettleHotplugEvents(const Napi::CallbackInfo& info);
+Napi::Value SetTransferBudget(const Napi::CallbackInfo& info);
+Napi::Value GetTransferBudget(const Napi::CallbackInfo& info);
 void initConstants(Napi::Object target);
 
 void USBThreadFn(ModuleData* instanceData) {
@@ -21,20 +29,27 @@ void USBThreadFn(ModuleData* instanceData) {
         if (instanceData->handlingEvents == false) {
             break;
         }
-        libusb_handle_events(usb_context);
+        // Wake up in time for any delayed transfer retry or hotplug batch
+        struct timeval tv;
+        instanceData->submitDueRetries(&tv);
+        instanceData->flushHotplug(&tv);
+        libusb_handle_events_timeout_completed(usb_context, &tv, NULL);
     }
 }
 
-ModuleData::ModuleData(libusb_context* usb_context) : usb_context(usb_context), hotplugQueue(handleHotplug) {
-    handlingEvents = true;
-    usb_thread = std::thread(USBThreadFn, this);
+ModuleData::ModuleData() : usb_context(nullptr), hotplugQueue(handleHotplug), hotplugSettleMs(0), capture(nullptr), captureUsers(0) {
+    handlingEvents = false;
     hotplugManager = HotPlugManager::create();
 }
 
 ModuleData::~ModuleData() {
-    handlingEvents = false;
-    libusb_interrupt_event_handler(usb_context);
-    usb_thread.join();
+    if (usb_thread.joinable()) {
+        handlingEvents = false;
+        libusb_interrupt_event_handler(usb_context);
+        usb_thread.join();
+    }
+    delete detachCapture();
+    discardHotplug();
 
     if (usb_context != nullptr) {
         libusb_exit(usb_context);
@@ -42,33 +57,95 @@ ModuleData::~ModuleData() {
     }
 }
 
+// Initialize libusb and start the event thread on first use (enumeration,
+// hotplug), rather than when the module loads: on Linux libusb_init starts
+// device monitoring and scans the bus, which processes that never touch
+// hardware shouldn't pay for. Only called on the JS thread. Throws if libusb
+// fails to initialize.
+libusb_context* ModuleData::context() {
+    if (usb_context) {
+        return usb_context;
+    }
+
+    libusb_context* ctx = nullptr;
+    if (noDeviceDiscovery) {
+        // Only takes effect when set before libusb_init, and is process wide
+        libusb_set_option(NULL, LIBUSB_OPTION_NO_DEVICE_DISCOVERY);
+    }
+    int res = libusb_init(&ctx);
+    if (res != 0) {
+        initError = res;
+        DEBUG_LOG("libusb_init failed %i", res);
+        return nullptr;
+    }
+    initError = 0;
+    if (debugLevel >= 0) {
+        libusb_set_option(ctx, LIBUSB_OPTION_LOG_LEVEL, debugLevel);
+    }
+    if (useUsbDk) {
+        libusb_set_option(ctx, LIBUSB_OPTION_USE_USBDK);
+    }
+
+    usb_context = ctx;
+    handlingEvents = true;
+    usb_thread = std::thread(USBThreadFn, this);
+    if (Capture* c = capture.load()) {
+        c->setEventThread(usb_thread.get_id());
+    }
+    return usb_context;
+}
+
+// The context for `env`, creating it if needed, or a thrown libusb error
+static libusb_context* usbContext(Napi::Env env) {
+    ModuleData* instanceData = env.GetInstanceData<ModuleData>();
+    libusb_context* usb_context = instanceData->context();
+    if (!usb_context) {
+        throw libusbException(env, instanceData->initError);
+    }
+    return usb_context;
+}
+
+// INIT_ERROR: the libusb_init result, 0 until libusb is first used
+static Napi::Value GetInitError(const Napi::CallbackInfo& info) {
+    return Napi::Number::New(info.Env(), info.Env().GetInstanceData<ModuleData>()->initError);
+}
+
 Napi::Object Init(Napi::Env env, Napi::Object exports) {
     Napi::HandleScope scope(env);
     initConstants(exports);
 
-    // Initialize libusb. On error, halt initialization.
-    libusb_context* usb_context = nullptr;
-    int res = libusb_init(&usb_context);
-
-    exports.Set("INIT_ERROR", Napi::Number::New(env, res));
-    if (res != 0) {
-        return exports;
-    }
+    exports.DefineProperty(Napi::PropertyDescriptor::Accessor(env, exports, "INIT_ERROR", GetInitError, napi_enumerable));
 
-    env.SetInstanceData(new ModuleData(usb_context));
+    env.SetInstanceData(new ModuleData());
 
     Device::Init(env, exports);
     Transfer::Init(env, exports);
+    LatestPoll::Init(env, exports);
+    FramedPoll::Init(env, exports);
+    FramerObject::Init(env, exports);
+    HidDecoder::Init(env, exports);
+    HidPoll::Init(env, exports);
+    FdPump::Init(env, exports);
+    BotEngine::Init(env, exports);
 
     exports.Set("setDebugLevel", Napi::Function::New(env, SetDebugLevel));
     exports.Set("useUsbDkBackend", Napi::Function::New(env, UseUsbDkBackend));
+    exports.Set("useNoDeviceDiscovery", Napi::Function::New(env, UseNoDeviceDiscovery));
+    exports.Set("_wrapSysDevice", Napi::Function::New(env, WrapSysDevice));
     exports.Set("getDeviceList", Napi::Function::New(env, GetDeviceList));
+    exports.Set("_getDeviceListAsync", Napi::Function::New(env, GetDeviceListAsync));
     exports.Set("_getLibusbCapability", Napi::Function::New(env, GetLibusbCapability));
     exports.Set("_supportedHotplugEvents", Napi::Function::New(env, SupportedHotplugEvents));
     exports.Set("_enableHotplugEvents", Napi::Function::New(env, EnableHotplugEvents));
     exports.Set("_disableHotplugEvents", Napi::Function::New(env, DisableHotplugEvents));
     exports.Set("refHotplugEvents", Napi::Function::New(env, RefHotplugEvents));
     exports.Set("unrefHotplugEvents", Napi::Function::New(env, UnrefHotplugEvents));
+    exports.Set("_setHotplugSettleTime", Napi::Function::New(env, SetHotplugSettleTime));
+    exports.Set("_settleHotplugEvents", Napi::Function::New(env, SettleHotplugEvents));
+    exports.Set("_setTransferBudget", Napi::Function::New(env, SetTransferBudget));
+    exports.Set("_getTransferBudget", Napi::Function::New(env, GetTransferBudget));
+    exports.Set("_startCapture", Napi::Function::New(env, StartCapture));
+    exports.Set("_stopCapture", Napi::Function::New(env, StopCapture));
     return exports;
 }
 
@@ -81,8 +158,11 @@ Napi::Value SetDebugLevel(const Napi::CallbackInfo& info) {
         THROW_BAD_ARGS("Usb::SetDebugLevel argument is invalid. [uint:[0-4]]!")
     }
 
-    libusb_context* usb_context = env.GetInstanceData<ModuleData>()->usb_context;
-    libusb_set_option(usb_context, LIBUSB_OPTION_LOG_LEVEL, info[0].As<Napi::Number>().Int32Value());
+    ModuleData* instanceData = env.GetInstanceData<ModuleData>();
+    instanceData->debugLevel = info[0].As<Napi::Number>().Int32Value();
+    if (instanceData->usb_context) {
+        libusb_set_option(instanceData->usb_context, LIBUSB_OPTION_LOG_LEVEL, instanceData->debugLevel);
+    }
     return env.Undefined();
 }
 
@@ -90,18 +170,61 @@ Napi::Value UseUsbDkBackend(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
     Napi::HandleScope scope(env);
 
-    libusb_context* usb_context = env.GetInstanceData<ModuleData>()->usb_context;
-    libusb_set_option(usb_context, LIBUSB_OPTION_USE_USBDK);
+    ModuleData* instanceData = env.GetInstanceData<ModuleData>();
+    instanceData->useUsbDk = true;
+    if (instanceData->usb_context) {
+        libusb_set_option(instanceData->usb_context, LIBUSB_OPTION_USE_USBDK);
+    }
     return env.Undefined();
 }
 
+// Skip enumeration for processes that only use wrapSysDevice(). Has to come
+// before libusb is first used.
+Napi::Value UseNoDeviceDiscovery(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::HandleScope scope(env);
+    ModuleData* instanceData = env.GetInstanceData<ModuleData>();
+
+    if (instanceData->usb_context) {
+        THROW_ERROR("libusb is already initialized");
+    }
+    instanceData->noDeviceDiscovery = true;
+    return env.Undefined();
+}
+
+// _wrapSysDevice(fd) -> Device, opened on a file descriptor the caller
+// already holds (e.g. /dev/bus/usb/BBB/DDD passed in by a supervisor).
+// libusb_close leaves the fd open.
+Napi::Value WrapSysDevice(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::HandleScope scope(env);
+    CHECK_N_ARGS(1);
+    int fd;
+    INT_ARG(fd, 0);
+    if (fd < 0) {
+        THROW_BAD_ARGS("Invalid file descriptor");
+    }
+
+    libusb_device_handle* handle = NULL;
+    CHECK_USB(libusb_wrap_sys_device(usbContext(env), (intptr_t) fd, &handle));
+
+    Napi::Object obj;
+    try {
+        obj = Device::get(env, libusb_get_device(handle));
+    } catch (...) {
+        libusb_close(handle);
+        throw;
+    }
+    Device::Unwrap(obj)->attachHandle(handle);
+    return obj;
+}
+
 Napi::Value GetDeviceList(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
     Napi::HandleScope scope(env);
     libusb_device** devs;
 
-    libusb_context* usb_context = env.GetInstanceData<ModuleData>()->usb_context;
-    int cnt = libusb_get_device_list(usb_context, &devs);
+    int cnt = libusb_get_device_list(usbContext(env), &devs);
     CHECK_USB(cnt);
 
     Napi::Array arr = Napi::Array::New(env, cnt);
@@ -114,6 +237,63 @@ Napi::Value GetDeviceList(const Napi::CallbackInfo& info) {
     return arr;
 }
 
+// Enumerate on the thread pool: on Linux libusb_get_device_list can rescan
+// sysfs and read descriptors, which stalls the event loop on busy hosts.
+// Devices already known to this context keep their existing Device objects.
+struct GetDeviceListWorker: Napi::AsyncWorker {
+    libusb_context* usb_context;
+    libusb_device** devs;
+    ssize_t cnt;
+
+    GetDeviceListWorker(libusb_context* usb_context, Napi::Function& callback)
+        : Napi::AsyncWorker(callback), usb_context(usb_context), devs(NULL), cnt(0) {}
+
+    virtual void Execute() {
+        cnt = libusb_get_device_list(usb_context, &devs);
+    }
+
+    void OnOK() override {
+        auto env = Env();
+        Napi::HandleScope scope(env);
+
+        Napi::Value error = env.Undefined();
+        Napi::Value result = env.Undefined();
+        if (cnt < 0) {
+            error = libusbException(env, (int)cnt).Value();
+        } else {
+            try {
+                Napi::Array arr = Napi::Array::New(env, cnt);
+                for(ssize_t i = 0; i < cnt; i++) {
+                    arr.Set((uint32_t)i, Device::get(env, devs[i]));
+                }
+                result = arr;
+            }
+            catch (const Napi::Error& e) {
+                error = e.Value();
+            }
+            libusb_free_device_list(devs, true);
+        }
+
+        try {
+            Callback().Call({ error, result });
+        }
+        catch (const Napi::Error& e) {
+            e.ThrowAsJavaScriptException();
+        }
+    }
+};
+
+Napi::Value GetDeviceListAsync(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::HandleScope scope(env);
+    CHECK_N_ARGS(1);
+    CALLBACK_ARG(0);
+
+    auto worker = new GetDeviceListWorker(usbContext(env), callback);
+    worker->Queue();
+    return env.Undefined();
+}
+
 Napi::Value GetLibusbCapability(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
 
@@ -140,7 +320,9 @@ Napi::Value EnableHotplugEvents(const Napi::CallbackInfo& info) {
     ModuleData* instanceData = env.GetInstanceData<ModuleData>();
 
     if (!instanceData->hotplugEnabled) {
+        usbContext(env);
         instanceData->hotplugThis.Reset(info.This().As<Napi::Object>(), 1);
+        instanceData->hotplugContext.reset(new Napi::AsyncContext(env, "USBHotplug", info.This().As<Napi::Object>()));
 
         // Start queue, then enable hotplug events
         instanceData->hotplugQueue.start(env);
@@ -161,12 +343,27 @@ Napi::Value DisableHotplugEvents(const Napi::CallbackInfo& info) {
         // Disable events, then stop queue
         instanceData->hotplugManager->disableHotplug(env, instanceData);
         instanceData->hotplugQueue.stop();
+        instanceData->hotplugContext.reset();
 
         instanceData->hotplugEnabled = false;
     }
     return env.Undefined();
 }
 
+// (settleMs)
+Napi::Value SetHotplugSettleTime(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::HandleScope scope(env);
+    ModuleData* instanceData = env.GetInstanceData<ModuleData>();
+    int settleMs;
+    INT_ARG(settleMs, 0);
+    if (settleMs < 0) {
+        THROW_BAD_ARGS("Settle time must not be negative");
+    }
+    instanceData->hotplugSettleMs = settleMs;
+    return env.Undefined();
+}
+
 Napi::Value RefHotplugEvents(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
     Napi::HandleScope scope(env);
@@ -189,6 +386,51 @@ Napi::Value UnrefHotplugEvents(const Napi::CallbackInfo& info) {
     return env.Undefined();
 }
 
+// (maxTransfers, maxBytes, queue)
+void TransferBudget::set(Napi::Env env, const Napi::CallbackInfo& info) {
+    CHECK_N_ARGS(3);
+    if (!info[0].IsNumber() || !info[1].IsNumber() || !info[2].IsBoolean()) {
+        THROW_BAD_ARGS("Transfer budget expects (maxTransfers: number, maxBytes: number, queue: boolean)")
+    }
+    maxTransfers = info[0].As<Napi::Number>().Uint32Value();
+    maxBytes = (uint64_t)info[1].As<Napi::Number>().Int64Value();
+    queue = info[2].As<Napi::Boolean>().Value();
+}
+
+Napi::Object TransferBudget::toObject(Napi::Env env, size_t queued) const {
+    Napi::Object obj = Napi::Object::New(env);
+    obj.Set("maxTransfers", Napi::Number::New(env, maxTransfers));
+    obj.Set("maxBytes", Napi::Number::New(env, (double)maxBytes));
+    obj.Set("queue", Napi::Boolean::New(env, queue));
+    obj.Set("transfers", Napi::Number::New(env, transfers));
+    obj.Set("bytes", Napi::Number::New(env, (double)bytes));
+    obj.Set("queued", Napi::Number::New(env, (double)queued));
+    return obj;
+}
+
+Napi::Value SetTransferBudget(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::HandleScope scope(env);
+    ModuleData* instanceData = env.GetInstanceData<ModuleData>();
+
+    instanceData->budget.set(env, info);
+    // A raised limit may let queued transfers go
+    instanceData->drainPendingTransfers();
+    return env.Undefined();
+}
+
+Napi::Value GetTransferBudget(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::HandleScope scope(env);
+    ModuleData* instanceData = env.GetInstanceData<ModuleData>();
+
+    size_t queued = 0;
+    for (Device* device : instanceData->waitingDevices) {
+        queued += device->scheduler.queued;
+    }
+    return instanceData->budget.toObject(env, queued);
+}
+
 #define DEFINE_CONSTANT(OBJ, VALUE) \
     OBJ.DefineProperty(Napi::PropertyDescriptor::Value(#VALUE, Napi::Number::New(OBJ.Env(), VALUE), static_cast<napi_property_attributes>(napi_enumerable | napi_configurable)));
 
@@ -271,6 +513,14 @@ void initConstants(Napi::Object target){
     DEFINE_CONSTANT(target, LIBUSB_CONTROL_SETUP_SIZE);
     DEFINE_CONSTANT(target, LIBUSB_DT_BOS_SIZE);
 
+    // libusb_speed
+    DEFINE_CONSTANT(target, LIBUSB_SPEED_UNKNOWN);
+    DEFINE_CONSTANT(target, LIBUSB_SPEED_LOW);
+    DEFINE_CONSTANT(target, LIBUSB_SPEED_FULL);
+    DEFINE_CONSTANT(target, LIBUSB_SPEED_HIGH);
+    DEFINE_CONSTANT(target, LIBUSB_SPEED_SUPER);
+    DEFINE_CONSTANT(target, LIBUSB_SPEED_SUPER_PLUS);
+
     // libusb_capability
     DEFINE_CONSTANT(target, LIBUSB_CAP_HAS_CAPABILITY);
     DEFINE_CONSTANT(target, LIBUSB_CAP_HAS_HOTPLUG);
@@ -4,6 +4,9 @@
 #include <assert.h>
 #include <string>
 #include <map>
+#include <vector>
+#include <deque>
+#include <list>
 
 #ifdef _WIN32
 #include <WinSock2.h>
@@ -11,20 +14,108 @@
 
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include <libusb.h>
 #include <napi.h>
+#include <uv.h>
 
 #include "helpers.h"
 #include "uv_async_queue.h"
 
 struct Transfer;
+struct SplitTransfer;
+struct ControlBatch;
 
 struct HotPlug;
+struct HotPlugEvent {
+    libusb_device* device;
+    libusb_hotplug_event event;
+};
 class HotPlugManager;
+class Capture;
+class Framer;
+class HidReportDescriptor;
 
 Napi::Error libusbException(Napi::Env env, int errorno);
 void handleCompletion(Transfer* self);
 
+// Limits on transfers in flight (and the buffer bytes they pin). Only touched
+// on the JS thread: by Transfer::Submit and handleCompletion.
+struct TransferBudget {
+    uint32_t maxTransfers = 0; // 0 = unlimited
+    uint64_t maxBytes = 0;     // 0 = unlimited
+    bool queue = false;        // queue submits over budget rather than failing them
+
+    uint32_t transfers = 0;
+    uint64_t bytes = 0;
+
+    // A lone transfer is always allowed, even if larger than maxBytes
+    inline bool fits(uint64_t length) const {
+        return (!maxTransfers || transfers < maxTransfers)
+            && (!maxBytes || bytes == 0 || bytes + length <= maxBytes);
+    }
+    inline void acquire(uint64_t length) { transfers++; bytes += length; }
+    inline void release(uint64_t length) { transfers--; bytes -= length; }
+
+    void set(Napi::Env env, const Napi::CallbackInfo& info);
+    Napi::Object toObject(Napi::Env env, size_t queued) const;
+};
+
+// Priority classes of the per-device submission scheduler, most urgent first
+enum TransferPriority {
+    PRIORITY_CONTROL,
+    PRIORITY_INTERRUPT, // interrupt and isochronous
+    PRIORITY_BULK,
+    PRIORITY_BACKGROUND,
+    PRIORITY_CLASSES
+};
+
+// Orders submissions on one device. Transfers that can't start straight away
+// wait in a queue per endpoint; queued transfers start most urgent class
+// first, taking the endpoints of a class in turn, within the class and
+// endpoint in-flight limits. Only touched on the JS thread, like TransferBudget.
+struct SubmitScheduler {
+    uint32_t classLimit[PRIORITY_CLASSES] = {};    // 0 = unlimited
+    uint32_t classInFlight[PRIORITY_CLASSES] = {};
+    uint32_t endpointLimit[32] = {};               // by endpointIndex(), 0 = unlimited
+    uint32_t endpointInFlight[32] = {};
+    std::map<int, std::deque<Transfer*>> queues[PRIORITY_CLASSES]; // by endpointIndex()
+    int lastEndpoint[PRIORITY_CLASSES] = {-1, -1, -1, -1}; // endpoint served last, for round robin
+    size_t queued = 0;
+
+    static inline int endpointIndex(uint8_t address) { return (address & 0x0f) | ((address & 0x80) >> 3); }
+
+    // Whether `t` can skip the queues: nothing as urgent is waiting and it is within its limits
+    bool canStart(Transfer* t) const;
+    Transfer* next(const TransferBudget& device, const TransferBudget& global);
+    void push(Transfer* t);
+    void pop(Transfer* t);
+    void remove(Transfer* t);
+    void acquire(Transfer* t);
+    void release(Transfer* t);
+
+    Napi::Object toObject(Napi::Env env) const;
+};
+
+// Automatic recovery from transfer failures, run on the libusb event thread
+// so that a STALL or timeout does not need a round trip through JS.
+struct RecoveryPolicy {
+    int maxRetries = 0;      // consecutive retries before failing; 0 = off
+    uint32_t retryDelay = 0; // ms before the first retry
+    double backoff = 2;      // delay multiplier for each further retry
+    bool retryTimeouts = true;
+};
+
+struct RecoveryStats {
+    std::atomic<uint32_t> stalls{0};
+    std::atomic<uint32_t> timeouts{0};
+    std::atomic<uint32_t> errors{0};
+    std::atomic<uint32_t> retries{0};
+    std::atomic<uint32_t> exhausted{0}; // failures reported after running out of retries
+};
+
 struct Device: public Napi::ObjectWrap<Device> {
     Napi::Env env;
     libusb_device* device;
@@ -33,6 +124,9 @@ struct Device: public Napi::ObjectWrap<Device> {
     int refs_;
     UVQueue<Transfer*> completionQueue;
 
+    TransferBudget budget;
+    SubmitScheduler scheduler;
+
     static Napi::Object Init(Napi::Env env, Napi::Object exports);
     static Napi::Object get(Napi::Env env, libusb_device* handle);
 
@@ -64,12 +158,21 @@ struct Device: public Napi::ObjectWrap<Device> {
     Napi::Value ReleaseInterface(const Napi::CallbackInfo& info);
 
     Napi::Value ClearHalt(const Napi::CallbackInfo& info);
+    Napi::Value OpenAndClaim(const Napi::CallbackInfo& info);
+    Napi::Value SetTransferBudget(const Napi::CallbackInfo& info);
+    Napi::Value GetTransferBudget(const Napi::CallbackInfo& info);
+    Napi::Value SetClassLimit(const Napi::CallbackInfo& info);
+    Napi::Value SetEndpointLimit(const Napi::CallbackInfo& info);
+    Napi::Value GetSchedulerStats(const Napi::CallbackInfo& info);
+    Napi::Value GetMaxPacketSize(const Napi::CallbackInfo& info);
+
+    void attachHandle(libusb_device_handle* handle);
 protected:
     Napi::Value Constructor(const Napi::CallbackInfo& info);
 };
 
 struct ModuleData {
-    libusb_context* usb_context;
+    libusb_context* usb_context; // created on first use, see context()
     std::thread usb_thread;
     std::atomic<bool> handlingEvents;
 
@@ -77,19 +180,70 @@ struct ModuleData {
     std::unique_ptr<HotPlugManager> hotplugManager;
     UVQueue<HotPlug*> hotplugQueue;
     Napi::ObjectReference hotplugThis;
+    std::unique_ptr<Napi::AsyncContext> hotplugContext; // of the code that enabled hotplug events
     std::map<libusb_device*, Device*> byPtr;
+
+    // Hotplug events held back until the settle window passes without one, coalesced per device
+    std::atomic<int> hotplugSettleMs;
+    std::mutex hotplugLock;
+    std::vector<HotPlugEvent> hotplugPending;
+    std::chrono::steady_clock::time_point hotplugFirst;    // of the first pending event
+    std::chrono::steady_clock::time_point hotplugDeadline;
     Napi::FunctionReference deviceConstructor;
 
-    ModuleData(libusb_context* usb_context);
+    TransferBudget budget;
+    std::list<Device*> waitingDevices;
+
+    std::atomic<Capture*> capture;
+    std::atomic<int> captureUsers;
+
+    // Guards recovering transfers against concurrent cancellation
+    std::mutex retryLock;
+    std::multimap<std::chrono::steady_clock::time_point, Transfer*> delayedRetries;
+
+    // Options set before the context exists, applied when it is created
+    int debugLevel = -1;
+    bool useUsbDk = false;
+    bool noDeviceDiscovery = false;
+    int initError = 0;
+
+    ModuleData();
     ~ModuleData();
+
+    libusb_context* context();
+
+    void drainPendingTransfers();
+    Capture* detachCapture();
+    void submitDueRetries(struct timeval* nextTimeout);
+    void flushHotplug(struct timeval* nextTimeout);
+    void discardHotplug();
 };
 
 struct Transfer: public Napi::ObjectWrap<Transfer> {
     libusb_transfer* transfer;
     Device* device;
+    ModuleData* instanceData;
     Napi::ObjectReference v8buffer;
     Napi::FunctionReference v8callback;
 
+    bool queued;        // waiting in the device's scheduler queues
+    bool inBudget;      // counted against the device and global budgets and the scheduler limits
+    int priority;       // TransferPriority
+    int submitError;    // deferred libusb_submit_transfer failure for a queued transfer
+    std::unique_ptr<SplitTransfer> split; // set while submitted with submitSplit()
+    std::unique_ptr<ControlBatch> batch;  // set while submitted with submitControlBatch()
+    std::unique_ptr<Napi::AsyncContext> asyncContext; // of the code that submitted, restored for the callback
+
+    // uv_hrtime() at libusb submission and in the completion callback
+    uint64_t submitTime;
+    uint64_t completeTime;
+
+    RecoveryPolicy recovery;
+    RecoveryStats recoveryStats;
+    int attempt;          // consecutive failed attempts, event thread only
+    bool cancelRequested; // under instanceData->retryLock
+    bool clearingHalt;    // the halt is being cleared on a worker before a retry, under instanceData->retryLock
+
     static Napi::Object Init(Napi::Env env, Napi::Object exports);
 
     inline void ref(){Ref();}
@@ -99,12 +253,364 @@ struct Transfer: public Napi::ObjectWrap<Transfer> {
     ~Transfer();
 
     Napi::Value Submit(const Napi::CallbackInfo& info);
+    Napi::Value SubmitSplit(const Napi::CallbackInfo& info);
+    Napi::Value SubmitControlBatch(const Napi::CallbackInfo& info);
     Napi::Value Cancel(const Napi::CallbackInfo& info);
+    Napi::Value SetRecovery(const Napi::CallbackInfo& info);
+    Napi::Value GetRecoveryStats(const Napi::CallbackInfo& info);
+    Napi::Value SetPriority(const Napi::CallbackInfo& info);
+
+    int submitNow(ModuleData* instanceData);
+    bool recover();
+    void retryLocked();
+    bool clearHalt();
+    void haltCleared(int r);
+    void resubmit();
 private:
     Napi::Value Constructor(const Napi::CallbackInfo& info);
 };
 
 
+// Base of the native polls: keeps preallocated transfers on an endpoint
+// resubmitted from the libusb event thread, and reports to JS through a notify
+// queue until the last one has ended. Subclasses say what a completed transfer
+// carries and how it is handed to JS; the hooks are called with the lock held
+// where their name says so.
+struct NativePoll {
+    Device* device;
+    ModuleData* instanceData;
+    std::vector<libusb_transfer*> transfers;
+    std::vector<unsigned char> buffers;
+    Napi::FunctionReference v8callback;
+    std::unique_ptr<Napi::AsyncContext> asyncContext; // of the code that started it, restored for the callback
+    UVQueue<NativePoll*> notifyQueue;
+    const char* resourceName;
+    const char* startedMessage;
+
+    std::mutex lock;
+    bool notifyPending;
+    bool started;
+    bool stopping;
+    bool endReported;
+    int inFlight;
+    int status;           // first transfer status that ended the poll
+    int submitError;
+
+    NativePoll(ModuleData* instanceData, const char* resourceName, const char* startedMessage);
+    virtual ~NativePoll();
+
+    void init(Device* device, int endpoint, int type, int nTransfers, int transferSize, Napi::Function callback);
+
+    Napi::Value Start(const Napi::CallbackInfo& info);
+    Napi::Value Stop(const Napi::CallbackInfo& info);
+
+    void completed(libusb_transfer* transfer);
+    void notifyLocked();
+    virtual void stopLocked();
+    virtual bool submitLocked(libusb_transfer* transfer);
+    static void handleNotify(NativePoll* self);
+
+    // The JS object
+    virtual Napi::Object wrapper() = 0;
+    virtual void ref() = 0;
+    virtual void unref() = 0;
+
+    // Submit the transfers to start with, throwing if none could be
+    virtual void startLocked(Napi::Env env);
+    // Take the data of a completed transfer; returns whether to resubmit it
+    virtual bool receivedLocked(libusb_transfer* transfer) = 0;
+    // Called after every completion
+    virtual void completedLocked(libusb_transfer* transfer) {}
+    // Whether there is something for JS, worth a notification
+    virtual bool pendingLocked() { return false; }
+    virtual bool endedLocked() { return inFlight == 0; }
+    // Move what is pending to the JS side; returns whether there was anything
+    virtual bool takeLocked() { return false; }
+    virtual Napi::Value errorLocked(Napi::Env env);
+    // Called on the JS thread when the poll has ended, before the last callback
+    virtual void ending() {}
+    // Arguments of the callback, after what takeLocked() took
+    virtual std::vector<napi_value> callbackArgs(Napi::Env env, Napi::Value error, bool ended) = 0;
+};
+
+// Keeps interrupt/bulk IN transfers resubmitted from the libusb event thread,
+// keeping only the newest report. JS reads it on demand or asks (arm) to be
+// notified of the next one, so high-rate endpoints cost JS nothing per report.
+struct LatestPoll: public Napi::ObjectWrap<LatestPoll>, public NativePoll {
+    std::vector<unsigned char> latest;
+    uint64_t latestTime;  // uv_hrtime() when the latest report completed
+    uint64_t reports;     // reports received
+    uint64_t dropped;     // reports overwritten before being read
+    bool unread;
+    bool armed;
+    bool signalled;       // an armed report arrived
+
+    static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+    LatestPoll(const Napi::CallbackInfo& info);
+    ~LatestPoll();
+
+    Napi::Value Read(const Napi::CallbackInfo& info);
+    Napi::Value Arm(const Napi::CallbackInfo& info);
+
+    Napi::Object wrapper() override { return Value(); }
+    void ref() override { Ref(); }
+    void unref() override { Unref(); }
+    bool receivedLocked(libusb_transfer* transfer) override;
+    bool pendingLocked() override;
+    bool takeLocked() override;
+    std::vector<napi_value> callbackArgs(Napi::Env env, Napi::Value error, bool ended) override;
+private:
+    Napi::Value Constructor(const Napi::CallbackInfo& info);
+};
+
+struct FramedPoll: public Napi::ObjectWrap<FramedPoll>, public NativePoll {
+    std::unique_ptr<Framer> framer;
+    std::vector<uint8_t> frames;   // complete frames not yet passed to JS, back to back
+    std::vector<uint32_t> ends;    // end offset of each frame in `frames`
+    uint64_t frameTime;            // uv_hrtime() when the last frame completed
+    uint64_t frameCount;
+
+    static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+    FramedPoll(const Napi::CallbackInfo& info);
+    ~FramedPoll();
+
+    Napi::Value Stats(const Napi::CallbackInfo& info);
+
+    Napi::Object wrapper() override { return Value(); }
+    void ref() override { Ref(); }
+    void unref() override { Unref(); }
+    bool receivedLocked(libusb_transfer* transfer) override;
+    bool pendingLocked() override;
+    bool takeLocked() override;
+    std::vector<napi_value> callbackArgs(Napi::Env env, Napi::Value error, bool ended) override;
+private:
+    Napi::Value Constructor(const Napi::CallbackInfo& info);
+};
+
+// A Framer on the JS thread, splitting data fed to it from JS: the framing of
+// FramedPoll without a device
+struct FramerObject: public Napi::ObjectWrap<FramerObject> {
+    std::unique_ptr<Framer> framer;
+
+    static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+    FramerObject(const Napi::CallbackInfo& info);
+    ~FramerObject();
+
+    Napi::Value Feed(const Napi::CallbackInfo& info);
+    Napi::Value Stats(const Napi::CallbackInfo& info);
+private:
+    Napi::Value Constructor(const Napi::CallbackInfo& info);
+};
+
+// A compiled HID report descriptor, shared with the polls that decode with it
+struct HidDecoder: public Napi::ObjectWrap<HidDecoder> {
+    std::shared_ptr<const HidReportDescriptor> descriptor;
+
+    static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+    HidDecoder(const Napi::CallbackInfo& info);
+
+    Napi::Value Reports(const Napi::CallbackInfo& info);
+    Napi::Value Decode(const Napi::CallbackInfo& info);
+private:
+    Napi::Value Constructor(const Napi::CallbackInfo& info);
+};
+
+// Polls an IN endpoint from the libusb event thread and decodes the reports
+// there, handing JS only the extracted values.
+struct HidPoll: public Napi::ObjectWrap<HidPoll>, public NativePoll {
+    std::shared_ptr<const HidReportDescriptor> descriptor;
+    std::vector<int32_t> values;   // decoded reports not yet passed to JS, back to back
+    std::vector<uint8_t> ids;      // report ID of each
+    std::vector<uint32_t> ends;    // end offset of each report in `values`
+    uint64_t reportTime;           // uv_hrtime() when the last report completed
+    uint64_t reportCount;
+    uint64_t dropped;              // unknown report IDs and short reports
+
+    static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+    HidPoll(const Napi::CallbackInfo& info);
+    ~HidPoll();
+
+    Napi::Value Stats(const Napi::CallbackInfo& info);
+
+    Napi::Object wrapper() override { return Value(); }
+    void ref() override { Ref(); }
+    void unref() override { Unref(); }
+    bool receivedLocked(libusb_transfer* transfer) override;
+    bool pendingLocked() override;
+    bool takeLocked() override;
+    std::vector<napi_value> callbackArgs(Napi::Env env, Napi::Value error, bool ended) override;
+private:
+    Napi::Value Constructor(const Napi::CallbackInfo& info);
+};
+
+// Moves data between an endpoint and a file descriptor without involving JS:
+// transfers run on the libusb event thread and a pump thread does the fd I/O.
+struct FdPump: public Napi::ObjectWrap<FdPump>, public NativePoll {
+    std::thread thread;   // joined once the pump has ended, or on environment teardown
+
+    int fd;
+    bool isIn;
+    int transferSize;
+    uint64_t limit;       // bytes to move, 0 for no limit
+    int fdFlags;          // file status flags of fd before pumping, restored after
+    int wakeFds[2];       // pipe signalled by stopLocked() to wake the pump thread out of poll()
+
+    std::condition_variable wake;
+    std::deque<libusb_transfer*> ready; // IN: filled, waiting to be written; OUT: free, waiting to be filled
+    bool finished;        // the pump thread is done
+    int ioError;          // errno from the fd side
+
+    uint64_t bytes;
+    uint64_t transfersDone;
+    size_t maxQueued;
+    uint64_t idleSince;   // uv_hrtime() when the last transfer in flight completed, or 0
+    uint64_t idleTime;    // ns spent with no transfer in flight while pumping
+
+    static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+    FdPump(const Napi::CallbackInfo& info);
+    ~FdPump();
+
+    Napi::Value Stats(const Napi::CallbackInfo& info);
+
+    void run();
+    void runIn();
+    void runOut();
+    void join();
+    static void cleanup(void* arg);
+    Napi::Object statsObject(Napi::Env env);
+
+    Napi::Object wrapper() override { return Value(); }
+    void ref() override { Ref(); }
+    void unref() override { Unref(); }
+    void stopLocked() override;
+    bool submitLocked(libusb_transfer* transfer) override;
+    void startLocked(Napi::Env env) override;
+    bool receivedLocked(libusb_transfer* transfer) override;
+    void completedLocked(libusb_transfer* transfer) override;
+    bool endedLocked() override { return finished; }
+    Napi::Value errorLocked(Napi::Env env) override;
+    void ending() override;
+    std::vector<napi_value> callbackArgs(Napi::Env env, Napi::Value error, bool ended) override;
+private:
+    Napi::Value Constructor(const Napi::CallbackInfo& info);
+};
+
+// A SCSI command queued on a BotEngine. The data buffer is the caller's
+// Buffer, kept alive by `data` until the callback has run.
+struct BotCommand {
+    uint8_t lun;
+    uint8_t cdb[16];
+    uint8_t cdbLength;
+    bool in;
+    uint8_t* buffer;
+    uint32_t length;
+    Napi::ObjectReference data;
+    Napi::FunctionReference callback;
+    std::unique_ptr<Napi::AsyncContext> asyncContext; // of the code that submitted it, restored for the callback
+
+    int error = 0;                 // transfer status or libusb error that failed the transport, 0 if it completed
+    int status = 0;                // CSW status: 0 passed, 1 failed, 2 phase error
+    uint32_t residue = 0;          // bytes of the data phase not transferred
+    std::vector<uint8_t> sense;    // REQUEST SENSE data after a failed command
+};
+
+// Runs SCSI commands over the USB Mass Storage Bulk-Only Transport on the
+// libusb event thread. Queued commands run back to back: the CBW, data and
+// CSW phases of each, the data split into concurrent transfers, and the
+// recovery after a failure (clear halt, or reset recovery) follow each other
+// there, and JS only hears about finished commands. Halts are cleared on the
+// thread pool, as libusb_clear_halt blocks.
+struct BotEngine: public Napi::ObjectWrap<BotEngine> {
+    enum Phase { IDLE, CBW, DATA, CSW, RESET, CLEAR_HALT };
+    // Where the command goes once the halts are cleared: on to the status phase after a data STALL, another CSW read after a CSW
+    // STALL, or the end of reset recovery
+    enum AfterHalt { HALT_THEN_STATUS, HALT_THEN_CSW, HALT_THEN_FINISH };
+
+    Device* device;
+    ModuleData* instanceData;
+    UVQueue<BotEngine*> notifyQueue;
+    int interfaceNumber;
+    unsigned char inEndpoint;
+    unsigned char outEndpoint;
+    unsigned int timeout;
+    uint32_t maxTransferSize;
+    libusb_transfer* cbwTransfer;
+    libusb_transfer* cswTransfer;
+    libusb_transfer* resetTransfer;
+    std::vector<libusb_transfer*> dataTransfers;
+    uint8_t cbw[31];
+    uint8_t csw[13];
+    uint8_t resetSetup[LIBUSB_CONTROL_SETUP_SIZE];
+    int pending;                   // commands submitted and not yet called back, only touched on the JS thread
+
+    std::mutex lock;
+    std::deque<BotCommand*> queue; // the running command first
+    std::vector<BotCommand*> done; // finished, waiting for JS
+    bool notifyPending;
+    uint32_t tag;
+
+    // The running command, or the REQUEST SENSE that follows it when it failed
+    Phase phase;
+    bool sensing;
+    uint8_t senseCdb[6];
+    const uint8_t* runCdb;
+    uint8_t runCdbLength;
+    uint8_t* runData;
+    uint32_t runLength;
+    bool runIn;
+    uint32_t nextOffset;           // start of the next data chunk to submit
+    uint32_t transferred;
+    int dataInFlight;
+    int dataStatus;                // first data transfer status other than completed
+    bool shortSeen;                // a data transfer came back short: the rest of the phase is skipped
+    bool cswCaptured;              // the CSW arrived in a data transfer queued after the short one
+    bool phaseError;
+    int cswAttempts;
+    int resetError;                // what the command that needed reset recovery failed with
+    unsigned char halts[2];        // endpoints to clear in the CLEAR_HALT phase
+    int haltCount;
+    bool haltRequested;            // JS is yet to queue the worker that clears them
+    AfterHalt afterHalt;
+
+    uint64_t commands;
+    uint64_t bytes;
+    uint64_t resets;
+    uint64_t clearHalts;
+
+    static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+    BotEngine(const Napi::CallbackInfo& info);
+    ~BotEngine();
+
+    Napi::Value Submit(const Napi::CallbackInfo& info);
+    Napi::Value Stats(const Napi::CallbackInfo& info);
+
+    void completed(libusb_transfer* transfer);
+    void startNextLocked();
+    void beginLocked();
+    int submitLocked(libusb_transfer* transfer);
+    void submitChunkLocked(libusb_transfer* transfer);
+    void cancelData();
+    void dataCompletedLocked(libusb_transfer* transfer);
+    void dataEndedLocked();
+    void startCswLocked();
+    void cswCompletedLocked(libusb_transfer* transfer);
+    void cswReceivedLocked();
+    void clearHaltsLocked(std::initializer_list<unsigned char> endpoints, AfterHalt then);
+    void haltsClearedLocked(int error);
+    void resetLocked(int error);
+    void resetCompletedLocked(libusb_transfer* transfer);
+    void finishLocked(int error);
+    void notifyLocked();
+private:
+    Napi::Value Constructor(const Napi::CallbackInfo& info);
+};
 
 #define CHECK_USB_CLEANUP(r, cleanup) \
     do { \
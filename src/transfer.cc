@@ -1,9 +1,169 @@
 #include "node_usb.h"
+#include "capture.h"
+#include <algorithm>
+#include <mutex>
 
 extern "C" void LIBUSB_CALL usbCompletionCb(libusb_transfer *transfer);
+extern "C" void LIBUSB_CALL splitCompletionCb(libusb_transfer *transfer);
+extern "C" void LIBUSB_CALL batchCompletionCb(libusb_transfer *transfer);
+
+// One logical transfer carried by several chunk transfers, up to `slots.size()`
+// in flight at once. Chunks point straight into the caller's buffer and are
+// refilled from the libusb event thread as they complete, so there is no gap
+// waiting on the JS thread between them. The JS thread only touches this in
+// Submit/Cancel, hence the lock.
+struct SplitTransfer {
+    std::mutex lock;
+    std::vector<libusb_transfer*> slots;
+    std::vector<bool> busy;
+    size_t chunkSize;
+    size_t length;
+    size_t next = 0;     // offset of the next chunk to submit
+    size_t end;          // data is complete up to here
+    int status = LIBUSB_TRANSFER_COMPLETED;
+    int submitError = 0;
+    int inFlight = 0;
+    bool stopped = false;
+
+    SplitTransfer(Transfer* t, size_t chunkSize, int concurrency)
+        : slots(concurrency), busy(concurrency, false), chunkSize(chunkSize) {
+        for (auto& slot : slots) {
+            slot = libusb_alloc_transfer(0);
+            slot->callback = splitCompletionCb;
+            slot->user_data = t;
+        }
+    }
+
+    ~SplitTransfer() {
+        for (auto slot : slots) {
+            libusb_free_transfer(slot);
+        }
+    }
+
+    int submitChunk(libusb_transfer* parent, size_t i) {
+        libusb_transfer* slot = slots[i];
+        slot->dev_handle = parent->dev_handle;
+        slot->endpoint = parent->endpoint;
+        slot->type = parent->type;
+        slot->timeout = parent->timeout;
+        slot->buffer = parent->buffer + next;
+        slot->length = (int) std::min(chunkSize, length - next);
+        ModuleData* instanceData = static_cast<Transfer*>(slot->user_data)->instanceData;
+        captureTransfer(instanceData, 'S', slot);
+        int r = libusb_submit_transfer(slot);
+        if (r < LIBUSB_SUCCESS) {
+            captureTransfer(instanceData, 'E', slot, r);
+        } else {
+            next += slot->length;
+            busy[i] = true;
+            inFlight++;
+        }
+        return r;
+    }
+
+    // Called with the lock held. Record where the data stops being complete,
+    // keeping the earliest point, and cancel whatever is still in flight.
+    void stop(size_t at, int atStatus) {
+        if (at < end) {
+            end = at;
+            status = atStatus;
+        }
+        if (!stopped) {
+            stopped = true;
+            for (size_t i = 0; i < slots.size(); i++) {
+                if (busy[i]) {
+                    libusb_cancel_transfer(slots[i]);
+                }
+            }
+        }
+    }
+
+    int start(libusb_transfer* parent) {
+        std::lock_guard<std::mutex> guard(lock);
+        length = parent->length;
+        end = length;
+        for (size_t i = 0; i < slots.size() && next < length; i++) {
+            int r = submitChunk(parent, i);
+            if (r < LIBUSB_SUCCESS) {
+                if (i == 0) {
+                    return r;
+                }
+                submitError = r;
+                stop(next, LIBUSB_TRANSFER_ERROR);
+                break;
+            }
+        }
+        return LIBUSB_SUCCESS;
+    }
+};
+
+// Size of the result header in front of each request of a control batch
+#define BATCH_HEADER_SIZE 8
+
+static inline void writeInt32LE(unsigned char* p, int32_t value) {
+    uint32_t v = (uint32_t) value;
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+// A sequence of control requests packed into the caller's buffer, each as an
+// 8 byte result header (status and actual length, int32 LE, filled in here)
+// followed by the setup packet and its data. The requests run back to back
+// from the libusb event thread on one slot transfer, and the caller gets one
+// completion for the lot, with the number of requests that ran.
+struct ControlBatch {
+    std::mutex lock;
+    libusb_transfer* slot;
+    bool stopOnError;
+    size_t next = 0;     // offset of the running request's header
+    uint32_t done = 0;   // requests that ran
+    int status = LIBUSB_TRANSFER_COMPLETED;
+    int submitError = 0;
+    bool stopped = false;
+
+    ControlBatch(Transfer* t, bool stopOnError) : stopOnError(stopOnError) {
+        slot = libusb_alloc_transfer(0);
+        slot->callback = batchCompletionCb;
+        slot->user_data = t;
+    }
+
+    ~ControlBatch() {
+        libusb_free_transfer(slot);
+    }
+
+    // Size of the request at `offset`, header included, or 0 if it overruns `length`
+    static size_t requestSize(const unsigned char* buffer, size_t length, size_t offset) {
+        if (length - offset < BATCH_HEADER_SIZE + LIBUSB_CONTROL_SETUP_SIZE) {
+            return 0;
+        }
+        const unsigned char* setup = buffer + offset + BATCH_HEADER_SIZE;
+        size_t size = BATCH_HEADER_SIZE + LIBUSB_CONTROL_SETUP_SIZE + (setup[6] | (setup[7] << 8));
+        return size <= length - offset ? size : 0;
+    }
+
+    int submitNext(libusb_transfer* parent) {
+        unsigned char* setup = parent->buffer + next + BATCH_HEADER_SIZE;
+        slot->dev_handle = parent->dev_handle;
+        slot->endpoint = 0;
+        slot->type = LIBUSB_TRANSFER_TYPE_CONTROL;
+        slot->timeout = parent->timeout;
+        slot->buffer = setup;
+        slot->length = LIBUSB_CONTROL_SETUP_SIZE + (setup[6] | (setup[7] << 8));
+        ModuleData* instanceData = static_cast<Transfer*>(slot->user_data)->instanceData;
+        captureTransfer(instanceData, 'S', slot);
+        int r = libusb_submit_transfer(slot);
+        if (r < LIBUSB_SUCCESS) {
+            captureTransfer(instanceData, 'E', slot, r);
+        }
+        return r;
+    }
+};
 
 Transfer::Transfer(const Napi::CallbackInfo& info)
-    : Napi::ObjectWrap<Transfer>(info) {
+    : Napi::ObjectWrap<Transfer>(info), instanceData(info.Env().GetInstanceData<ModuleData>()), queued(false), inBudget(false), priority(PRIORITY_BULK), submitError(0),
+      submitTime(0), completeTime(0), attempt(0), cancelRequested(false), clearingHalt(false) {
     transfer = libusb_alloc_transfer(0);
     transfer->callback = usbCompletionCb;
     transfer->user_data = this;
@@ -34,12 +194,81 @@ Napi::Value Transfer::Constructor(const Napi::CallbackInfo& info) {
     self->transfer->endpoint = endpoint;
     self->transfer->type = type;
     self->transfer->timeout = timeout;
+    if (type == LIBUSB_TRANSFER_TYPE_CONTROL) {
+        self->priority = PRIORITY_CONTROL;
+    } else if (type == LIBUSB_TRANSFER_TYPE_INTERRUPT || type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS) {
+        self->priority = PRIORITY_INTERRUPT;
+    }
 
     self->v8callback.Reset(callback, 1);
 
     return info.This();
 }
 
+// Transfer.submitSplit(buffer, chunkSize, concurrency)
+Napi::Value Transfer::SubmitSplit(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(Transfer, 3);
+    int chunkSize, concurrency;
+    INT_ARG(chunkSize, 1);
+    INT_ARG(concurrency, 2);
+    if (chunkSize <= 0 || concurrency <= 0) {
+        THROW_BAD_ARGS("chunkSize and concurrency must be positive");
+    }
+
+    if (self->transfer->buffer){
+        THROW_ERROR("Transfer is already active")
+    }
+
+    // Small enough for one chunk: a plain transfer does the same job
+    if (!info[0].IsBuffer() || info[0].As<Napi::Buffer<unsigned char>>().ByteLength() <= (size_t) chunkSize) {
+        return Submit(info);
+    }
+
+    self->split.reset(new SplitTransfer(self, chunkSize, concurrency));
+    try {
+        return Submit(info);
+    } catch (...) {
+        self->split.reset();
+        throw;
+    }
+}
+
+// Transfer.submitControlBatch(buffer, stopOnError)
+Napi::Value Transfer::SubmitControlBatch(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(Transfer, 2);
+
+    if (self->transfer->buffer){
+        THROW_ERROR("Transfer is already active")
+    }
+    if (self->transfer->type != LIBUSB_TRANSFER_TYPE_CONTROL) {
+        THROW_ERROR("Control batches need a control transfer");
+    }
+    if (!info[0].IsBuffer()){
+        THROW_BAD_ARGS("Buffer arg [0] must be Buffer");
+    }
+
+    Napi::Buffer<unsigned char> buffer = info[0].As<Napi::Buffer<unsigned char>>();
+    size_t length = buffer.ByteLength();
+    if (length == 0) {
+        THROW_BAD_ARGS("Control batch is empty");
+    }
+    for (size_t offset = 0; offset < length;) {
+        size_t size = ControlBatch::requestSize(buffer.Data(), length, offset);
+        if (size == 0) {
+            THROW_BAD_ARGS("Control batch request overruns the buffer");
+        }
+        offset += size;
+    }
+
+    self->batch.reset(new ControlBatch(self, info[1].ToBoolean()));
+    try {
+        return Submit(info);
+    } catch (...) {
+        self->batch.reset();
+        throw;
+    }
+}
+
 // Transfer.submit(buffer, callback)
 Napi::Value Transfer::Submit(const Napi::CallbackInfo& info) {
     ENTER_METHOD(Transfer, 1);
@@ -58,6 +287,17 @@ Napi::Value Transfer::Submit(const Napi::CallbackInfo& info) {
 
     // Can't be cached in constructor as device could be closed and re-opened
     self->transfer->dev_handle = self->device->device_handle;
+    self->attempt = 0;
+    self->cancelRequested = false;
+    self->submitTime = 0;
+    self->completeTime = 0;
+    // A pooled transfer cancelled before reaching libusb must not report the last use's length
+    self->transfer->actual_length = 0;
+
+    // Every submission is its own async operation, even on a pooled or
+    // resubmitted transfer. The transfer object is the resource, so this
+    // allocates no JS object.
+    self->asyncContext.reset(new Napi::AsyncContext(env, "USBTransfer", info.This().As<Napi::Object>()));
 
     self->v8buffer.Reset(buffer_obj, 1);
     self->transfer->buffer = (unsigned char*) buffer_obj.Data();
@@ -73,10 +313,43 @@ Napi::Value Transfer::Submit(const Napi::CallbackInfo& info) {
         self->transfer->buffer
     );
 
-    CHECK_USB_CLEANUP(libusb_submit_transfer(self->transfer), {
+    ModuleData* instanceData = env.GetInstanceData<ModuleData>();
+    Device* device = self->device;
+    uint64_t length = self->transfer->length;
+    bool fitsDevice = device->budget.fits(length);
+    bool fitsGlobal = instanceData->budget.fits(length);
+
+    // Anything as urgent already waiting (including earlier transfers on
+    // this endpoint) goes first; the scheduler limits always queue.
+    if (!device->scheduler.canStart(self) || !fitsDevice || !fitsGlobal) {
+        if ((!fitsDevice && !device->budget.queue) || (!fitsGlobal && !instanceData->budget.queue)) {
+            self->v8buffer.Reset();
+            self->transfer->buffer = NULL;
+            self->transfer->length = 0;
+            self->asyncContext.reset();
+            throw libusbException(env, LIBUSB_ERROR_BUSY);
+        }
+
+        DEBUG_LOG("Queueing %p", self);
+        self->queued = true;
+        if (device->scheduler.queued == 0) {
+            instanceData->waitingDevices.push_back(device);
+        }
+        device->scheduler.push(self);
+        self->ref();
+        device->ref();
+        // It may only be waiting its turn
+        if (fitsDevice && fitsGlobal) {
+            instanceData->drainPendingTransfers();
+        }
+        return info.This();
+    }
+
+    CHECK_USB_CLEANUP(self->submitNow(instanceData), {
         self->v8buffer.Reset();
         self->transfer->buffer = NULL;
         self->transfer->length = 0;
+        self->asyncContext.reset();
     });
     self->ref();
     self->device->ref();
@@ -84,34 +357,451 @@ Napi::Value Transfer::Submit(const Napi::CallbackInfo& info) {
     return info.This();
 }
 
+int Transfer::submitNow(ModuleData* instanceData) {
+    submitTime = uv_hrtime();
+    int r;
+    if (split) {
+        r = split->start(transfer);
+    } else if (batch) {
+        std::lock_guard<std::mutex> guard(batch->lock);
+        r = batch->submitNext(transfer);
+    } else {
+        captureTransfer(instanceData, 'S', transfer);
+        r = libusb_submit_transfer(transfer);
+        if (r < LIBUSB_SUCCESS) {
+            captureTransfer(instanceData, 'E', transfer, r);
+        }
+    }
+    if (r == LIBUSB_SUCCESS) {
+        device->budget.acquire(transfer->length);
+        instanceData->budget.acquire(transfer->length);
+        device->scheduler.acquire(this);
+        inBudget = true;
+    }
+    return r;
+}
+
+bool SubmitScheduler::canStart(Transfer* t) const {
+    int endpoint = endpointIndex(t->transfer->endpoint);
+    for (int c = 0; c <= t->priority; c++) {
+        if (!queues[c].empty()) {
+            return false;
+        }
+    }
+    return (!classLimit[t->priority] || classInFlight[t->priority] < classLimit[t->priority])
+        && (!endpointLimit[endpoint] || endpointInFlight[endpoint] < endpointLimit[endpoint]);
+}
+
+// The next queued transfer to start, or NULL if none can. A class whose
+// next transfer doesn't fit the budgets holds back the less urgent ones, so
+// they can't use up the capacity it is waiting for.
+Transfer* SubmitScheduler::next(const TransferBudget& device, const TransferBudget& global) {
+    for (int c = 0; c < PRIORITY_CLASSES; c++) {
+        if (queues[c].empty() || (classLimit[c] && classInFlight[c] >= classLimit[c])) {
+            continue;
+        }
+        auto it = queues[c].upper_bound(lastEndpoint[c]);
+        for (size_t n = 0; n < queues[c].size(); n++, ++it) {
+            if (it == queues[c].end()) {
+                it = queues[c].begin();
+            }
+            int endpoint = it->first;
+            if (endpointLimit[endpoint] && endpointInFlight[endpoint] >= endpointLimit[endpoint]) {
+                continue;
+            }
+            Transfer* t = it->second.front();
+            uint64_t length = t->transfer->length;
+            if (!device.fits(length) || !global.fits(length)) {
+                return NULL;
+            }
+            lastEndpoint[c] = endpoint;
+            return t;
+        }
+    }
+    return NULL;
+}
+
+void SubmitScheduler::push(Transfer* t) {
+    queues[t->priority][endpointIndex(t->transfer->endpoint)].push_back(t);
+    queued++;
+}
+
+// Remove `t` from the front of its queue, after next() picked it
+void SubmitScheduler::pop(Transfer* t) {
+    auto& classQueues = queues[t->priority];
+    auto it = classQueues.find(endpointIndex(t->transfer->endpoint));
+    it->second.pop_front();
+    if (it->second.empty()) {
+        classQueues.erase(it);
+    }
+    queued--;
+}
+
+void SubmitScheduler::remove(Transfer* t) {
+    auto& classQueues = queues[t->priority];
+    auto it = classQueues.find(endpointIndex(t->transfer->endpoint));
+    it->second.erase(std::find(it->second.begin(), it->second.end(), t));
+    if (it->second.empty()) {
+        classQueues.erase(it);
+    }
+    queued--;
+}
+
+void SubmitScheduler::acquire(Transfer* t) {
+    classInFlight[t->priority]++;
+    endpointInFlight[endpointIndex(t->transfer->endpoint)]++;
+}
+
+void SubmitScheduler::release(Transfer* t) {
+    classInFlight[t->priority]--;
+    endpointInFlight[endpointIndex(t->transfer->endpoint)]--;
+}
+
+Napi::Object SubmitScheduler::toObject(Napi::Env env) const {
+    static const char* names[PRIORITY_CLASSES] = { "control", "interrupt", "bulk", "background" };
+    Napi::Object obj = Napi::Object::New(env);
+    for (int c = 0; c < PRIORITY_CLASSES; c++) {
+        size_t waiting = 0;
+        for (auto& queue : queues[c]) {
+            waiting += queue.second.size();
+        }
+        Napi::Object stats = Napi::Object::New(env);
+        stats.Set("limit", Napi::Number::New(env, classLimit[c]));
+        stats.Set("inFlight", Napi::Number::New(env, classInFlight[c]));
+        stats.Set("queued", Napi::Number::New(env, (double) waiting));
+        obj.Set(names[c], stats);
+    }
+    return obj;
+}
+
+// Submit queued transfers that the scheduler lets go and that now fit their
+// device and the global budget. A failed deferred submit is reported through
+// the normal completion path.
+void ModuleData::drainPendingTransfers() {
+    for (auto it = waitingDevices.begin(); it != waitingDevices.end();) {
+        Device* device = *it;
+        while (device->scheduler.queued > 0) {
+            Transfer* t = device->scheduler.next(device->budget, budget);
+            if (!t) {
+                break;
+            }
+            device->scheduler.pop(t);
+            t->queued = false;
+
+            int r = t->submitNow(this);
+            if (r < LIBUSB_SUCCESS) {
+                t->submitError = r;
+                device->completionQueue.post(t);
+            }
+        }
+
+        if (device->scheduler.queued == 0) {
+            it = waitingDevices.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Resubmit after a failure, from the libusb event thread
+void Transfer::resubmit() {
+    recoveryStats.retries++;
+    captureTransfer(instanceData, 'S', transfer);
+    int r = libusb_submit_transfer(transfer);
+    if (r < LIBUSB_SUCCESS) {
+        captureTransfer(instanceData, 'E', transfer, r);
+        submitError = r;
+        device->completionQueue.post(this);
+    }
+}
+
+// Called on the event thread for a failed transfer. Returns true if it was
+// (or will be) resubmitted rather than reported to JS.
+bool Transfer::recover() {
+    int status = transfer->status;
+    if (status == LIBUSB_TRANSFER_STALL) {
+        recoveryStats.stalls++;
+    } else if (status == LIBUSB_TRANSFER_TIMED_OUT) {
+        recoveryStats.timeouts++;
+        if (!recovery.retryTimeouts) {
+            return false;
+        }
+    } else if (status == LIBUSB_TRANSFER_ERROR) {
+        recoveryStats.errors++;
+    } else {
+        // Cancelled, device gone or overflow: nothing to retry
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(instanceData->retryLock);
+        if (cancelRequested) {
+            return false;
+        }
+        if (++attempt > recovery.maxRetries) {
+            recoveryStats.exhausted++;
+            return false;
+        }
+        if (status == LIBUSB_TRANSFER_STALL) {
+            // libusb_clear_halt blocks until the device answers, so it runs
+            // on a worker rather than here; see clearHalt()
+            clearingHalt = true;
+            device->completionQueue.post(this);
+        } else {
+            retryLocked();
+        }
+    }
+    return true;
+}
+
+// Clears the halt of a stalled endpoint on the thread pool, then retries.
+// libusb_clear_halt also resets the host side of the endpoint (its data
+// toggle), which a CLEAR_FEATURE request of our own would leave stale.
+struct Transfer_ClearHalt: Napi::AsyncWorker {
+    Transfer* t;
+    libusb_device_handle* handle;
+    unsigned char endpoint;
+    int errcode;
+
+    Transfer_ClearHalt(Transfer* t)
+        : Napi::AsyncWorker(t->Env(), "USBClearHalt"), t(t), handle(t->transfer->dev_handle), endpoint(t->transfer->endpoint), errcode(0) {}
+
+    void Execute() override {
+        errcode = libusb_clear_halt(handle, endpoint);
+    }
+
+    void OnOK() override {
+        t->haltCleared(errcode);
+    }
+};
+
+// On the JS thread, for a transfer that recover() passed on to clear its
+// halt. Returns false if it was cancelled meanwhile, to complete now.
+bool Transfer::clearHalt() {
+    {
+        std::lock_guard<std::mutex> guard(instanceData->retryLock);
+        if (!clearingHalt) {
+            return false;
+        }
+        if (cancelRequested) {
+            clearingHalt = false;
+            transfer->status = LIBUSB_TRANSFER_CANCELLED;
+            return false;
+        }
+    }
+    (new Transfer_ClearHalt(this))->Queue();
+    return true;
+}
+
+// The halt is cleared, or failed to clear: retry the transfer, or report the
+// STALL (or the cancellation asked for meanwhile)
+void Transfer::haltCleared(int r) {
+    {
+        std::lock_guard<std::mutex> guard(instanceData->retryLock);
+        clearingHalt = false;
+        if (cancelRequested) {
+            transfer->status = LIBUSB_TRANSFER_CANCELLED;
+        } else if (r < LIBUSB_SUCCESS) {
+            DEBUG_LOG("clear_halt failed during recovery %p %i", this, r);
+        } else {
+            retryLocked();
+            // The event thread may be waiting past a delayed retry queued from here
+            libusb_interrupt_event_handler(instanceData->usb_context);
+            return;
+        }
+    }
+    handleCompletion(this);
+}
+
+// Resubmit now, or once the backed off delay for this attempt has passed
+void Transfer::retryLocked() {
+    double delay = recovery.retryDelay;
+    for (int i = 1; i < attempt; i++) {
+        delay *= recovery.backoff;
+    }
+    if (delay < 1) {
+        resubmit();
+    } else {
+        auto due = std::chrono::steady_clock::now() + std::chrono::milliseconds((int64_t) delay);
+        instanceData->delayedRetries.emplace(due, this);
+    }
+}
+
+// Resubmit delayed retries that are due, and work out how long the event
+// thread may wait before the next one.
+void ModuleData::submitDueRetries(struct timeval* nextTimeout) {
+    nextTimeout->tv_sec = 60;
+    nextTimeout->tv_usec = 0;
+
+    std::lock_guard<std::mutex> guard(retryLock);
+    auto now = std::chrono::steady_clock::now();
+    while (!delayedRetries.empty() && delayedRetries.begin()->first <= now) {
+        Transfer* t = delayedRetries.begin()->second;
+        delayedRetries.erase(delayedRetries.begin());
+        t->resubmit();
+    }
+
+    if (!delayedRetries.empty()) {
+        int64_t wait = std::chrono::duration_cast<std::chrono::microseconds>(delayedRetries.begin()->first - now).count();
+        nextTimeout->tv_sec = (long) (wait / 1000000);
+        nextTimeout->tv_usec = (long) (wait % 1000000);
+    }
+}
+
 extern "C" void LIBUSB_CALL usbCompletionCb(libusb_transfer *transfer){
     Transfer* t = static_cast<Transfer*>(transfer->user_data);
     DEBUG_LOG("Completion callback %p", t);
     assert(t != NULL);
+    t->completeTime = uv_hrtime();
+    captureTransfer(t->instanceData, 'C', transfer);
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+        t->attempt = 0;
+    } else if (t->recovery.maxRetries > 0 && t->recover()) {
+        return;
+    }
     t->device->completionQueue.post(t);
 }
 
+
+extern "C" void LIBUSB_CALL splitCompletionCb(libusb_transfer *slot){
+    Transfer* t = static_cast<Transfer*>(slot->user_data);
+    SplitTransfer* split = t->split.get();
+    DEBUG_LOG("Split completion callback %p", t);
+    assert(split != NULL);
+    captureTransfer(t->instanceData, 'C', slot);
+
+    bool done;
+    {
+        std::lock_guard<std::mutex> guard(split->lock);
+        size_t i = std::find(split->slots.begin(), split->slots.end(), slot) - split->slots.begin();
+        size_t offset = slot->buffer - t->transfer->buffer;
+        split->busy[i] = false;
+        split->inFlight--;
+
+        if (slot->status != LIBUSB_TRANSFER_COMPLETED || slot->actual_length < slot->length) {
+            // Error, cancellation or a short packet ends the logical transfer
+            split->stop(offset + slot->actual_length, slot->status);
+        } else if (!split->stopped && split->next < split->length) {
+            int r = split->submitChunk(t->transfer, i);
+            if (r < LIBUSB_SUCCESS) {
+                split->submitError = r;
+                split->stop(split->next, LIBUSB_TRANSFER_ERROR);
+            }
+        }
+        done = split->inFlight == 0;
+    }
+
+    if (done) {
+        t->completeTime = uv_hrtime();
+        t->transfer->status = (libusb_transfer_status) split->status;
+        t->transfer->actual_length = (int) split->end;
+        t->submitError = split->status == LIBUSB_TRANSFER_ERROR ? split->submitError : 0;
+        t->device->completionQueue.post(t);
+    }
+}
+
+extern "C" void LIBUSB_CALL batchCompletionCb(libusb_transfer *slot){
+    Transfer* t = static_cast<Transfer*>(slot->user_data);
+    ControlBatch* batch = t->batch.get();
+    DEBUG_LOG("Batch completion callback %p", t);
+    assert(batch != NULL);
+    captureTransfer(t->instanceData, 'C', slot);
+
+    bool done = false;
+    {
+        std::lock_guard<std::mutex> guard(batch->lock);
+        unsigned char* header = t->transfer->buffer + batch->next;
+        writeInt32LE(header, slot->status);
+        writeInt32LE(header + 4, slot->actual_length);
+        batch->done++;
+
+        int status = slot->status;
+        if (status == LIBUSB_TRANSFER_CANCELLED || status == LIBUSB_TRANSFER_NO_DEVICE) {
+            // Nothing more can run
+            batch->status = status;
+            done = true;
+        } else if (status != LIBUSB_TRANSFER_COMPLETED && batch->stopOnError) {
+            batch->status = status;
+            done = true;
+        } else if (batch->stopped) {
+            batch->status = LIBUSB_TRANSFER_CANCELLED;
+            done = true;
+        } else {
+            batch->next += ControlBatch::requestSize(t->transfer->buffer, t->transfer->length, batch->next);
+            if (batch->next >= (size_t) t->transfer->length) {
+                done = true;
+            } else {
+                int r = batch->submitNext(t->transfer);
+                if (r < LIBUSB_SUCCESS) {
+                    batch->submitError = r;
+                    batch->status = LIBUSB_TRANSFER_ERROR;
+                    done = true;
+                }
+            }
+        }
+    }
+
+    if (done) {
+        t->completeTime = uv_hrtime();
+        t->transfer->status = (libusb_transfer_status) batch->status;
+        t->transfer->actual_length = (int) batch->done;
+        t->submitError = batch->submitError;
+        t->device->completionQueue.post(t);
+    }
+}
+
 void handleCompletion(Transfer* self){
     Napi::Env env = self->Env();
     Napi::HandleScope scope(env);
     DEBUG_LOG("HandleCompletion %p", self);
 
+    if (self->clearHalt()) {
+        return;
+    }
+
     self->device->unref();
 
+    ModuleData* instanceData = env.GetInstanceData<ModuleData>();
+    if (self->inBudget) {
+        self->device->budget.release(self->transfer->length);
+        instanceData->budget.release(self->transfer->length);
+        self->device->scheduler.release(self);
+        self->inBudget = false;
+    }
+    int submitError = self->submitError;
+    self->submitError = 0;
+
+    // Transfers that never completed in libusb (cancelled while queued,
+    // failed deferred submit) are stamped now
+    uint64_t completeTime = self->completeTime ? self->completeTime : uv_hrtime();
+    uint64_t submitTime = self->submitTime ? self->submitTime : completeTime;
+
     // The callback may resubmit and overwrite these, so need to clear the
     // persistent first.
     Napi::Object buffer = self->v8buffer.Value();
     self->v8buffer.Reset();
     self->transfer->buffer = NULL;
+    self->split.reset();
+    self->batch.reset();
+    // Ends with this completion; a resubmit from the callback gets its own
+    std::unique_ptr<Napi::AsyncContext> context = std::move(self->asyncContext);
+
+    if (!instanceData->waitingDevices.empty()) {
+        instanceData->drainPendingTransfers();
+    }
 
     if (!self->v8callback.IsEmpty()) {
         Napi::Value error = env.Undefined();
-        if (self->transfer->status != 0){
+        if (submitError != 0){
+            error = libusbException(env, submitError).Value();
+        } else if (self->transfer->status != 0){
             error = libusbException(env, self->transfer->status).Value();
         }
         try {
             self->v8callback.MakeCallback(self->Value(), { error, buffer,
-                Napi::Number::New(env, (uint32_t)self->transfer->actual_length) });
+                Napi::Number::New(env, (uint32_t)self->transfer->actual_length),
+                Napi::Number::New(env, completeTime / 1e6),
+                Napi::Number::New(env, submitTime / 1e6) }, context ? (napi_async_context) *context : nullptr);
         }
         catch (const Napi::Error& e) {
             e.ThrowAsJavaScriptException();
@@ -124,6 +814,60 @@ void handleCompletion(Transfer* self){
 Napi::Value Transfer::Cancel(const Napi::CallbackInfo& info){
     ENTER_METHOD(Transfer, 0);
     DEBUG_LOG("Cancel %p %i", self, !!self->transfer->buffer);
+    if (self->queued) {
+        // Never reached libusb, so complete it as cancelled from here
+        SubmitScheduler& scheduler = self->device->scheduler;
+        scheduler.remove(self);
+        if (scheduler.queued == 0) {
+            env.GetInstanceData<ModuleData>()->waitingDevices.remove(self->device);
+        }
+        self->queued = false;
+        self->transfer->status = LIBUSB_TRANSFER_CANCELLED;
+        self->device->completionQueue.post(self);
+        return Napi::Boolean::New(env, true);
+    }
+    if (self->split) {
+        std::lock_guard<std::mutex> guard(self->split->lock);
+        if (self->split->stopped || self->split->inFlight == 0) {
+            return Napi::Boolean::New(env, false);
+        }
+        self->split->stop(self->split->end, LIBUSB_TRANSFER_CANCELLED);
+        return Napi::Boolean::New(env, true);
+    }
+    if (self->batch) {
+        std::lock_guard<std::mutex> guard(self->batch->lock);
+        if (self->batch->stopped) {
+            return Napi::Boolean::New(env, false);
+        }
+        // Stops the batch after the running request if that one can't be cancelled
+        self->batch->stopped = true;
+        libusb_cancel_transfer(self->batch->slot);
+        return Napi::Boolean::New(env, true);
+    }
+    if (self->recovery.maxRetries > 0) {
+        // Keep the event thread from resubmitting it behind our back
+        ModuleData* instanceData = self->instanceData;
+        std::lock_guard<std::mutex> guard(instanceData->retryLock);
+        self->cancelRequested = true;
+        for (auto it = instanceData->delayedRetries.begin(); it != instanceData->delayedRetries.end(); ++it) {
+            if (it->second == self) {
+                instanceData->delayedRetries.erase(it);
+                self->transfer->status = LIBUSB_TRANSFER_CANCELLED;
+                self->device->completionQueue.post(self);
+                return Napi::Boolean::New(env, true);
+            }
+        }
+        if (self->clearingHalt) {
+            // Completes as cancelled once the halt is cleared
+            return Napi::Boolean::New(env, true);
+        }
+        int r = libusb_cancel_transfer(self->transfer);
+        if (r == LIBUSB_ERROR_NOT_FOUND){
+            return Napi::Boolean::New(env, false);
+        }
+        CHECK_USB(r);
+        return Napi::Boolean::New(env, true);
+    }
     int r = libusb_cancel_transfer(self->transfer);
     if (r == LIBUSB_ERROR_NOT_FOUND){
         // Not useful to throw an error for this case
@@ -134,13 +878,73 @@ Napi::Value Transfer::Cancel(const Napi::CallbackInfo& info){
     }
 }
 
+// Transfer.setRecovery(maxRetries, retryDelay, backoff, retryTimeouts)
+Napi::Value Transfer::SetRecovery(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(Transfer, 4);
+    int maxRetries, retryDelay;
+    INT_ARG(maxRetries, 0);
+    INT_ARG(retryDelay, 1);
+    if (!info[2].IsNumber()) {
+        THROW_BAD_ARGS("Parameter backoff (2) should be number");
+    }
+    double backoff = info[2].As<Napi::Number>().DoubleValue();
+    if (maxRetries < 0 || retryDelay < 0 || backoff < 1) {
+        THROW_BAD_ARGS("Invalid recovery policy");
+    }
+
+    // The event thread reads the policy while the transfer is in flight
+    if (self->transfer->buffer) {
+        THROW_ERROR("Transfer is already active")
+    }
+
+    self->recovery.maxRetries = maxRetries;
+    self->recovery.retryDelay = retryDelay;
+    self->recovery.backoff = backoff;
+    self->recovery.retryTimeouts = info[3].ToBoolean();
+    return env.Undefined();
+}
+
+Napi::Value Transfer::GetRecoveryStats(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(Transfer, 0);
+    Napi::Object stats = Napi::Object::New(env);
+    stats.Set("stalls", Napi::Number::New(env, self->recoveryStats.stalls));
+    stats.Set("timeouts", Napi::Number::New(env, self->recoveryStats.timeouts));
+    stats.Set("errors", Napi::Number::New(env, self->recoveryStats.errors));
+    stats.Set("retries", Napi::Number::New(env, self->recoveryStats.retries));
+    stats.Set("exhausted", Napi::Number::New(env, self->recoveryStats.exhausted));
+    return stats;
+}
+
+// Transfer.setPriority(priority)
+Napi::Value Transfer::SetPriority(const Napi::CallbackInfo& info) {
+    ENTER_METHOD(Transfer, 1);
+    int priority;
+    INT_ARG(priority, 0);
+    if (priority < 0 || priority >= PRIORITY_CLASSES) {
+        THROW_BAD_ARGS("Invalid priority");
+    }
+
+    // The scheduler keys queued and in-flight transfers by priority
+    if (self->transfer->buffer) {
+        THROW_ERROR("Transfer is already active")
+    }
+
+    self->priority = priority;
+    return env.Undefined();
+}
+
 Napi::Object Transfer::Init(Napi::Env env, Napi::Object exports) {
     exports.Set("Transfer", Transfer::DefineClass(
         env,
         "Transfer",
         {
             Transfer::InstanceMethod("submit", &Transfer::Submit),
+            Transfer::InstanceMethod("submitSplit", &Transfer::SubmitSplit),
+            Transfer::InstanceMethod("submitControlBatch", &Transfer::SubmitControlBatch),
             Transfer::InstanceMethod("cancel", &Transfer::Cancel),
+            Transfer::InstanceMethod("setRecovery", &Transfer::SetRecovery),
+            Transfer::InstanceMethod("getRecoveryStats", &Transfer::GetRecoveryStats),
+            Transfer::InstanceMethod("setPriority", &Transfer::SetPriority),
         }));
 
     return exports;
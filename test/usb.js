@@ -5,6 +5,7 @@ const getDeviceList = require('../').getDeviceList;
 const findByIds = require('../').findByIds;
 const findBySerialNumber = require('../').findBySerialNumber;
 const Worker = require('worker_threads').Worker;
+const AsyncLocalStorage = require('async_hooks').AsyncLocalStorage;
 
 if (typeof gc === 'function') {
     // Running with --expose-gc, do a sweep between tests so valgrind blames the right one.
@@ -18,6 +19,25 @@ describe('USB Module', () => {
         assert.ok(usb.LIBUSB_ENDPOINT_IN === 128);
     });
 
+    it('should not start libusb until first use', function() {
+        if (process.platform !== 'linux') {
+            this.skip();
+        }
+        // Count the event threads in a fresh process, before and after enumerating
+        const script = `
+            const fs = require('fs');
+            const threads = () => fs.readdirSync('/proc/self/task')
+                .filter(id => fs.readFileSync(\`/proc/self/task/\${id}/comm\`, 'utf8').trim() === 'node-usb events').length;
+            const { usb } = require(${JSON.stringify(require('path').join(__dirname, '..'))});
+            const before = threads();
+            usb.getDeviceList();
+            console.log(JSON.stringify({ before, after: threads() }));
+        `;
+        const result = JSON.parse(require('child_process').execFileSync(process.execPath, ['-e', script]).toString());
+        assert.equal(result.before, 0);
+        assert.equal(result.after, 1);
+    });
+
     it('should handle abuse without crashing', () => {
         assert.throws(() => new usb.Device());
         assert.throws(() => usb.Device());
@@ -44,6 +64,15 @@ describe('getDeviceList', () => {
     });
 });
 
+describe('getDeviceListAsync', () => {
+    it('should return the same devices as getDeviceList', async () => {
+        const devices = getDeviceList();
+        const asyncDevices = await usb.getDeviceListAsync();
+        assert.equal(asyncDevices.length, devices.length);
+        assert.ok(asyncDevices.every(device => devices.includes(device)));
+    });
+});
+
 describe('findByIds', () => {
     it('should return an array with length > 0', () => {
         const device = findByIds(0x59e3, 0x0a23);
@@ -58,7 +87,191 @@ describe('findBySerialNumber', () => {
     });
 });
 
+describe('wrapSysDevice', () => {
+    it('should open a device from a file descriptor', function() {
+        if (process.platform !== 'linux') {
+            this.skip();
+        }
+        const fs = require('fs');
+        const found = findByIds(0x59e3, 0x0a23);
+        const pad = n => String(n).padStart(3, '0');
+        const fd = fs.openSync(`/dev/bus/usb/${pad(found.busNumber)}/${pad(found.deviceAddress)}`, 'r+');
+        try {
+            const device = usb.wrapSysDevice(fd);
+            assert.equal(device.deviceDescriptor.idVendor, 0x59e3);
+            assert.ok(device.interfaces.length > 0);
+            device.close();
+        } finally {
+            fs.closeSync(fd);
+        }
+    });
+});
+
+describe('HidDecoder', () => {
+    // Mouse with report ID 2: three buttons, five bits of padding, then X, Y and wheel
+    const mouse = Buffer.from([
+        0x05, 0x01, 0x09, 0x02, 0xa1, 0x01, 0x85, 0x02, 0x09, 0x01, 0xa1, 0x00,
+        0x05, 0x09, 0x19, 0x01, 0x29, 0x03, 0x15, 0x00, 0x25, 0x01, 0x95, 0x03, 0x75, 0x01, 0x81, 0x02,
+        0x95, 0x01, 0x75, 0x05, 0x81, 0x01,
+        0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x09, 0x38, 0x15, 0x81, 0x25, 0x7f, 0x75, 0x08, 0x95, 0x03, 0x81, 0x06,
+        0xc0, 0xc0
+    ]);
+
+    it('should compile the report layout', () => {
+        const reports = new usb.HidDecoder(mouse).reports();
+        assert.equal(reports.length, 1);
+        assert.equal(reports[0].reportId, 2);
+        assert.equal(reports[0].size, 5);
+        assert.equal(reports[0].values, 6);
+        assert.deepEqual(reports[0].fields.map(field => field.bitOffset), [0, 8]);
+        assert.equal(reports[0].fields[1].usages[0], 0x10030);
+        assert.ok(reports[0].fields[1].isRelative);
+    });
+
+    it('should decode reports', () => {
+        const decoder = new usb.HidDecoder(mouse);
+        const report = decoder.decode(Buffer.from([0x02, 0x05, 0xfe, 0x03, 0x81]));
+        assert.equal(report.reportId, 2);
+        assert.deepEqual(Array.from(report.values), [1, 0, 1, -2, 3, -127]);
+        assert.equal(decoder.decode(Buffer.from([0x01, 0x00])), undefined);
+        assert.equal(decoder.decode(Buffer.from([0x02, 0x00])), undefined);
+    });
+
+    it('should reject malformed descriptors', () => {
+        assert.throws(() => new usb.HidDecoder(Buffer.from([0xa1, 0x01, 0x75, 0x08, 0x95, 0x01, 0x81, 0x02])));
+        assert.throws(() => new usb.HidDecoder(Buffer.from([0x75, 0x40, 0x95, 0x01, 0x81, 0x02])));
+        // Usage Minimum 0, Usage Maximum 0xFFFFFFFF
+        assert.throws(() => new usb.HidDecoder(Buffer.from([0x1b, 0x00, 0x00, 0x00, 0x00, 0x2b, 0xff, 0xff, 0xff, 0xff, 0x75, 0x01, 0x95, 0x10, 0x81, 0x02])));
+    });
+
+    it('should reject reports longer than 64 KiB', () => {
+        // Report Size 32, Report Count 4096: 16 KiB per Input item
+        const field = [0x81, 0x02];
+        const descriptor = count => Buffer.from([0x75, 0x20, 0x96, 0x00, 0x10, ...Array(count).fill(field).flat()]);
+        assert.equal(new usb.HidDecoder(descriptor(4)).reports().length, 1);
+        assert.throws(() => new usb.HidDecoder(descriptor(5)), /64 KiB/);
+    });
+
+    it('should accept a usage range ending at 0xFFFFFFFF', () => {
+        const decoder = new usb.HidDecoder(Buffer.from([0x1b, 0xf0, 0xff, 0xff, 0xff, 0x2b, 0xff, 0xff, 0xff, 0xff, 0x75, 0x01, 0x95, 0x10, 0x81, 0x02]));
+        const usages = decoder.reports()[0].fields[0].usages;
+        assert.equal(usages.length, 16);
+        assert.equal(usages[15], 0xffffffff);
+    });
+});
+
+describe('Framer', () => {
+    const feed = (framer, bytes) => framer.feed(Buffer.from(bytes)).map(frame => [...frame]);
+
+    it('should split length-prefixed frames across feeds', () => {
+        // Sync byte, then a big-endian 16-bit payload length
+        const framer = new usb.Framer({ mode: 'length', lengthOffset: 1, lengthSize: 2, littleEndian: false, maxFrameSize: 16 });
+        assert.deepEqual(feed(framer, [0xaa, 0x00]), []);
+        assert.deepEqual(feed(framer, [0x03, 1, 2, 3, 0xaa, 0x00, 0x01]), [[0xaa, 0x00, 0x03, 1, 2, 3]]);
+        assert.deepEqual(feed(framer, [9]), [[0xaa, 0x00, 0x01, 9]]);
+    });
+
+    it('should drop what is buffered on a length out of sync', () => {
+        const framer = new usb.Framer({ mode: 'length', lengthOffset: 1, lengthSize: 2, littleEndian: false, maxFrameSize: 16 });
+        assert.deepEqual(feed(framer, [0xaa, 0xff, 0xff, 1, 2]), []);
+        assert.equal(framer.stats().overflows, 5);
+        assert.deepEqual(feed(framer, [0xaa, 0x00, 0x01, 7]), [[0xaa, 0x00, 0x01, 7]]);
+    });
+
+    it('should find a delimiter split across feeds', () => {
+        const framer = new usb.Framer({ mode: 'delimiter', delimiter: '\r\n' });
+        assert.deepEqual(feed(framer, Buffer.from('ab\r')), []);
+        assert.deepEqual(framer.feed(Buffer.from('\ncd\r\n')).map(String), ['ab', 'cd']);
+        assert.deepEqual(feed(framer, Buffer.from('xyz')), []);
+        assert.deepEqual(feed(framer, Buffer.from('w')), []);
+        assert.deepEqual(framer.feed(Buffer.from('\r\n')).map(String), ['xyzw']);
+    });
+
+    it('should discard an oversized frame up to the next delimiter', () => {
+        const framer = new usb.Framer({ mode: 'delimiter', delimiter: Buffer.from('\r\n'), maxFrameSize: 8 });
+        assert.deepEqual(feed(framer, Buffer.from('0123456789')), []);
+        assert.deepEqual(framer.feed(Buffer.from('ab\r\nok\r\n')).map(String), ['ok']);
+        assert.equal(framer.stats().overflows, 12);
+    });
+
+    it('should check CRCs in their byte order', () => {
+        const check = Buffer.from('123456789');
+        const modbus = new usb.Framer({ mode: 'fixed', size: 11, crc: 'crc16-modbus' });
+        assert.equal(modbus.feed(Buffer.concat([check, Buffer.from([0x37, 0x4b])])).length, 1);
+        assert.equal(modbus.feed(Buffer.concat([check, Buffer.from([0x4b, 0x37])])).length, 0);
+        assert.equal(modbus.stats().crcErrors, 1);
+
+        const ccitt = new usb.Framer({ mode: 'fixed', size: 11, crc: 'crc16-ccitt' });
+        assert.equal(ccitt.feed(Buffer.concat([check, Buffer.from([0x29, 0xb1])])).length, 1);
+        assert.equal(ccitt.feed(Buffer.concat([check, Buffer.from([0xb1, 0x29])])).length, 0);
+
+        const crc32 = new usb.Framer({ mode: 'fixed', size: 13, crc: 'crc32' });
+        assert.equal(crc32.feed(Buffer.concat([check, Buffer.from([0x26, 0x39, 0xf4, 0xcb])])).length, 1);
+    });
+
+    it('should reject sizes that are not non-negative integers', () => {
+        assert.throws(() => new usb.Framer({ mode: 'fixed', size: -1 }), TypeError);
+        assert.throws(() => new usb.Framer({ mode: 'fixed', size: NaN }), TypeError);
+        assert.throws(() => new usb.Framer({ mode: 'fixed', size: 1.5 }), TypeError);
+        assert.throws(() => new usb.Framer({ mode: 'length', lengthOffset: 2 ** 53 }), TypeError);
+    });
+});
+
+describe('CdcAcm', () => {
+    const { CdcAcm } = require('../');
+
+    it('should find the data interface from the union descriptor', () => {
+        // Header, Call Management and Union (master 0, slave 2) functional descriptors
+        const extra = Buffer.from([0x05, 0x24, 0x00, 0x10, 0x01, 0x05, 0x24, 0x01, 0x00, 0x02, 0x05, 0x24, 0x06, 0x00, 0x02]);
+        assert.equal(CdcAcm.dataInterfaceNumber({ interfaceNumber: 0, descriptor: { extra } }), 2);
+        assert.equal(CdcAcm.dataInterfaceNumber({ interfaceNumber: 3, descriptor: { extra: Buffer.alloc(0) } }), 4);
+        assert.equal(CdcAcm.dataInterfaceNumber({ interfaceNumber: 3, descriptor: { extra: Buffer.from([0x00, 0x24, 0x06]) } }), 4);
+    });
+
+    it('should encode and decode the line coding', () => {
+        const buffer = CdcAcm.encodeLineCoding({ baudRate: 115200, dataBits: 7, stopBits: 2, parity: 'even' });
+        assert.deepEqual(buffer, Buffer.from([0x00, 0xc2, 0x01, 0x00, 0x02, 0x02, 0x07]));
+        assert.deepEqual(CdcAcm.decodeLineCoding(buffer), { baudRate: 115200, dataBits: 7, stopBits: 2, parity: 'even' });
+        assert.throws(() => CdcAcm.encodeLineCoding({ baudRate: 9600, dataBits: 9 }), TypeError);
+    });
+
+    it('should parse SERIAL_STATE notifications', () => {
+        const state = CdcAcm.parseSerialState(Buffer.from([0xa1, 0x20, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x43, 0x00]));
+        assert.deepEqual(state, { dcd: true, dsr: true, break: false, ring: false, framingError: false, parityError: false, overrun: true });
+        assert.equal(CdcAcm.parseSerialState(Buffer.from([0xa1, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00])), undefined);
+        assert.equal(CdcAcm.parseSerialState(Buffer.from([0xa1, 0x20, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00])), undefined);
+    });
+});
+
 describe('Hotplug', () => {
+    it('should set the settle window', () => {
+        assert.throws(() => { usb.hotplugSettleTime = -1; }, TypeError);
+        usb.hotplugSettleTime = 50;
+        assert.equal(usb.hotplugSettleTime, 50);
+        usb.hotplugSettleTime = 0;
+    });
+
+    it('should coalesce events over the settle window', () => {
+        // [ms, device, arrived]; each batch is delivered with one change event
+        const batches = usb._settleHotplugEvents(50, [
+            [0, 1, true], [10, 1, true],  // repeated: reported once
+            [20, 2, true], [30, 2, false], // attached and detached: not reported
+            [40, 3, false],
+            [200, 4, true]                 // after the window: a batch of its own
+        ]);
+        assert.deepEqual(batches, [[[1, true], [3, false]], [[4, true]]]);
+    });
+
+    it('should extend the settle window while events arrive, up to ten windows', () => {
+        const events = [];
+        for (let time = 0; time <= 1000; time += 40) {
+            events.push([time, time, true]);
+        }
+        const batches = usb._settleHotplugEvents(50, events);
+        assert.deepEqual(batches.map(batch => batch.length), [13, 13]);
+        assert.deepEqual(batches[1][0], [520, true]);
+    });
+
     it('should detect detach', done => {
         usb.once('detach', device => {
             assert.equal(device.deviceDescriptor.idVendor, 0x59e3);
@@ -89,6 +302,7 @@ describe('Device', () => {
     it('should have sane properties', () => {
         assert.ok(device.busNumber > 0, 'busNumber must be larger than 0');
         assert.ok(device.deviceAddress > 0, 'deviceAddress must be larger than 0');
+        assert.ok(device.speed >= usb.LIBUSB_SPEED_LOW, 'speed must be known');
         if (process.platform !== 'darwin' || process.arch !== 'arm64') {
             assert.ok(util.isArray(device.portNumbers), 'portNumbers must be an array');
         }
@@ -102,6 +316,19 @@ describe('Device', () => {
         assert.ok(device.configDescriptor !== undefined);
     });
 
+    it('should open and close asynchronously', async () => {
+        await device.openAsync();
+        assert.ok(device.interfaces);
+        await device.closeAsync();
+        assert.equal(device.interfaces, undefined);
+    });
+
+    it('should open and claim asynchronously', async () => {
+        await device.openAndClaimAsync([0]);
+        await util.promisify(cb => device.interfaces[0].release(cb))();
+        await device.closeAsync();
+    });
+
     it('should open', () => {
         device.open();
     });
@@ -148,6 +375,50 @@ describe('Device', () => {
                 done();
             });
         });
+
+        it('should run a batch of requests in one call', done => {
+            device.controlTransferBatch([
+                { bmRequestType: 0x40, bRequest: 0x81, wValue: 0, wIndex: 0, data: buffer },
+                { bmRequestType: 0xc0, bRequest: 0xff, wValue: 0, wIndex: 0, length: 64 },
+                { bmRequestType: 0xc0, bRequest: 0x81, wValue: 0, wIndex: 0, length: 128 }
+            ], { continueOnError: true }, (error, results) => {
+                assert.ok(error === undefined, error);
+                assert.equal(results.length, 3);
+                assert.equal(results[0].actualLength, buffer.length);
+                assert.equal(results[1].status, usb.LIBUSB_TRANSFER_STALL);
+                assert.equal(results[2].data.toString(), buffer.toString());
+                done();
+            });
+        });
+
+        it('should stop a batch at the first error', done => {
+            device.controlTransferBatch([
+                { bmRequestType: 0xc0, bRequest: 0xff, wValue: 0, wIndex: 0, length: 64 },
+                { bmRequestType: 0xc0, bRequest: 0x81, wValue: 0, wIndex: 0, length: 128 }
+            ], {}, (error, results) => {
+                assert.equal(error.errno, usb.LIBUSB_TRANSFER_STALL);
+                assert.equal(results.length, 1);
+                done();
+            });
+        });
+
+        it('should be captured to pcap', done => {
+            const path = require('path').join(require('os').tmpdir(), `node-usb-${process.pid}.pcap`);
+            usb.startCapture(path, { snaplen: 16 });
+            device.controlTransfer(0xc0, 0x81, 0, 0, 128, error => {
+                assert.ok(error === undefined, error);
+                const stats = usb.stopCapture();
+                assert.equal(stats.packets, 2);
+                assert.equal(stats.dropped, 0);
+
+                const file = require('fs').readFileSync(path);
+                require('fs').unlinkSync(path);
+                assert.equal(file.readUInt32LE(20), 220);
+                // Global header, then submit (no data) and completion (16 of 128 bytes)
+                assert.equal(file.length, 24 + (16 + 64) + (16 + 64 + 16));
+                done();
+            });
+        });
     });
 
     describe('Interface', () => {
@@ -216,6 +487,45 @@ describe('Device', () => {
                 });
             });
 
+            it('should stamp reads on the event thread', done => {
+                const before = Number(process.hrtime.bigint()) / 1e6;
+                inEndpoint.transfer(64, (error, data, completeTime, submitTime) => {
+                    const after = Number(process.hrtime.bigint()) / 1e6;
+                    assert.ok(error === undefined, error);
+                    assert.ok(before <= submitTime && submitTime <= completeTime && completeTime <= after);
+                    done();
+                });
+            });
+
+            it('should run callbacks in the context of the submitter', done => {
+                const storage = new AsyncLocalStorage();
+                let pending = 0;
+                // Pooled transfers are reused, so resubmit from the callbacks under another store
+                ['a', 'b'].forEach(store => storage.run(store, () => {
+                    pending++;
+                    inEndpoint.transfer(64, error => {
+                        assert.ok(error === undefined, error);
+                        assert.equal(storage.getStore(), store);
+                        storage.run(store + '2', () => inEndpoint.transfer(64, () => {
+                            assert.equal(storage.getStore(), store + '2');
+                            if (--pending === 0) {
+                                done();
+                            }
+                        }));
+                    });
+                }));
+            });
+
+            it('should support split reads', done => {
+                inEndpoint.splitTransfers = { chunkSize: 256, concurrency: 4 };
+                inEndpoint.transfer(4096, (error, data) => {
+                    inEndpoint.splitTransfers = undefined;
+                    assert.ok(error === undefined, error);
+                    assert.equal(data.length, 4096);
+                    done();
+                });
+            });
+
             it('times out', done => {
                 iface.endpoints[4].timeout = 20;
                 iface.endpoints[4].transfer(64, error => {
@@ -246,6 +556,154 @@ describe('Device', () => {
                 });
             });
 
+            it('polls the device with recovery enabled', done => {
+                let packets = 0;
+
+                inEndpoint.recovery = { maxRetries: 3, retryDelay: 5 };
+                inEndpoint.startPoll(4, 64, error => {
+                    inEndpoint.recovery = undefined;
+                    assert.ok(error === undefined, error);
+                    assert.equal(inEndpoint.recoveryStats.exhausted, 0);
+                    done();
+                });
+
+                inEndpoint.on('data', () => {
+                    if (++packets === 20) {
+                        inEndpoint.removeAllListeners('data');
+                        inEndpoint.stopPoll();
+                    }
+                });
+            });
+
+            it('clears a STALL and retries when recovery is enabled', done => {
+                const before = inEndpoint.recoveryStats;
+                // SET_FEATURE(ENDPOINT_HALT) makes the next read STALL
+                device.controlTransfer(0x02, 0x03, 0, 0x81, Buffer.alloc(0), error => {
+                    assert.ok(error === undefined, error);
+                    inEndpoint.recovery = { maxRetries: 2 };
+                    inEndpoint.startPoll(1, 64, error => {
+                        inEndpoint.recovery = undefined;
+                        assert.ok(error === undefined, error);
+                        const stats = inEndpoint.recoveryStats;
+                        assert.equal(stats.stalls - before.stalls, 1);
+                        assert.equal(stats.retries - before.retries, 1);
+                        assert.equal(stats.exhausted, before.exhausted);
+                        done();
+                    });
+                    inEndpoint.once('data', data => {
+                        assert.equal(data.length, 64);
+                        inEndpoint.stopPoll();
+                    });
+                });
+            });
+
+            it('polls the device with adaptive transfer sizes', done => {
+                let packets = 0;
+
+                assert.equal(inEndpoint.maxPacketSize, inEndpoint.descriptor.wMaxPacketSize);
+                assert.equal(inEndpoint.burstSize, inEndpoint.descriptor.wMaxPacketSize);
+                inEndpoint.startAdaptivePoll({ interval: 10 }, error => {
+                    assert.ok(error === undefined, error);
+                    assert.equal(inEndpoint.adaptivePollStats, undefined);
+                    done();
+                });
+
+                inEndpoint.on('data', () => {
+                    if (++packets === 200) {
+                        const stats = inEndpoint.adaptivePollStats;
+                        assert.ok(stats.throughput > 0);
+                        assert.equal(stats.transferSize % inEndpoint.burstSize, 0);
+                        assert.ok(stats.nTransfers >= 2 && stats.nTransfers <= 16);
+                        inEndpoint.removeAllListeners('data');
+                        inEndpoint.stopPoll();
+                    }
+                });
+            });
+
+            it('polls the device decoding HID reports', done => {
+                // 64 one-byte vendor values per report
+                const decoder = new usb.HidDecoder(Buffer.from([
+                    0x06, 0x00, 0xff, 0x09, 0x01, 0xa1, 0x01, 0x15, 0x00, 0x26, 0xff, 0x00, 0x75, 0x08, 0x95, 0x40, 0x09, 0x01, 0x81, 0x02, 0xc0
+                ]));
+                let reports = 0;
+
+                inEndpoint.startHidPoll(decoder, 4, 64);
+                inEndpoint.on('reports', batch => {
+                    batch.forEach(report => {
+                        assert.equal(report.reportId, 0);
+                        assert.equal(report.values.length, 64);
+                    });
+                    reports += batch.length;
+                    if (reports >= 20) {
+                        inEndpoint.removeAllListeners('reports');
+                        assert.ok(inEndpoint.hidStats.reports >= reports);
+                        inEndpoint.stopPoll(done);
+                    }
+                });
+            });
+
+            it('polls the device keeping the latest report', done => {
+                let events = 0;
+
+                inEndpoint.startLatestPoll(4, 64, 20);
+                inEndpoint.on('data', data => {
+                    assert.equal(data.length, 64);
+                    if (++events === 3) {
+                        inEndpoint.removeAllListeners('data');
+                        const latest = inEndpoint.readLatest();
+                        assert.ok(latest.reports >= events);
+                        inEndpoint.stopPoll(done);
+                    }
+                });
+            });
+
+            it('polls the device splitting fixed-size frames', done => {
+                let frames = 0;
+
+                inEndpoint.startFramedPoll({ mode: 'fixed', size: 48 }, 4, 64);
+                inEndpoint.on('frames', batch => {
+                    batch.forEach(frame => assert.equal(frame.length, 48));
+                    frames += batch.length;
+                    if (frames >= 20) {
+                        inEndpoint.removeAllListeners('frames');
+                        assert.ok(inEndpoint.framingStats.frames >= frames);
+                        inEndpoint.stopPoll(done);
+                    }
+                });
+            });
+
+            it('polls the device passing the byte stream through', done => {
+                let bytes = 0;
+
+                inEndpoint.startFramedPoll({ mode: 'stream' }, 4, 256);
+                inEndpoint.on('frames', batch => {
+                    batch.forEach(frame => assert.equal(frame.length % 64, 0));
+                    bytes += batch.reduce((total, frame) => total + frame.length, 0);
+                    if (bytes >= 4096) {
+                        inEndpoint.removeAllListeners('frames');
+                        assert.equal(inEndpoint.framingStats.overflows, 0);
+                        inEndpoint.stopPoll(done);
+                    }
+                });
+            });
+
+            it('pumps the endpoint to a file descriptor', done => {
+                const fs = require('fs');
+                const path = require('path').join(require('os').tmpdir(), `node-usb-pump-${process.pid}.bin`);
+                const fd = fs.openSync(path, 'w');
+
+                inEndpoint.pump(fd, { length: 4096 }, (error, stats) => {
+                    fs.closeSync(fd);
+                    const size = fs.statSync(path).size;
+                    fs.unlinkSync(path);
+                    assert.ok(error === undefined, error);
+                    assert.equal(stats.bytes, 4096);
+                    assert.equal(size, 4096);
+                    assert.equal(stats.inFlight, 0);
+                    done();
+                });
+            });
+
             it('polls the device using a callback', done => {
                 let packets = 0;
 
@@ -301,6 +759,78 @@ describe('Device', () => {
                 });
             });
 
+            it('should support gather writes', done => {
+                const header = Buffer.from([1, 2, 3]);
+                const payload = Buffer.alloc(200, 0x55);
+                outEndpoint.transferv([header, payload], (error, actual, segmentBytes) => {
+                    assert.ok(error === undefined, error);
+                    assert.equal(actual, 203);
+                    assert.deepEqual(segmentBytes, [3, 200]);
+                    done();
+                });
+            });
+
+            it('should fail fast over the transfer budget', done => {
+                device.setTransferBudget({ maxTransfers: 1, queue: false });
+                outEndpoint.transfer([1, 2, 3, 4], error => {
+                    assert.ok(error === undefined, error);
+                });
+                outEndpoint.transfer([5, 6, 7, 8], error => {
+                    assert.equal(error.errno, usb.LIBUSB_ERROR_BUSY);
+                    device.setTransferBudget({ maxTransfers: 0 });
+                    done();
+                });
+            });
+
+            it('should queue over the transfer budget', done => {
+                device.setTransferBudget({ maxTransfers: 1, queue: true });
+                outEndpoint.transfer([1, 2, 3, 4]);
+                assert.equal(device.transferBudget.transfers, 1);
+                outEndpoint.transfer([5, 6, 7, 8], error => {
+                    assert.ok(error === undefined, error);
+                    assert.equal(device.transferBudget.queued, 0);
+                    device.setTransferBudget({ maxTransfers: 0, queue: false });
+                    done();
+                });
+                assert.equal(device.transferBudget.queued, 1);
+            });
+
+            it('should let control transfers past queued bulk transfers', done => {
+                device.setSchedulerLimits({ bulk: 1 });
+                outEndpoint.transfer([1, 2, 3, 4]);
+                outEndpoint.transfer([5, 6, 7, 8], error => {
+                    assert.ok(error === undefined, error);
+                    device.setSchedulerLimits({ bulk: 0 });
+                    done();
+                });
+                assert.equal(device.schedulerStats.bulk.queued, 1);
+                device.controlTransfer(0xc0, 0x81, 0, 0, 128, error => {
+                    assert.ok(error === undefined, error);
+                });
+                assert.equal(device.schedulerStats.control.inFlight, 1);
+            });
+
+            it('stops a pump reading from an idle pipe', function(done) {
+                if (process.platform === 'win32') {
+                    this.skip();
+                }
+                const fs = require('fs');
+                const path = require('path').join(require('os').tmpdir(), `node-usb-pump-${process.pid}.fifo`);
+                require('child_process').execFileSync('mkfifo', [path]);
+                // Opened for reading and writing, so that neither the open nor a read ever sees the end of the file
+                const fd = fs.openSync(path, 'r+');
+
+                const pump = outEndpoint.pump(fd, {}, (error, stats) => {
+                    fs.closeSync(fd);
+                    fs.unlinkSync(path);
+                    assert.ok(error === undefined, error);
+                    assert.equal(stats.bytes, 0);
+                    assert.equal(stats.inFlight, 0);
+                    done();
+                });
+                setTimeout(() => pump.stop(), 100);
+            });
+
             it('times out', done => {
                 iface.endpoints[5].timeout = 20;
                 iface.endpoints[5].transfer([1, 2, 3, 4], error => {
@@ -320,7 +850,119 @@ describe('Device', () => {
     });
 });
 
+describe('PersistentDevice', () => {
+    const { PersistentDevice } = require('../');
+
+    it('should claim and poll through a stable identity', async () => {
+        const device = findByIds(0x59e3, 0x0a23);
+        const persistent = await PersistentDevice.open(device);
+        assert.ok(persistent.key.startsWith(`${device.busNumber}-`));
+        assert.equal(persistent.device, device);
+
+        await persistent.claimInterface(0);
+        await new Promise(resolve => {
+            persistent.startPoll(0x81, 2, 64);
+            persistent.once('data', (address, data) => {
+                assert.equal(address, 0x81);
+                assert.equal(data.length, 64);
+                resolve();
+            });
+        });
+        await persistent.close();
+        assert.equal(persistent.device, undefined);
+    });
+});
+
+describe('MassStorage', () => {
+    const { MassStorage } = require('../');
+
+    it('should refuse a device without a mass storage interface', async () => {
+        const device = findByIds(0x59e3, 0x0a23);
+        await assert.rejects(MassStorage.open(device), /No Bulk-Only mass storage interface/);
+        device.close();
+    });
+
+    // Writes to the device: only run against a scratch device such as g_mass_storage, named as vid:pid
+    it('should write and read back blocks', async function() {
+        const target = process.env.NODE_USB_TEST_MASS_STORAGE;
+        if (!target) {
+            this.skip();
+        }
+        const [vid, pid] = target.split(':').map(id => parseInt(id, 16));
+        const device = findByIds(vid, pid);
+        const storage = await MassStorage.open(device, { maxCommandSize: 64 * 1024 });
+        const { blockSize, blocks } = await storage.readCapacity();
+        const count = Math.min(blocks, Math.ceil(256 * 1024 / blockSize));
+        const lba = blocks - count;
+
+        const original = await storage.readBlocks(lba, count);
+        const pattern = Buffer.alloc(count * blockSize);
+        for (let i = 0; i < pattern.length; i++) {
+            pattern[i] = (i * 7) & 0xff;
+        }
+        await storage.writeBlocks(lba, pattern);
+        assert.ok(pattern.equals(await storage.readBlocks(lba, count)));
+        await storage.writeBlocks(lba, original);
+        await storage.synchronizeCache().catch(() => undefined);
+
+        const stats = storage.stats();
+        assert.ok(stats.commands >= 4 * Math.ceil(count * blockSize / (64 * 1024)));
+        assert.equal(stats.queued, 0);
+        await storage.close();
+        device.close();
+    });
+});
+
 if (process.platform !== 'win32') {
+    describe('Broker', () => {
+        const { BrokerServer, BrokerClient } = require('../');
+        const path = require('path').join(require('os').tmpdir(), `node-usb-broker-${process.pid}.sock`);
+        let server;
+
+        before(() => {
+            server = new BrokerServer(path);
+            return server.listen();
+        });
+
+        it('should share a device between clients', async () => {
+            const clients = await Promise.all([BrokerClient.connect(path), BrokerClient.connect(path)]);
+            const info = (await clients[0].getDeviceList()).find(item => item.deviceDescriptor.idVendor === 0x59e3 && item.deviceDescriptor.idProduct === 0x0a23);
+            assert.ok(info, 'Demo device is not attached');
+
+            const devices = await Promise.all(clients.map(client => client.openDevice(info.key)));
+            await devices[0].claimInterface(0);
+            await assert.rejects(devices[1].claimInterface(0), error => error.errno === usb.LIBUSB_ERROR_BUSY);
+
+            const data = Buffer.from([1, 2, 3, 4]);
+            await devices[1].controlTransfer(0x40, 0x81, 0, 0, data);
+            const echo = await devices[0].controlTransfer(0xc0, 0x81, 0, 0, 4);
+            assert.deepEqual(echo, data);
+
+            await devices[0].close();
+            await Promise.all(clients.map(client => client.close()));
+        });
+
+        it('should only let the owner connect by default', () => {
+            assert.equal(require('fs').statSync(path).mode & 0o777, 0o600);
+        });
+
+        it('should drop a client sending an oversized frame', async () => {
+            const socket = require('net').connect(path);
+            const prefix = Buffer.alloc(12);
+            prefix.writeUInt32LE(0xffffffff, 0);
+            socket.write(prefix);
+            await new Promise(resolve => socket.once('close', resolve));
+        });
+
+        it('should reject requests after the connection closes', async () => {
+            const client = await BrokerClient.connect(path);
+            await client.close();
+            await assert.rejects(client.getDeviceList(), /closed/);
+        });
+
+        after(() => server.close());
+    });
+
     describe('Context Aware', () => {
         it('should handle opening the same device from different contexts', async () => {
             await Promise.all(Array.from({ length: 5 }, () => new Promise((resolve, reject) => {
@@ -0,0 +1,168 @@
+import { EventEmitter } from 'events';
+import { connect, Socket } from 'net';
+import * as usb from '../usb';
+import { BrokerHeader, BrokerMessage, encodeMessage, MessageReader } from './protocol';
+import { BrokerDeviceInfo } from './server';
+
+interface PendingRequest {
+    resolve: (value: { result: unknown, payload: Buffer }) => void;
+    reject: (error: Error) => void;
+}
+
+/**
+ * Connects to a `BrokerServer` to use the devices it shares.
+ */
+export class BrokerClient extends EventEmitter {
+    private reader = new MessageReader();
+    private pending = new Map<number, PendingRequest>();
+    private nextId = 1;
+
+    protected constructor(protected socket: Socket) {
+        super();
+        socket.on('data', chunk => {
+            let messages: BrokerMessage[];
+            try {
+                messages = this.reader.push(chunk);
+            } catch (error) {
+                socket.destroy(error as Error);
+                return;
+            }
+            for (const message of messages) {
+                const request = this.pending.get(message.id);
+                if (!request) {
+                    continue;
+                }
+                this.pending.delete(message.id);
+                if (message.header.error) {
+                    request.reject(Object.assign(new Error(message.header.error.message), { errno: message.header.error.errno }) as usb.LibUSBException);
+                } else {
+                    request.resolve({ result: message.header.result, payload: message.payload });
+                }
+            }
+        });
+        socket.on('error', error => this.emit('error', error));
+        socket.on('close', () => {
+            for (const request of this.pending.values()) {
+                request.reject(new Error('Broker connection closed'));
+            }
+            this.pending.clear();
+            this.emit('close');
+        });
+    }
+
+    /**
+     * Connect to the broker listening at `path`.
+     * @param path
+     */
+    public static connect(path: string): Promise<BrokerClient> {
+        return new Promise((resolve, reject) => {
+            const socket = connect(path);
+            socket.once('error', reject);
+            socket.once('connect', () => {
+                socket.removeListener('error', reject);
+                resolve(new BrokerClient(socket));
+            });
+        });
+    }
+
+    /** List the devices attached to the broker. */
+    public async getDeviceList(): Promise<BrokerDeviceInfo[]> {
+        return (await this.request({ op: 'list' })).result as BrokerDeviceInfo[];
+    }
+
+    /**
+     * Open a device through the broker. Other clients may have the same device open.
+     * @param key The `key` of a device from `getDeviceList()`
+     */
+    public async openDevice(key: string): Promise<BrokerDevice> {
+        const info = (await this.request({ op: 'open', device: key })).result as BrokerDeviceInfo;
+        return new BrokerDevice(this, info);
+    }
+
+    /** Disconnect from the broker, which releases any devices and interfaces still held. */
+    public close(): Promise<void> {
+        return new Promise(resolve => {
+            if (this.socket.destroyed) {
+                resolve();
+                return;
+            }
+            this.socket.once('close', () => resolve());
+            this.socket.end();
+        });
+    }
+
+    /** @hidden */
+    public request(header: BrokerHeader, payload?: Buffer): Promise<{ result: unknown, payload: Buffer }> {
+        return new Promise((resolve, reject) => {
+            if (this.socket.destroyed) {
+                reject(new Error('Broker connection closed'));
+                return;
+            }
+            const id = this.nextId;
+            this.nextId = (this.nextId % 0xffffffff) + 1;
+            this.pending.set(id, { resolve, reject });
+            this.socket.write(encodeMessage(id, header, payload));
+        });
+    }
+}
+
+/**
+ * A device opened through a `BrokerClient`.
+ */
+export class BrokerDevice {
+    constructor(private client: BrokerClient, public readonly info: BrokerDeviceInfo) {
+    }
+
+    /**
+     * Perform a control transfer, as with `Device.controlTransfer()`.
+     *
+     * Resolves with the data read for IN transfers, or the number of bytes written for OUT transfers.
+     */
+    public async controlTransfer(bmRequestType: number, bRequest: number, wValue: number, wIndex: number, data_or_length: number | Buffer): Promise<Buffer | number> {
+        const isIn = !!(bmRequestType & usb.LIBUSB_ENDPOINT_IN);
+        const header = { op: 'control', device: this.info.key, bmRequestType, bRequest, wValue, wIndex, length: isIn ? data_or_length as number : undefined };
+        const reply = await this.client.request(header, isIn ? undefined : data_or_length as Buffer);
+        return isIn ? reply.payload : reply.result as number;
+    }
+
+    /**
+     * Claim an interface for this client. Fails with `LIBUSB_ERROR_BUSY` if another client holds it.
+     * @param interfaceNumber
+     */
+    public async claimInterface(interfaceNumber: number): Promise<void> {
+        await this.client.request({ op: 'claim', device: this.info.key, interface: interfaceNumber });
+    }
+
+    /**
+     * Release an interface claimed by this client.
+     * @param interfaceNumber
+     */
+    public async releaseInterface(interfaceNumber: number): Promise<void> {
+        await this.client.request({ op: 'release', device: this.info.key, interface: interfaceNumber });
+    }
+
+    /**
+     * Read up to `length` bytes from an IN endpoint of a claimed interface.
+     * @param endpoint Endpoint address
+     * @param length
+     * @param timeout Timeout in milliseconds (0 means unlimited)
+     */
+    public async transferIn(endpoint: number, length: number, timeout = 0): Promise<Buffer> {
+        return (await this.client.request({ op: 'transfer', device: this.info.key, endpoint, length, timeout })).payload;
+    }
+
+    /**
+     * Write `data` to an OUT endpoint of a claimed interface, resolving with the number of bytes written.
+     * @param endpoint Endpoint address
+     * @param data
+     * @param timeout Timeout in milliseconds (0 means unlimited)
+     */
+    public async transferOut(endpoint: number, data: Buffer, timeout = 0): Promise<number> {
+        return (await this.client.request({ op: 'transfer', device: this.info.key, endpoint, timeout }, data)).result as number;
+    }
+
+    /** Close the device for this client, releasing its interfaces. The broker closes the device once no client has it open. */
+    public async close(): Promise<void> {
+        await this.client.request({ op: 'close', device: this.info.key });
+    }
+}
@@ -0,0 +1,2 @@
+export { BrokerServer, BrokerDeviceInfo } from './server';
+export { BrokerClient, BrokerDevice } from './client';
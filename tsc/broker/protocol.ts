@@ -0,0 +1,106 @@
+/**
+ * Wire format shared by `BrokerServer` and `BrokerClient`.
+ *
+ * Each frame is: u32 length of the rest of the frame, u32 request id, u32 header length, a JSON header, then any binary payload.
+ * All integers are little-endian. Responses carry the id of their request.
+ */
+
+const PREFIX_SIZE = 12;
+
+export interface BrokerMessage {
+    id: number;
+    header: BrokerHeader;
+    payload: Buffer;
+}
+
+export interface BrokerHeader {
+    op?: string;
+    error?: { message: string; errno?: number };
+    [key: string]: unknown;
+}
+
+export const encodeMessage = (id: number, header: BrokerHeader, payload?: Buffer): Buffer => {
+    const json = Buffer.from(JSON.stringify(header));
+    const payloadLength = payload ? payload.length : 0;
+    const prefix = Buffer.alloc(PREFIX_SIZE);
+    prefix.writeUInt32LE(PREFIX_SIZE - 4 + json.length + payloadLength, 0);
+    prefix.writeUInt32LE(id, 4);
+    prefix.writeUInt32LE(json.length, 8);
+    return payload ? Buffer.concat([prefix, json, payload]) : Buffer.concat([prefix, json]);
+};
+
+/** Largest frame a `MessageReader` accepts by default. */
+export const MAX_FRAME_SIZE = 64 * 1024 * 1024;
+
+/**
+ * Reassembles frames from a stream of socket chunks.
+ *
+ * Chunks are only joined once a whole frame has arrived, so a large payload costs one copy however many chunks it came in. A frame
+ * longer than `maxFrameSize`, or whose header does not fit in it, throws: the stream cannot be trusted after that, so the caller
+ * should drop the connection.
+ */
+export class MessageReader {
+    private chunks: Buffer[] = [];
+    private length = 0;
+
+    constructor(private maxFrameSize = MAX_FRAME_SIZE) {
+    }
+
+    public push(chunk: Buffer): BrokerMessage[] {
+        this.chunks.push(chunk);
+        this.length += chunk.length;
+
+        const messages: BrokerMessage[] = [];
+        while (this.length >= 4) {
+            const frameLength = this.peek(4).readUInt32LE(0);
+            if (frameLength < PREFIX_SIZE - 4 || frameLength > this.maxFrameSize) {
+                throw new Error(`Invalid broker frame length ${frameLength}`);
+            }
+            if (this.length - 4 < frameLength) {
+                break;
+            }
+
+            const frame = this.take(4 + frameLength);
+            const id = frame.readUInt32LE(4);
+            const headerLength = frame.readUInt32LE(8);
+            if (headerLength > frameLength - (PREFIX_SIZE - 4)) {
+                throw new Error(`Invalid broker header length ${headerLength}`);
+            }
+            const payloadStart = PREFIX_SIZE + headerLength;
+            messages.push({
+                id,
+                header: JSON.parse(frame.toString('utf8', PREFIX_SIZE, payloadStart)),
+                payload: frame.subarray(payloadStart)
+            });
+        }
+        return messages;
+    }
+
+    // A buffer starting with at least `size` bytes, joining only the chunks they span
+    private peek(size: number): Buffer {
+        while (this.chunks[0].length < size) {
+            this.chunks.splice(0, 2, Buffer.concat([this.chunks[0], this.chunks[1]]));
+        }
+        return this.chunks[0];
+    }
+
+    // Remove and return the first `size` bytes
+    private take(size: number): Buffer {
+        const parts: Buffer[] = [];
+        let needed = size;
+        while (needed > 0) {
+            const chunk = this.chunks[0];
+            if (chunk.length <= needed) {
+                parts.push(chunk);
+                this.chunks.shift();
+                needed -= chunk.length;
+            } else {
+                parts.push(chunk.subarray(0, needed));
+                this.chunks[0] = chunk.subarray(needed);
+                needed = 0;
+            }
+        }
+        this.length -= size;
+        return parts.length === 1 ? parts[0] : Buffer.concat(parts, size);
+    }
+}
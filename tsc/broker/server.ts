@@ -0,0 +1,320 @@
+import { EventEmitter } from 'events';
+import { promises as fs } from 'fs';
+import { createServer, Server, Socket } from 'net';
+import { promisify } from 'util';
+import * as usb from '../usb';
+import { DeviceDescriptor } from '../usb/descriptors';
+import { InEndpoint, OutEndpoint } from '../usb/endpoint';
+import { Interface } from '../usb/interface';
+import { BrokerHeader, BrokerMessage, encodeMessage, MessageReader } from './protocol';
+
+/** Description of a device shared by a broker. */
+export interface BrokerDeviceInfo {
+    /** Key identifying the device to the broker */
+    key: string;
+    busNumber: number;
+    deviceAddress: number;
+    portNumbers: number[];
+    deviceDescriptor: DeviceDescriptor;
+}
+
+/** Options for `BrokerServer.listen()`. */
+export interface BrokerListenOptions {
+    /** Permissions of the socket file (default `0o600`, only the user running the broker). Ignored on Windows. */
+    mode?: number;
+    /** Owner to give the socket file, e.g. to let another user's processes connect. Ignored on Windows. */
+    uid?: number;
+    /** Group to give the socket file, usually with a `mode` of `0o660`. Ignored on Windows. */
+    gid?: number;
+}
+
+interface SharedDevice {
+    device: usb.Device;
+    clients: Set<Socket>;
+    /** Client which claimed each interface number */
+    owners: Map<number, Socket>;
+}
+
+interface Reply {
+    result?: unknown;
+    payload?: Buffer;
+}
+
+const deviceKey = (device: usb.Device): string => `${device.busNumber}-${device.deviceAddress}`;
+
+const brokerError = (message: string, errno?: number): Error => Object.assign(new Error(message), { errno });
+
+/**
+ * Shares the USB devices of this process with other processes over a local socket (a Unix domain socket path, or a named pipe on Windows).
+ *
+ * This is a request/response protocol run by this Node process: every request and its payload travel through the socket, so it
+ * suits coordinating access to devices and moderate data rates, not bulk streaming at the speed of a local libusb handle.
+ *
+ * The broker owns the libusb context and device handles; clients (see `BrokerClient`) open devices, claim interfaces and run transfers
+ * through it. Several clients may open the same device, but each interface can only be claimed by one client at a time. Interfaces and
+ * devices held by a client are released when it disconnects.
+ *
+ * Any process that can connect to the socket can use the devices, so access is controlled by the permissions of the socket file.
+ */
+export class BrokerServer extends EventEmitter {
+    protected server: Server;
+    protected devices = new Map<string, SharedDevice>();
+    protected opening = new Map<string, Promise<SharedDevice>>();
+    protected sockets = new Set<Socket>();
+    protected releasing = new WeakMap<Socket, Promise<void>>();
+
+    constructor(public readonly path: string) {
+        super();
+        this.server = createServer(socket => this.handleConnection(socket));
+        this.server.on('error', error => this.emit('error', error));
+    }
+
+    /**
+     * Start accepting clients. The socket file is restricted to `options.mode` before the promise resolves; for a socket that no
+     * other user can reach at all, even briefly, put it in a directory only the intended users can enter.
+     * @param options
+     */
+    public async listen(options: BrokerListenOptions = {}): Promise<void> {
+        await new Promise<void>((resolve, reject) => {
+            this.server.once('error', reject);
+            this.server.listen(this.path, () => {
+                this.server.removeListener('error', reject);
+                resolve();
+            });
+        });
+        if (process.platform === 'win32') {
+            return;
+        }
+        try {
+            await fs.chmod(this.path, options.mode ?? 0o600);
+            if (options.uid !== undefined || options.gid !== undefined) {
+                await fs.chown(this.path, options.uid ?? -1, options.gid ?? -1);
+            }
+        } catch (error) {
+            await promisify(this.server.close).bind(this.server)();
+            throw error;
+        }
+    }
+
+    /** Disconnect all clients, release their devices and stop accepting new ones. */
+    public async close(): Promise<void> {
+        const closed = promisify(this.server.close).bind(this.server)();
+        for (const socket of this.sockets) {
+            socket.destroy();
+        }
+        await Promise.all([...this.sockets].map(socket => this.releaseClient(socket)));
+        await closed;
+    }
+
+    protected handleConnection(socket: Socket): void {
+        const reader = new MessageReader();
+        this.sockets.add(socket);
+        this.emit('connection', socket);
+
+        socket.on('data', chunk => {
+            let messages: BrokerMessage[];
+            try {
+                messages = reader.push(chunk);
+            } catch (error) {
+                socket.destroy(error as Error);
+                return;
+            }
+            for (const message of messages) {
+                this.handleMessage(socket, message);
+            }
+        });
+        socket.on('error', () => socket.destroy());
+        socket.on('close', () => {
+            if (this.sockets.delete(socket)) {
+                this.releaseClient(socket).catch(error => this.emit('error', error));
+            }
+        });
+    }
+
+    protected async handleMessage(socket: Socket, message: BrokerMessage): Promise<void> {
+        let header: BrokerHeader;
+        let payload: Buffer | undefined;
+        try {
+            const reply = await this.dispatch(socket, message.header, message.payload);
+            header = { result: reply.result };
+            payload = reply.payload;
+        } catch (error) {
+            const e = error as usb.LibUSBException;
+            header = { error: { message: e.message, errno: e.errno } };
+        }
+        if (!socket.destroyed) {
+            socket.write(encodeMessage(message.id, header, payload));
+        }
+    }
+
+    protected async dispatch(socket: Socket, header: BrokerHeader, payload: Buffer): Promise<Reply> {
+        switch (header.op) {
+            case 'list':
+                return { result: (await usb.getDeviceListAsync()).map(device => this.describe(device)) };
+            case 'open':
+                return this.open(socket, header.device as string);
+            case 'close':
+                await this.closeDevice(socket, this.shared(socket, header.device as string));
+                return {};
+            case 'claim':
+                return this.claim(socket, header.device as string, header.interface as number);
+            case 'release':
+                return this.release(socket, header.device as string, header.interface as number);
+            case 'control':
+                return this.control(socket, header, payload);
+            case 'transfer':
+                return this.transfer(socket, header, payload);
+            default:
+                throw brokerError(`Unknown broker operation: ${header.op}`);
+        }
+    }
+
+    protected describe(device: usb.Device): BrokerDeviceInfo {
+        return {
+            key: deviceKey(device),
+            busNumber: device.busNumber,
+            deviceAddress: device.deviceAddress,
+            portNumbers: device.portNumbers,
+            deviceDescriptor: device.deviceDescriptor
+        };
+    }
+
+    protected async open(socket: Socket, key: string): Promise<Reply> {
+        let shared = this.devices.get(key);
+        if (!shared) {
+            // Clients opening the same device at once share one open
+            let opening = this.opening.get(key);
+            if (!opening) {
+                opening = this.openShared(key);
+                this.opening.set(key, opening);
+            }
+            try {
+                shared = await opening;
+            } finally {
+                this.opening.delete(key);
+            }
+        }
+        shared.clients.add(socket);
+        return { result: this.describe(shared.device) };
+    }
+
+    protected async openShared(key: string): Promise<SharedDevice> {
+        const device = (await usb.getDeviceListAsync()).find(item => deviceKey(item) === key);
+        if (!device) {
+            throw brokerError(`Device ${key} not found`, usb.LIBUSB_ERROR_NO_DEVICE);
+        }
+        await device.openAsync();
+        const shared = { device, clients: new Set<Socket>(), owners: new Map<number, Socket>() };
+        this.devices.set(key, shared);
+        return shared;
+    }
+
+    protected shared(socket: Socket, key: string): SharedDevice {
+        const shared = this.devices.get(key);
+        if (!shared || !shared.clients.has(socket)) {
+            throw brokerError(`Device ${key} is not open`);
+        }
+        return shared;
+    }
+
+    protected ownedInterface(socket: Socket, shared: SharedDevice, interfaceNumber: number): Interface {
+        if (shared.owners.get(interfaceNumber) !== socket) {
+            throw brokerError(`Interface ${interfaceNumber} is not claimed by this client`);
+        }
+        return shared.device.interface(interfaceNumber);
+    }
+
+    protected async claim(socket: Socket, key: string, interfaceNumber: number): Promise<Reply> {
+        const shared = this.shared(socket, key);
+        const owner = shared.owners.get(interfaceNumber);
+        if (owner === socket) {
+            return {};
+        }
+        if (owner) {
+            throw brokerError(`Interface ${interfaceNumber} is claimed by another client`, usb.LIBUSB_ERROR_BUSY);
+        }
+        const iface = shared.device.interface(interfaceNumber);
+        if (!iface) {
+            throw brokerError(`Interface ${interfaceNumber} not found`, usb.LIBUSB_ERROR_NOT_FOUND);
+        }
+        shared.owners.set(interfaceNumber, socket);
+        try {
+            await iface.claimAsync();
+        } catch (error) {
+            shared.owners.delete(interfaceNumber);
+            throw error;
+        }
+        return {};
+    }
+
+    protected async release(socket: Socket, key: string, interfaceNumber: number): Promise<Reply> {
+        const shared = this.shared(socket, key);
+        const iface = this.ownedInterface(socket, shared, interfaceNumber);
+        shared.owners.delete(interfaceNumber);
+        await iface.releaseAsync();
+        return {};
+    }
+
+    protected async control(socket: Socket, header: BrokerHeader, payload: Buffer): Promise<Reply> {
+        const shared = this.shared(socket, header.device as string);
+        const bmRequestType = header.bmRequestType as number;
+        const isIn = !!(bmRequestType & usb.LIBUSB_ENDPOINT_IN);
+        const data = await new Promise<Buffer | number | undefined>((resolve, reject) => {
+            shared.device.controlTransfer(bmRequestType, header.bRequest as number, header.wValue as number, header.wIndex as number,
+                isIn ? header.length as number : payload, (error, result) => error ? reject(error) : resolve(result));
+        });
+        return isIn ? { payload: data as Buffer } : { result: data };
+    }
+
+    protected async transfer(socket: Socket, header: BrokerHeader, payload: Buffer): Promise<Reply> {
+        const shared = this.shared(socket, header.device as string);
+        const address = header.endpoint as number;
+        const iface = shared.device.interfaces?.find(item => item.endpoint(address));
+        if (!iface) {
+            throw brokerError(`Endpoint ${address} not found`, usb.LIBUSB_ERROR_NOT_FOUND);
+        }
+        const endpoint = this.ownedInterface(socket, shared, iface.interfaceNumber).endpoint(address) as InEndpoint | OutEndpoint;
+        const isIn = endpoint instanceof InEndpoint;
+        const buffer = isIn ? Buffer.alloc(header.length as number) : payload;
+
+        // A transfer of its own with the request's timeout, rather than setting endpoint.timeout, which every request on the endpoint shares
+        const actual = await new Promise<number>((resolve, reject) => {
+            endpoint.makeTransfer((header.timeout as number) || 0, (error, _buffer, actualLength) => error ? reject(error) : resolve(actualLength))
+                .submit(buffer);
+        });
+        return isIn ? { payload: buffer.subarray(0, actual) } : { result: actual };
+    }
+
+    protected async closeDevice(socket: Socket, shared: SharedDevice): Promise<void> {
+        for (const [interfaceNumber, owner] of shared.owners) {
+            if (owner === socket) {
+                shared.owners.delete(interfaceNumber);
+                const iface = shared.device.interface(interfaceNumber);
+                await iface.releaseAsync().catch(() => undefined);
+            }
+        }
+        shared.clients.delete(socket);
+        if (shared.clients.size === 0) {
+            this.devices.delete(deviceKey(shared.device));
+            await shared.device.closeAsync();
+        }
+    }
+
+    // Release everything a client holds, once: both close() and the socket closing call this
+    protected releaseClient(socket: Socket): Promise<void> {
+        let releasing = this.releasing.get(socket);
+        if (!releasing) {
+            releasing = this.releaseDevices(socket);
+            this.releasing.set(socket, releasing);
+        }
+        return releasing;
+    }
+
+    protected async releaseDevices(socket: Socket): Promise<void> {
+        for (const shared of [...this.devices.values()]) {
+            if (shared.clients.has(socket)) {
+                await this.closeDevice(socket, shared);
+            }
+        }
+    }
+}
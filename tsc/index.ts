@@ -48,6 +48,19 @@ const findBySerialNumber = async (serialNumber: string): Promise<usb.Device | un
     return undefined;
 };
 
+/**
+ * Convenience method to open many devices (and optionally claim interfaces on them) in parallel on the thread pool.
+ *
+ * Resolves with one entry per device: `undefined` on success, or the error that device failed with.
+ * @param devices
+ * @param interfaces Interface numbers to claim on every device
+ * @param autoDetachKernelDriver Optionally enable/disable automatic kernel driver detachment before claiming
+ */
+const openDevices = (devices: usb.Device[], interfaces: number[] = [], autoDetachKernelDriver?: boolean): Promise<(usb.LibUSBException | undefined)[]> => {
+    return Promise.all(devices.map(device => device.openAndClaimAsync(interfaces, autoDetachKernelDriver)
+        .then(() => undefined, error => error as usb.LibUSBException)));
+};
+
 const webusb = new WebUSB();
 
 export {
@@ -57,17 +70,26 @@ export {
     // Convenience methods
     findByIds,
     findBySerialNumber,
+    openDevices,
 
     // Default WebUSB object (mimics navigator.usb)
     webusb
 };
 
 // Usb types
-export { Device, Transfer, DeviceEvents, getDeviceList, useUsbDkBackend, LibUSBException } from './usb';
+export { Device, Transfer, DeviceEvents, getDeviceList, getDeviceListAsync, useUsbDkBackend, useNoDeviceDiscovery, wrapSysDevice, LibUSBException, TransferBudget, TransferBudgetUsage, CaptureOptions, CaptureStats, RecoveryPolicy, RecoveryStats, LatestReport, FramingOptions, FramingStats, Framer, PumpOptions, PumpStats, BotEngineStats, HidDecoder, HidField, HidReportInfo, HidReport, HidPollStats, ControlRequest, ControlResult, TransferPriority, SchedulerLimits, SchedulerClassStats } from './usb';
 export * from './usb/capability';
 export * from './usb/descriptors';
 export * from './usb/endpoint';
 export * from './usb/interface';
+export * from './usb/transfer-pool';
+export * from './usb/poll-tuner';
+export * from './usb/persistent-device';
+export * from './usb/cdc-acm';
+export * from './usb/mass-storage';
+
+// Broker for sharing devices between processes
+export * from './broker';
 
 // WebUSB types
 export * from './webusb';
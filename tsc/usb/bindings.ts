@@ -15,6 +15,15 @@ module.exports = usb;
  */
 export declare function getDeviceList(): Device[];
 
+/**
+ * Return a promise of the list of `Device` objects for the USB devices attached to the system.
+ *
+ * Enumeration runs on the thread pool, and devices which are already known keep their existing `Device` objects.
+ */
+export declare function getDeviceListAsync(): Promise<Device[]>;
+
+export declare function _getDeviceListAsync(callback: (error: LibUSBException | undefined, devices?: Device[]) => void): void;
+
 /**
  * Force polling loop for hotplug events
  */
@@ -25,6 +34,18 @@ export declare let pollHotplug: boolean;
  */
 export declare let pollHotplugDelay: number;
 
+/**
+ * Settle window for native hotplug events (ms). When non-zero, events are held until none has arrived for this long, but no longer than
+ * ten windows after the first one. Repeated events for a device are dropped, a device attached and detached again meanwhile is not
+ * reported at all, and the rest are delivered together, followed by one `change` event. The default, `0`, delivers each event as it
+ * happens.
+ */
+export declare let hotplugSettleTime: number;
+
+/**
+ * Result of `libusb_init`. libusb is initialized, and its event thread started, on first use (enumeration or hotplug events)
+ * rather than when the module loads, so this is `0` until then. A failure is also thrown from the call that needed libusb.
+ */
 export declare const INIT_ERROR: number;
 
 export declare class LibUSBException extends Error {
@@ -42,10 +63,159 @@ export declare function setDebugLevel(level: number): void;
  */
 export declare function useUsbDkBackend(): void;
 
+/**
+ * Stop libusb from enumerating devices, for processes that only reach devices through `wrapSysDevice()`: no sysfs scan,
+ * no hotplug monitoring. Must be called before libusb is first used, and applies to every context created in the process.
+ */
+export declare function useNoDeviceDiscovery(): void;
+
+/**
+ * Return an open `Device` for a file descriptor of a USB device node (e.g. `/dev/bus/usb/001/004`) opened by another,
+ * privileged process, without enumerating. Closing the device leaves the file descriptor open; wrap it again to reopen.
+ * Linux and Android only.
+ * @param fd
+ * @param defaultConfig Set up the interfaces of the current configuration, as `Device.open()` does (default `true`)
+ */
+export declare function wrapSysDevice(fd: number, defaultConfig?: boolean): Device;
+
+export declare function _wrapSysDevice(fd: number): Device;
+
 export declare function _supportedHotplugEvents(): boolean;
 export declare function _enableHotplugEvents(): void;
 export declare function _disableHotplugEvents(): void;
 export declare function _getLibusbCapability(capability: number): number;
+export declare function _setHotplugSettleTime(settleMs: number): void;
+/** Batches `[timeMs, deviceId, arrived]` events as the settle window would, for testing. */
+export declare function _settleHotplugEvents(settleMs: number, events: [number, number, boolean][]): [number, boolean][][];
+
+/** Limits on transfers in flight, for a device or for the whole module. */
+export declare interface TransferBudget {
+    /** Maximum number of transfers in flight, or `0` for no limit */
+    maxTransfers: number;
+
+    /** Maximum number of buffer bytes pinned by transfers in flight, or `0` for no limit. A single transfer is always allowed. */
+    maxBytes: number;
+
+    /** Queue submits over budget until capacity frees up, instead of failing them with `LIBUSB_ERROR_BUSY` */
+    queue: boolean;
+}
+
+/** A transfer budget along with its current usage. */
+export declare interface TransferBudgetUsage extends TransferBudget {
+    /** Number of transfers in flight */
+    transfers: number;
+
+    /** Number of buffer bytes pinned by transfers in flight */
+    bytes: number;
+
+    /** Number of transfers waiting for budget */
+    queued: number;
+}
+
+/** One request of `Device.controlTransferBatch()`. */
+export declare interface ControlRequest {
+    bmRequestType: number;
+    bRequest: number;
+    wValue: number;
+    wIndex: number;
+
+    /** Data to send, for OUT requests */
+    data?: Uint8Array;
+
+    /** Number of bytes to read, for IN requests */
+    length?: number;
+}
+
+/** The outcome of one request of `Device.controlTransferBatch()`. */
+export declare interface ControlResult {
+    /** Transfer status, `usb.LIBUSB_TRANSFER_COMPLETED` (0) on success, e.g. `usb.LIBUSB_TRANSFER_STALL` if the device rejected the request */
+    status: number;
+
+    /** Bytes actually transferred */
+    actualLength: number;
+
+    /** Data read, for IN requests; a view of the batch's result buffer */
+    data?: Buffer;
+}
+
+/**
+ * Priority classes of a device's submission scheduler, most urgent first. Transfers default to the class of their type,
+ * with isochronous transfers in `'interrupt'`; `'background'` is only used when asked for.
+ */
+export type TransferPriority = 'control' | 'interrupt' | 'bulk' | 'background';
+
+/** In-flight limits of a device's submission scheduler, see `Device.setSchedulerLimits()`. */
+export declare interface SchedulerLimits {
+    /** Maximum transfers in flight for each priority class, or `0` for no limit */
+    control: number;
+    interrupt: number;
+    bulk: number;
+    background: number;
+
+    /** Maximum transfers in flight on an endpoint, keyed by endpoint address, or `0` for no limit */
+    endpoints: { [address: number]: number };
+}
+
+/** Usage of one priority class of a device's submission scheduler. */
+export declare interface SchedulerClassStats {
+    /** Maximum transfers in flight, or `0` for no limit */
+    limit: number;
+
+    /** Transfers in flight */
+    inFlight: number;
+
+    /** Transfers waiting to be submitted */
+    queued: number;
+}
+
+/**
+ * Set the budget shared by transfers on all devices.
+ * @param budget
+ */
+export declare function setTransferBudget(budget: Partial<TransferBudget>): void;
+
+/**
+ * Get the budget shared by transfers on all devices, along with its current usage.
+ */
+export declare function getTransferBudget(): TransferBudgetUsage;
+
+export declare function _setTransferBudget(maxTransfers: number, maxBytes: number, queue: boolean): void;
+export declare function _getTransferBudget(): TransferBudgetUsage;
+
+/** Options for `startCapture()`. */
+export declare interface CaptureOptions {
+    /** Maximum number of payload bytes recorded per submit or completion (default `65536`) */
+    snaplen?: number;
+
+    /** Size in bytes of each in-memory ring buffering records for the writer thread (default 4 MiB). Records are dropped when it is full. */
+    bufferSize?: number;
+}
+
+/** Totals for a finished capture. */
+export declare interface CaptureStats {
+    /** Number of records written */
+    packets: number;
+
+    /** Number of records dropped because the ring buffer was full */
+    dropped: number;
+}
+
+/**
+ * Start recording every transfer submit and completion to a pcap file at `path`, in the `LINKTYPE_USB_LINUX_MMAPPED` (usbmon) format read by Wireshark.
+ *
+ * Records are queued in lock-free ring buffers and written by a background thread.
+ * @param path
+ * @param options
+ */
+export declare function startCapture(path: string, options?: CaptureOptions): void;
+
+/**
+ * Stop the capture started by `startCapture()`, flushing and closing the file. Returns `undefined` if no capture was running.
+ */
+export declare function stopCapture(): CaptureStats | undefined;
+
+export declare function _startCapture(path: string, snaplen: number, bufferSize: number): void;
+export declare function _stopCapture(): CaptureStats | undefined;
 
 /**
  * Restore (re-reference) the hotplug events unreferenced by `unrefHotplugEvents()`
@@ -57,16 +227,80 @@ export declare function refHotplugEvents(): void;
  */
 export declare function unrefHotplugEvents(): void;
 
+/** Policy for recovering from transfer failures on the libusb event thread, without a round trip through JS. */
+export declare interface RecoveryPolicy {
+    /** Consecutive retries before the failure is reported, or `0` to disable recovery */
+    maxRetries: number;
+
+    /** Delay in milliseconds before the first retry (default `0`) */
+    retryDelay?: number;
+
+    /** Multiplier applied to the delay for each further retry (default `2`) */
+    backoff?: number;
+
+    /** Also retry transfers that timed out (default `true`) */
+    retryTimeouts?: boolean;
+}
+
+/** Counters kept by transfer recovery. */
+export declare interface RecoveryStats {
+    /** STALLs seen (each is cleared with `clearHalt` before retrying) */
+    stalls: number;
+
+    /** Timeouts seen */
+    timeouts: number;
+
+    /** Other transfer errors seen */
+    errors: number;
+
+    /** Resubmissions made */
+    retries: number;
+
+    /** Failures reported after running out of retries */
+    exhausted: number;
+}
+
 /** Represents a USB transfer */
 export declare class Transfer {
-    constructor(device: Device, endpointAddr: number, type: number, timeout: number, callback: (error: LibUSBException, buf: Buffer, actual: number) => void);
+    /**
+     * Create a transfer. The callback also receives `completeTime` and `submitTime`: when libusb completed and was handed the transfer,
+     * in milliseconds on the `process.hrtime()` clock (compare with `Number(process.hrtime.bigint()) / 1e6`), captured on the libusb
+     * event thread so that event loop delays are not included.
+     */
+    constructor(device: Device, endpointAddr: number, type: number, timeout: number, callback: (error: LibUSBException, buf: Buffer, actual: number, completeTime: number, submitTime: number) => void);
 
     /**
      * (Re-)submit the transfer.
      *
      * @param buffer Buffer where data will be written (for IN transfers) or read from (for OUT transfers).
      */
-    submit(buffer: Buffer, callback?: (error: LibUSBException | undefined, buffer: Buffer, actualLength: number) => void): Transfer;
+    submit(buffer: Buffer, callback?: (error: LibUSBException | undefined, buffer: Buffer, actualLength: number, completeTime: number, submitTime: number) => void): Transfer;
+
+    /**
+     * (Re-)submit the transfer as consecutive chunks of `chunkSize` bytes, keeping up to `concurrency` of them in flight.
+     *
+     * The chunks read into (or write from) slices of `buffer` and are resubmitted by the libusb event thread, and the callback is
+     * called once for the whole buffer. A short packet, error or cancellation ends the transfer, with `actualLength` counting the
+     * bytes transferred in order up to that point. `chunkSize` should be a multiple of the endpoint's maximum packet size.
+     *
+     * @param buffer Buffer where data will be written (for IN transfers) or read from (for OUT transfers).
+     * @param chunkSize Size in bytes of each chunk.
+     * @param concurrency Number of chunks to keep in flight.
+     */
+    submitSplit(buffer: Buffer, chunkSize: number, concurrency: number): Transfer;
+
+    /**
+     * (Re-)submit a control transfer as a batch of requests packed in `buffer`, run back to back by the libusb event thread.
+     *
+     * Each request is an 8 byte result header followed by its setup packet and data; the header is filled in with the transfer
+     * status and actual length (int32 little-endian) as the request completes. The callback is called once for the batch, with
+     * `actualLength` counting the requests that ran. With `stopOnError` the first failed request ends the batch and its status
+     * is the error; otherwise the batch carries on and only cancellation or a lost device end it early.
+     *
+     * @param buffer Packed requests.
+     * @param stopOnError Whether a failed request ends the batch.
+     */
+    submitControlBatch(buffer: Buffer, stopOnError: boolean): Transfer;
 
     /**
      * Cancel the transfer.
@@ -74,6 +308,312 @@ export declare class Transfer {
      * Returns `true` if the transfer was canceled, `false` if it wasn't in pending state.
      */
     cancel(): boolean;
+
+    /**
+     * Recover from STALLs, timeouts and transfer errors: timeouts and errors are resubmitted from the libusb event thread, and a
+     * STALL is first cleared with `clearHalt` on the thread pool. The transfer is resubmitted with the same buffer, up to `maxRetries`
+     * times in a row. Can't be changed while the transfer is active.
+     */
+    setRecovery(maxRetries: number, retryDelay: number, backoff: number, retryTimeouts: boolean): void;
+
+    /** Counters kept by recovery for this transfer. */
+    getRecoveryStats(): RecoveryStats;
+
+    /**
+     * Set the scheduler priority class (see `TransferPriority`), by default from the transfer type. Can't be changed while the
+     * transfer is active.
+     */
+    setPriority(priority: number): void;
+}
+
+/** Snapshot of the newest report kept by a `LatestPoll`. */
+export declare interface LatestReport {
+    /** Copy of the newest report, or `undefined` if none has arrived yet */
+    data?: Buffer;
+
+    /** Number of reports received */
+    reports: number;
+
+    /** Number of reports overwritten before they were read */
+    dropped: number;
+
+    /** When the newest report completed, in milliseconds on the `process.hrtime()` clock */
+    completeTime?: number;
+}
+
+/** Polls an IN endpoint from the libusb event thread, keeping only the newest report. See `InEndpoint.startLatestPoll()`. */
+export declare class LatestPoll {
+    constructor(device: Device, endpointAddr: number, type: number, nTransfers: number, transferSize: number, callback: (error: LibUSBException | undefined, ended: boolean) => void);
+
+    /** Submit the transfers. */
+    start(): void;
+
+    /** Cancel the transfers; the callback is called with `ended` set once they have all finished. */
+    stop(): void;
+
+    /** Copy out the newest report. */
+    read(): LatestReport;
+
+    /** Have the callback called once for the next report, or straight away if there is one not yet read. */
+    arm(): void;
+}
+
+/** How `InEndpoint.startFramedPoll()` splits the received byte stream into frames. */
+export declare interface FramingOptions {
+    /**
+     * `'fixed'`: frames of `size` bytes. `'length'`: each frame starts with a length field. `'delimiter'`: frames end with `delimiter`,
+     * which is removed (empty frames are skipped). `'stream'`: no framing, the data of each transfer is one frame, so a batch is the
+     * byte stream received since the last one.
+     */
+    mode: 'fixed' | 'length' | 'delimiter' | 'stream';
+
+    /** Frame size in bytes for `'fixed'` framing */
+    size?: number;
+
+    /** Bytes before the length field, e.g. a sync byte or message type (default 0) */
+    lengthOffset?: number;
+
+    /** Width of the length field in bytes: 1, 2 or 4 (default 1) */
+    lengthSize?: number;
+
+    /** Byte order of the length field (default `true`) */
+    littleEndian?: boolean;
+
+    /** Whether the length counts the whole frame rather than just the payload after the length field and before any CRC (default `false`) */
+    lengthIncludesHeader?: boolean;
+
+    /** Frame terminator for `'delimiter'` framing */
+    delimiter?: Buffer | string;
+
+    /** Check a CRC in the last bytes of each frame, computed over the bytes before it. Frames that fail are dropped. */
+    crc?: 'crc16-ccitt' | 'crc16-modbus' | 'crc32';
+
+    /** Byte order of the CRC (default big-endian for `'crc16-ccitt'`, little-endian otherwise) */
+    crcLittleEndian?: boolean;
+
+    /** Larger frames (or out of sync length fields) are discarded (default 65536) */
+    maxFrameSize?: number;
+}
+
+/** Counters of a `FramedPoll`. */
+export declare interface FramingStats {
+    /** Complete frames received */
+    frames: number;
+
+    /** Frames dropped because of a bad CRC */
+    crcErrors: number;
+
+    /** Bytes discarded because they did not fit in `maxFrameSize` or had a bad length field */
+    overflows: number;
+}
+
+/** Polls an IN endpoint from the libusb event thread, splitting the data into frames there. See `InEndpoint.startFramedPoll()`. */
+export declare class FramedPoll {
+    /**
+     * The callback receives the frames completed since it last ran as one buffer `data` with the end offset of each frame in `ends`,
+     * and the time the newest of them completed.
+     */
+    constructor(device: Device, endpointAddr: number, type: number, nTransfers: number, transferSize: number, framing: FramingOptions,
+        callback: (error: LibUSBException | undefined, ended: boolean, data: Buffer | undefined, ends: Uint32Array | undefined, completeTime: number) => void);
+
+    /** Submit the transfers. */
+    start(): void;
+
+    /** Cancel the transfers; the callback is called with `ended` set once they have all finished. */
+    stop(): void;
+
+    stats(): FramingStats;
+}
+
+/** Splits a byte stream into frames as `InEndpoint.startFramedPoll()` does, for data from elsewhere. */
+export declare class Framer {
+    /** Throws if the options are invalid. */
+    constructor(framing: FramingOptions);
+
+    /** Add `data` to the stream, returning the frames it completes. */
+    feed(data: Buffer): Buffer[];
+
+    stats(): Omit<FramingStats, 'frames'>;
+}
+
+/** One Input item of a HID report, see `HidDecoder.reports()`. */
+export declare interface HidField {
+    /** Index of the field's first value in the decoded `values` */
+    valueIndex: number;
+
+    /** Number of values (Report Count) */
+    count: number;
+
+    /** Position in the report in bits, after any report ID byte */
+    bitOffset: number;
+
+    /** Bits per value (Report Size) */
+    bitSize: number;
+
+    /** Data of the Input item */
+    flags: number;
+
+    /** Array fields decode to the usage ID each value selects (0 for none); variable fields to one value per usage */
+    isArray: boolean;
+
+    /** Values are relative to the previous report, e.g. mouse movement */
+    isRelative: boolean;
+
+    usagePage: number;
+
+    /** Extended usages, `(usagePage << 16) | usageId`. Values of variable fields past the last usage share the last one. */
+    usages: number[];
+
+    logicalMinimum: number;
+    logicalMaximum: number;
+    physicalMinimum: number;
+    physicalMaximum: number;
+    unit: number;
+    unitExponent: number;
+}
+
+/** Layout of one Input report, see `HidDecoder.reports()`. */
+export declare interface HidReportInfo {
+    /** Report ID, or 0 when the device does not use report IDs */
+    reportId: number;
+
+    /** Report length in bytes, including the report ID byte if any */
+    size: number;
+
+    /** Number of decoded values */
+    values: number;
+
+    fields: HidField[];
+}
+
+/** A decoded Input report. */
+export declare interface HidReport {
+    reportId: number;
+
+    /** Values of the report's fields, at each field's `valueIndex` */
+    values: Int32Array;
+}
+
+/** Counters of a `HidPoll`. */
+export declare interface HidPollStats {
+    /** Reports decoded */
+    reports: number;
+
+    /** Reports dropped for an unknown report ID or for being shorter than their layout */
+    dropped: number;
+}
+
+/** A HID report descriptor compiled for decoding Input reports. See `Interface.getHidDecoder()`. */
+export declare class HidDecoder {
+    /** Throws if the descriptor is malformed. */
+    constructor(reportDescriptor: Buffer);
+
+    /** Layout of each Input report the descriptor defines. */
+    reports(): HidReportInfo[];
+
+    /** Decode one Input report, or return `undefined` if its report ID is unknown or it is too short. */
+    decode(report: Buffer): HidReport | undefined;
+}
+
+/** Polls an IN endpoint from the libusb event thread, decoding HID reports there. See `InEndpoint.startHidPoll()`. */
+export declare class HidPoll {
+    /**
+     * The callback receives the reports decoded since it last ran: their `values` back to back with the end offset of each report
+     * in `ends`, their report IDs, and the time the newest of them completed.
+     */
+    constructor(device: Device, endpointAddr: number, type: number, nTransfers: number, transferSize: number, decoder: HidDecoder,
+        callback: (error: LibUSBException | undefined, ended: boolean, values: Int32Array | undefined, ids: Uint8Array | undefined, ends: Uint32Array | undefined, completeTime: number) => void);
+
+    /** Submit the transfers. */
+    start(): void;
+
+    /** Cancel the transfers; the callback is called with `ended` set once they have all finished. */
+    stop(): void;
+
+    stats(): HidPollStats;
+}
+
+/** Options for `Endpoint.pump()`. */
+export declare interface PumpOptions {
+    /** Transfers kept in flight (default 4) */
+    nTransfers?: number;
+
+    /** Size of each transfer in bytes, rounded down to a multiple of the max packet size (default 16384) */
+    transferSize?: number;
+
+    /** Stop after this many bytes; `0` runs until the end of the file for OUT endpoints, or until `stop()` (default 0) */
+    length?: number;
+}
+
+/** Counters of an `FdPump`. */
+export declare interface PumpStats {
+    /** Bytes written to the file descriptor (IN) or to the endpoint (OUT) */
+    bytes: number;
+
+    /** Transfers completed */
+    transfers: number;
+
+    /** Transfers submitted and not yet completed */
+    inFlight: number;
+
+    /** Completed IN transfers waiting to be written to the file descriptor */
+    queued: number;
+
+    /** Most IN transfers waiting at once, a sign of a slow consumer */
+    maxQueued: number;
+
+    /** Milliseconds with no transfer in flight, a sign of a slow producer or consumer */
+    idleTime: number;
+}
+
+/** Moves data between an endpoint and a file descriptor on a native thread. See `Endpoint.pump()`. */
+export declare class FdPump {
+    /** `limit` is a byte count, or 0 for no limit. The callback is called once, when the pump has finished. */
+    constructor(device: Device, endpointAddr: number, type: number, fd: number, nTransfers: number, transferSize: number, limit: number,
+        callback: (error: LibUSBException | undefined, stats: PumpStats) => void);
+
+    /** Submit the transfers and start the pump thread. */
+    start(): void;
+
+    /** Cancel the transfers; the callback is called once the pump has finished. */
+    stop(): void;
+
+    stats(): PumpStats;
+}
+
+/** Counters of a `BotEngine`, see `MassStorage.stats()`. */
+export declare interface BotEngineStats {
+    /** Commands started, not counting the REQUEST SENSE run after a failed one */
+    commands: number;
+
+    /** Bytes moved in data phases */
+    bytes: number;
+
+    /** Reset recoveries (Bulk-Only Mass Storage Reset and clearing both halts) */
+    resets: number;
+
+    /** Endpoint halts cleared */
+    clearHalts: number;
+
+    /** Commands waiting or running */
+    queued: number;
+}
+
+/** Runs SCSI commands over the USB Mass Storage Bulk-Only Transport on the libusb event thread. See `MassStorage`. */
+export declare class BotEngine {
+    /** Data phases are split into transfers of at most `maxTransferSize` bytes, `depth` of them in flight. `timeout` applies to each transfer, 0 for none. */
+    constructor(device: Device, interfaceNumber: number, inEndpoint: number, outEndpoint: number, maxTransferSize: number, depth: number, timeout: number);
+
+    /**
+     * Queue a command. `data` is read into or written from directly, and must not be touched until the callback has run.
+     *
+     * The callback receives a transport error (after reset recovery), or the CSW `status` (0 passed, 1 failed, 2 phase error), the
+     * bytes of the data phase that were not transferred, and the sense data fetched with REQUEST SENSE after a failed command.
+     */
+    submit(lun: number, cdb: Buffer, dataIn: boolean, data: Buffer | undefined,
+        callback: (error: LibUSBException | undefined, status: number, residue: number, sense: Buffer | undefined) => void): void;
+
+    stats(): BotEngineStats;
 }
 
 /** Represents a USB device. */
@@ -84,6 +624,9 @@ export declare class Device extends ExtendedDevice {
     /** Integer USB device address */
     deviceAddress: number;
 
+    /** Negotiated connection speed, one of the `LIBUSB_SPEED_*` constants. */
+    speed: number;
+
     /** Array containing the USB device port numbers, or `undefined` if not supported on this platform. */
     portNumbers: number[];
 
@@ -92,20 +635,27 @@ export declare class Device extends ExtendedDevice {
 
     _bosDescriptor?: BosDescriptor;
 
-    __open(): void;
-    __close(): void;
+    __open(callback?: (error?: LibUSBException) => void): void;
+    __close(callback?: (error?: LibUSBException) => void): void;
     __getParent(): Device;
     __getConfigDescriptor(): ConfigDescriptor;
     __getAllConfigDescriptors(): ConfigDescriptor[];
     __setConfiguration(desired: number, callback: (error?: LibUSBException) => void): void;
     __clearHalt(addr: number, callback: (error?: LibUSBException) => void): void;
     __setInterface(addr: number, altSetting: number, callback: (error?: LibUSBException) => void): void;
-    __claimInterface(addr: number): void;
+    __claimInterface(addr: number, callback?: (error?: LibUSBException) => void): void;
     __releaseInterface(addr: number, callback: (error?: LibUSBException) => void): void;
-    __detachKernelDriver(addr: number): void;
+    __detachKernelDriver(addr: number, callback?: (error?: LibUSBException) => void): void;
     __attachKernelDriver(addr: number): void;
     __isKernelDriverActive(addr: number): boolean;
-    __setAutoDetachKernelDriver(enable: number): void;
+    __setAutoDetachKernelDriver(enable: number, callback?: (error?: LibUSBException) => void): void;
+    __openAndClaim(interfaces: number[], autoDetachKernelDriver: number, callback: (error?: LibUSBException) => void): void;
+    __setTransferBudget(maxTransfers: number, maxBytes: number, queue: boolean): void;
+    __getTransferBudget(): TransferBudgetUsage;
+    __setClassLimit(priority: number, maxTransfers: number): void;
+    __setEndpointLimit(endpointAddr: number, maxTransfers: number): void;
+    __getSchedulerStats(): { [priority in TransferPriority]: SchedulerClassStats };
+    __getMaxPacketSize(endpointAddr: number, iso: boolean): number;
 
     /**
     * Performs a reset of the device. Callback is called when complete.
@@ -287,6 +837,14 @@ export declare const LIBUSB_RECIPIENT_OTHER: number;
 export declare const LIBUSB_CONTROL_SETUP_SIZE: number;
 export declare const LIBUSB_DT_BOS_SIZE: number;
 
+// libusb_speed
+export declare const LIBUSB_SPEED_UNKNOWN: number;
+export declare const LIBUSB_SPEED_LOW: number;
+export declare const LIBUSB_SPEED_FULL: number;
+export declare const LIBUSB_SPEED_HIGH: number;
+export declare const LIBUSB_SPEED_SUPER: number;
+export declare const LIBUSB_SPEED_SUPER_PLUS: number;
+
 // libusb_capability
 export declare const LIBUSB_CAP_HAS_CAPABILITY: number;
 export declare const LIBUSB_CAP_HAS_HOTPLUG: number;
@@ -337,6 +895,13 @@ export declare interface DeviceEvents extends EventListeners<DeviceEvents> {
     detach: Device;
     attachIds: DeviceIds;
     detachIds: DeviceIds;
+    change: HotplugChange;
+}
+
+/** Devices attached and detached in one batch of hotplug events. */
+export declare interface HotplugChange {
+    attached: Device[];
+    detached: Device[];
 }
 
 export declare function addListener<K extends keyof DeviceEvents>(event: K, listener: (arg: DeviceEvents[K]) => void): void;
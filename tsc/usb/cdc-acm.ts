@@ -0,0 +1,393 @@
+import { platform } from 'os';
+import { Duplex } from 'stream';
+import * as usb from './index';
+import { LibUSBException, LIBUSB_ENDPOINT_IN, LIBUSB_ENDPOINT_OUT, LIBUSB_RECIPIENT_INTERFACE, LIBUSB_REQUEST_TYPE_CLASS } from './bindings';
+import { InEndpoint, OutEndpoint } from './endpoint';
+import { SplitTransferOptions } from './transfer-pool';
+import { Interface } from './interface';
+
+// Communications Class Subclass Specification for PSTN Devices, CDC 1.2
+const CDC_CLASS_COMM = 0x02;
+const CDC_CLASS_DATA = 0x0a;
+const CDC_SUBCLASS_ACM = 0x02;
+const CDC_CS_INTERFACE = 0x24;
+const CDC_UNION_TYPE = 0x06;
+
+const SET_LINE_CODING = 0x20;
+const GET_LINE_CODING = 0x21;
+const SET_CONTROL_LINE_STATE = 0x22;
+const SEND_BREAK = 0x23;
+
+const NOTIFY_RESPONSE_AVAILABLE = 0x01;
+const NOTIFY_SERIAL_STATE = 0x20;
+
+const REQUEST_OUT = LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE | LIBUSB_ENDPOINT_OUT;
+const REQUEST_IN = LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE | LIBUSB_ENDPOINT_IN;
+
+const PARITY = ['none', 'odd', 'even', 'mark', 'space'] as const;
+const STOP_BITS = [1, 1.5, 2] as const;
+
+/** Line coding of a CDC-ACM function, as set by SET_LINE_CODING. */
+export interface LineCoding {
+    /** Data terminal rate in bits per second. */
+    baudRate: number;
+    /** Data bits: 5, 6, 7, 8 or 16 (default 8). */
+    dataBits?: number;
+    /** Stop bits (default 1). */
+    stopBits?: 1 | 1.5 | 2;
+    /** Parity (default `'none'`). */
+    parity?: 'none' | 'odd' | 'even' | 'mark' | 'space';
+}
+
+/** Serial state reported by the device in a SERIAL_STATE notification. */
+export interface SerialState {
+    /** Carrier detect (DCD). */
+    dcd: boolean;
+    /** Data set ready (DSR). */
+    dsr: boolean;
+    /** A break was detected. */
+    break: boolean;
+    /** Ring signal detected. */
+    ring: boolean;
+    /** A framing error occurred. */
+    framingError: boolean;
+    /** A parity error occurred. */
+    parityError: boolean;
+    /** Received data has been discarded due to overrun in the device. */
+    overrun: boolean;
+}
+
+/** Options for `CdcAcm.open()`. */
+export interface CdcAcmOptions {
+    /** Number of the communications interface, if the device has more than one ACM function (default: the first one). */
+    interface?: number;
+    /** Line coding to set once the interfaces are claimed (default: leave it as it is). */
+    lineCoding?: LineCoding;
+    /** Assert DTR once the interfaces are claimed (default `true`). */
+    dtr?: boolean;
+    /** Assert RTS once the interfaces are claimed (default `true`). */
+    rts?: boolean;
+    /** Bulk IN transfers kept in flight (default 4). */
+    nTransfers?: number;
+    /** Size of each bulk IN transfer in bytes (default 16384). */
+    transferSize?: number;
+    /** Writes larger than this are split into concurrent transfers of this size (default 65536). */
+    writeChunkSize?: number;
+    /** Detach kernel drivers such as `cdc_acm` from both interfaces (default `true`). */
+    detachKernelDriver?: boolean;
+}
+
+const isAcm = (iface: Interface): boolean =>
+    iface.descriptor.bInterfaceClass === CDC_CLASS_COMM && iface.descriptor.bInterfaceSubClass === CDC_SUBCLASS_ACM;
+
+/**
+ * A CDC-ACM serial function of a device, as a duplex byte stream.
+ *
+ * Received data is read by a framed poll in `'stream'` mode (see `InEndpoint.startFramedPoll()`): several large bulk IN transfers
+ * are kept in flight and resubmitted from the libusb event thread, and everything received since the last event reaches JS as one
+ * chunk. Reading does not stop while the stream is paused, since the device cannot be asked to hold on to its data without losing
+ * the transfers in flight, so a consumer that stops reading should `close()` the port. Written chunks are sent as soon as they are
+ * written, large ones split into concurrent transfers, and `writev` batches are gathered into back-to-back transfers without copying.
+ *
+ * Events besides those of `Duplex`: `serialState(state)` when the device reports a change of its serial state, and
+ * `responseAvailable` when it has an encapsulated response ready.
+ */
+export class CdcAcm extends Duplex {
+    /** The communications interface. */
+    public readonly commInterface: Interface;
+    /** The data interface. */
+    public readonly dataInterface: Interface;
+    /** Last serial state reported by the device, or `undefined` before the first notification. */
+    public serialState: SerialState | undefined;
+
+    protected readonly bulkIn: InEndpoint;
+    protected readonly bulkOut: OutEndpoint;
+    protected readonly notify: InEndpoint | undefined;
+    protected controlLines = 0;
+    protected closing: Promise<void> | undefined;
+    protected readonly previousSplitTransfers: SplitTransferOptions | undefined;
+
+    private onFrames = (frames: Buffer[]) => this.frames(frames);
+    private onError = (error: LibUSBException) => this.destroy(error);
+    private onEnd = () => {
+        if (!this.closing) {
+            this.push(null);
+        }
+    };
+    private onNotification = (data: Buffer) => this.notification(data);
+    private onNotifyError = (error: LibUSBException) => {
+        if (error.errno !== usb.LIBUSB_TRANSFER_NO_DEVICE) {
+            this.emit('error', error);
+        }
+    };
+
+    /**
+     * Number of the data interface named by the union functional descriptor of a communications interface, or of the interface
+     * after it if there is no union descriptor.
+     * @param comm
+     */
+    public static dataInterfaceNumber(comm: Pick<Interface, 'descriptor' | 'interfaceNumber'>): number {
+        const extra = comm.descriptor.extra;
+        for (let pos = 0; pos + 2 < extra.length && extra[pos] > 0; pos += extra[pos]) {
+            if (extra[pos + 1] === CDC_CS_INTERFACE && extra[pos + 2] === CDC_UNION_TYPE && extra[pos] >= 5) {
+                return extra[pos + 4];
+            }
+        }
+        return comm.interfaceNumber + 1;
+    }
+
+    /**
+     * Encode a line coding as the 7 byte structure of SET_LINE_CODING.
+     * @param coding
+     */
+    public static encodeLineCoding(coding: LineCoding): Buffer {
+        const stopBits = STOP_BITS.indexOf(coding.stopBits ?? 1);
+        const parity = PARITY.indexOf(coding.parity ?? 'none');
+        const dataBits = coding.dataBits ?? 8;
+        if (stopBits < 0 || parity < 0 || [5, 6, 7, 8, 16].indexOf(dataBits) < 0) {
+            throw new TypeError('Invalid line coding');
+        }
+        const buffer = Buffer.alloc(7);
+        buffer.writeUInt32LE(coding.baudRate, 0);
+        buffer[4] = stopBits;
+        buffer[5] = parity;
+        buffer[6] = dataBits;
+        return buffer;
+    }
+
+    /**
+     * Decode the 7 byte structure returned by GET_LINE_CODING.
+     * @param buffer
+     */
+    public static decodeLineCoding(buffer: Buffer): LineCoding {
+        return {
+            baudRate: buffer.readUInt32LE(0),
+            stopBits: STOP_BITS[buffer[4]] ?? 1,
+            parity: PARITY[buffer[5]] ?? 'none',
+            dataBits: buffer[6]
+        };
+    }
+
+    /**
+     * Serial state carried by a SERIAL_STATE notification, or `undefined` if `data` is another notification or too short.
+     * @param data
+     */
+    public static parseSerialState(data: Buffer): SerialState | undefined {
+        if (data.length < 10 || data[1] !== NOTIFY_SERIAL_STATE) {
+            return undefined;
+        }
+        const bits = data.readUInt16LE(8);
+        return {
+            dcd: !!(bits & 0x01),
+            dsr: !!(bits & 0x02),
+            break: !!(bits & 0x04),
+            ring: !!(bits & 0x08),
+            framingError: !!(bits & 0x10),
+            parityError: !!(bits & 0x20),
+            overrun: !!(bits & 0x40)
+        };
+    }
+
+    /**
+     * Open `device` (if it is not already open), claim the interfaces of its CDC-ACM function and start reading.
+     * @param device
+     * @param options
+     */
+    public static async open(device: usb.Device, options: CdcAcmOptions = {}): Promise<CdcAcm> {
+        if (!device.interfaces) {
+            await device.openAsync();
+        }
+        const comm = (device.interfaces || []).find(iface => isAcm(iface) && (options.interface === undefined || iface.interfaceNumber === options.interface));
+        if (!comm) {
+            throw new Error('No CDC-ACM interface found');
+        }
+        const data = device.interface(CdcAcm.dataInterfaceNumber(comm));
+        if (!data || data.descriptor.bInterfaceClass !== CDC_CLASS_DATA) {
+            throw new Error('CDC data interface not found');
+        }
+
+        const claimed: Interface[] = [];
+        let port: CdcAcm;
+        try {
+            for (const iface of [comm, data]) {
+                if (options.detachKernelDriver !== false && platform() === 'linux' && iface.isKernelDriverActive()) {
+                    await iface.detachKernelDriverAsync();
+                }
+                await iface.claimAsync();
+                claimed.push(iface);
+            }
+            port = new CdcAcm(device, comm, data, options);
+        } catch (error) {
+            for (const iface of claimed) {
+                await iface.releaseAsync().catch(() => undefined);
+            }
+            throw error;
+        }
+
+        try {
+            if (options.lineCoding) {
+                await port.setLineCoding(options.lineCoding);
+            }
+            await port.setControlLines({ dtr: options.dtr ?? true, rts: options.rts ?? true });
+        } catch (error) {
+            await port.close().catch(() => undefined);
+            throw error;
+        }
+        port.startReading(options.nTransfers ?? 4, options.transferSize ?? 16384);
+        return port;
+    }
+
+    protected constructor(public readonly device: usb.Device, comm: Interface, data: Interface, options: CdcAcmOptions) {
+        super();
+        this.commInterface = comm;
+        this.dataInterface = data;
+
+        const bulkIn = data.endpoints.find(endpoint => endpoint instanceof InEndpoint && endpoint.transferType === usb.LIBUSB_TRANSFER_TYPE_BULK);
+        const bulkOut = data.endpoints.find(endpoint => endpoint instanceof OutEndpoint && endpoint.transferType === usb.LIBUSB_TRANSFER_TYPE_BULK);
+        if (!bulkIn || !bulkOut) {
+            throw new Error('CDC data interface has no bulk endpoints');
+        }
+        this.bulkIn = bulkIn as InEndpoint;
+        this.bulkOut = bulkOut as OutEndpoint;
+        this.previousSplitTransfers = this.bulkOut.splitTransfers;
+        this.bulkOut.splitTransfers = { chunkSize: options.writeChunkSize ?? 65536, concurrency: 4 };
+        this.notify = comm.endpoints.find(endpoint => endpoint instanceof InEndpoint && endpoint.transferType === usb.LIBUSB_TRANSFER_TYPE_INTERRUPT) as InEndpoint | undefined;
+    }
+
+    /**
+     * Set the baud rate, data bits, stop bits and parity.
+     * @param coding
+     */
+    public async setLineCoding(coding: LineCoding): Promise<void> {
+        await this.request(SET_LINE_CODING, 0, CdcAcm.encodeLineCoding(coding));
+    }
+
+    /** Read the current line coding from the device. */
+    public async getLineCoding(): Promise<LineCoding> {
+        const buffer = await this.request(GET_LINE_CODING, 0, 7) as Buffer;
+        if (buffer.length < 7) {
+            throw new Error('Short GET_LINE_CODING response');
+        }
+        return CdcAcm.decodeLineCoding(buffer);
+    }
+
+    /**
+     * Set the DTR and RTS control lines. Lines not given keep their state.
+     * @param lines
+     */
+    public setControlLines(lines: { dtr?: boolean, rts?: boolean }): Promise<void> {
+        let value = this.controlLines;
+        if (lines.dtr !== undefined) value = lines.dtr ? value | 0x01 : value & ~0x01;
+        if (lines.rts !== undefined) value = lines.rts ? value | 0x02 : value & ~0x02;
+        return this.request(SET_CONTROL_LINE_STATE, value).then(() => {
+            this.controlLines = value;
+        });
+    }
+
+    /**
+     * Send a break.
+     * @param duration Length of the break in milliseconds, or 0xFFFF to hold it until another call with 0 (default 250)
+     */
+    public sendBreak(duration = 250): Promise<void> {
+        return this.request(SEND_BREAK, duration & 0xffff).then(() => undefined);
+    }
+
+    /** Stop reading, deassert DTR and RTS and release the interfaces. The device stays open. */
+    public close(): Promise<void> {
+        if (!this.closing) {
+            this.closing = this.shutdown();
+            this.destroy();
+        }
+        return this.closing;
+    }
+
+    public _read(): void {
+        // Data is pushed as it arrives
+    }
+
+    public _write(chunk: Buffer, _encoding: BufferEncoding, callback: (error?: Error | null) => void): void {
+        this.bulkOut.transfer(chunk, error => callback(error));
+    }
+
+    public _writev(chunks: Array<{ chunk: Buffer }>, callback: (error?: Error | null) => void): void {
+        this.bulkOut.transferv(chunks.map(entry => entry.chunk), error => callback(error));
+    }
+
+    public _destroy(error: Error | null, callback: (error?: Error | null) => void): void {
+        if (!this.closing) {
+            this.closing = this.shutdown();
+        }
+        this.closing.then(() => callback(error), closeError => callback(error || closeError));
+    }
+
+    protected request(bRequest: number, wValue: number, dataOrLength: Buffer | number = Buffer.alloc(0)): Promise<Buffer | number | undefined> {
+        const bmRequestType = typeof dataOrLength === 'number' ? REQUEST_IN : REQUEST_OUT;
+        return new Promise((resolve, reject) => {
+            this.device.controlTransfer(bmRequestType, bRequest, wValue, this.commInterface.interfaceNumber, dataOrLength, (error, result) => {
+                if (error) {
+                    reject(error);
+                } else {
+                    resolve(result);
+                }
+            });
+        });
+    }
+
+    protected startReading(nTransfers: number, transferSize: number): void {
+        this.bulkIn.on('frames', this.onFrames);
+        this.bulkIn.on('error', this.onError);
+        this.bulkIn.on('end', this.onEnd);
+        this.bulkIn.startFramedPoll({ mode: 'stream' }, nTransfers, transferSize);
+
+        if (this.notify) {
+            this.notify.on('data', this.onNotification);
+            this.notify.on('error', this.onNotifyError);
+            this.notify.startPoll(2, Math.max(16, this.notify.descriptor.wMaxPacketSize));
+        }
+    }
+
+    protected frames(frames: Buffer[]): void {
+        if (frames.length === 0) {
+            return;
+        }
+        // Stream frames are back to back in one buffer: push them as a single chunk
+        const first = frames[0];
+        const last = frames[frames.length - 1];
+        this.push(Buffer.from(first.buffer, first.byteOffset, last.byteOffset + last.length - first.byteOffset));
+    }
+
+    // CDC notifications: an 8 byte header like a setup packet, followed by wLength bytes of data
+    protected notification(data: Buffer): void {
+        if (data.length < 8) {
+            return;
+        }
+        const state = CdcAcm.parseSerialState(data);
+        if (state) {
+            this.serialState = state;
+            this.emit('serialState', state);
+        } else if (data[1] === NOTIFY_RESPONSE_AVAILABLE) {
+            this.emit('responseAvailable');
+        }
+    }
+
+    protected async shutdown(): Promise<void> {
+        for (const endpoint of [this.bulkIn, this.notify]) {
+            if (endpoint && endpoint.pollActive) {
+                await new Promise<void>(resolve => endpoint.stopPoll(resolve));
+            }
+        }
+        this.bulkIn.removeListener('frames', this.onFrames);
+        this.bulkIn.removeListener('error', this.onError);
+        this.bulkIn.removeListener('end', this.onEnd);
+        if (this.notify) {
+            this.notify.removeListener('data', this.onNotification);
+            this.notify.removeListener('error', this.onNotifyError);
+        }
+        this.bulkOut.splitTransfers = this.previousSplitTransfers;
+        if (this.device.interfaces) {
+            await this.setControlLines({ dtr: false, rts: false }).catch(() => undefined);
+            await this.commInterface.releaseAsync().catch(() => undefined);
+            await this.dataInterface.releaseAsync().catch(() => undefined);
+        }
+    }
+}
@@ -144,6 +144,27 @@ export interface EndpointDescriptor {
      * If libusb encounters unknown endpoint descriptors, it will store them here, should you wish to parse them.
      */
     extra: Buffer;
+
+    /** SuperSpeed endpoint companion descriptor, present only for SuperSpeed endpoints. */
+    companion?: SsEndpointCompanionDescriptor;
+}
+
+/** A structure representing the SuperSpeed endpoint companion descriptor */
+export interface SsEndpointCompanionDescriptor {
+    /** Size of this descriptor (in bytes) */
+    bLength: number;
+
+    /** Descriptor type. */
+    bDescriptorType: number;
+
+    /** Number of packets, minus one, the endpoint can send or receive as part of a burst. */
+    bMaxBurst: number;
+
+    /** For bulk endpoints the maximum number of streams, for isochronous endpoints the Mult value. */
+    bmAttributes: number;
+
+    /** Total number of bytes a periodic endpoint transfers every service interval. */
+    wBytesPerInterval: number;
 }
 
 /** A generic representation of a BOS Device Capability descriptor */
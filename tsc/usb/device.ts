@@ -2,6 +2,7 @@ import * as usb from './bindings';
 import { Interface } from './interface';
 import { Capability } from './capability';
 import { BosDescriptor, ConfigDescriptor } from './descriptors';
+import { TransferPool, PRIORITIES } from './transfer-pool';
 
 const isBuffer = (obj: number | Uint8Array | undefined): obj is Uint8Array => !!obj && obj instanceof Uint8Array;
 const DEFAULT_TIMEOUT = 1000;
@@ -12,6 +13,9 @@ export class ExtendedDevice {
      */
     public interfaces: Interface[] | undefined;
 
+    // Created lazily as the native constructor doesn't run field initialisers
+    private _controlTransferPool: TransferPool | undefined;
+
     private _timeout = DEFAULT_TIMEOUT;
     /**
      * Timeout in milliseconds to use for control transfers.
@@ -23,6 +27,54 @@ export class ExtendedDevice {
         this._timeout = value;
     }
 
+    /**
+     * Limits on this device's transfers in flight, along with their current usage.
+     */
+    public get transferBudget(): usb.TransferBudgetUsage {
+        return (this as unknown as usb.Device).__getTransferBudget();
+    }
+
+    /**
+     * Limit the number of transfers and buffer bytes in flight on this device.
+     *
+     * Submits over budget either fail with `LIBUSB_ERROR_BUSY` or, when `queue` is set, wait until earlier transfers complete.
+     * The module-wide budget set with `usb.setTransferBudget()` applies as well.
+     * @param budget
+     */
+    public setTransferBudget(budget: Partial<usb.TransferBudget>): void {
+        const current = this.transferBudget;
+        (this as unknown as usb.Device).__setTransferBudget(budget.maxTransfers ?? current.maxTransfers, budget.maxBytes ?? current.maxBytes, budget.queue ?? current.queue);
+    }
+
+    /**
+     * Limit the transfers in flight on this device per priority class and per endpoint.
+     *
+     * Transfers that can't be submitted straight away wait in a queue per endpoint, and are submitted most urgent class first,
+     * taking the endpoints of a class in turn. Capping bulk or background transfers keeps a large download from holding up
+     * control and interrupt requests. Transfers over these limits always queue, whatever the transfer budget's `queue` setting.
+     * @param limits
+     */
+    public setSchedulerLimits(limits: Partial<usb.SchedulerLimits>): void {
+        const device = this as unknown as usb.Device;
+        PRIORITIES.forEach((priority, i) => {
+            const limit = limits[priority];
+            if (limit !== undefined) {
+                device.__setClassLimit(i, limit);
+            }
+        });
+        const endpoints = limits.endpoints || {};
+        for (const address of Object.keys(endpoints)) {
+            device.__setEndpointLimit(Number(address), endpoints[Number(address)]);
+        }
+    }
+
+    /**
+     * Limits, transfers in flight and queued transfers for each priority class of this device's submission scheduler.
+     */
+    public get schedulerStats(): { [priority in usb.TransferPriority]: usb.SchedulerClassStats } {
+        return (this as unknown as usb.Device).__getSchedulerStats();
+    }
+
     /**
      * Object with properties for the fields of the active configuration descriptor.
      */
@@ -74,16 +126,46 @@ export class ExtendedDevice {
      */
     public open(this: usb.Device, defaultConfig = true): void {
         this.__open();
+        this.refreshInterfaces(defaultConfig);
+    }
 
-        // The presence of interfaces is used to determine if the device is open
-        this.interfaces = [];
-        if (defaultConfig === false) {
-            return;
-        }
-        const len = this.configDescriptor ? this.configDescriptor.interfaces.length : 0;
-        for (let i = 0; i < len; i++) {
-            this.interfaces[i] = new Interface(this, i);
-        }
+    /**
+     * Open the device without blocking the event loop. `libusb_open` runs on the thread pool.
+     * @param defaultConfig
+     */
+    public openAsync(this: usb.Device, defaultConfig = true): Promise<void> {
+        return new Promise((resolve, reject) => {
+            this.__open(error => {
+                if (error) {
+                    return reject(error);
+                }
+                this.refreshInterfaces(defaultConfig);
+                resolve();
+            });
+        });
+    }
+
+    /**
+     * Open the device (if not already open) and claim the listed interface numbers as a single job on the thread pool.
+     *
+     * If any step fails, interfaces claimed by this call are released and the device is closed again if it was opened by this call.
+     * Calls for separate devices run in parallel, up to the size of the libuv thread pool (`UV_THREADPOOL_SIZE`).
+     * @param interfaces Interface numbers to claim
+     * @param autoDetachKernelDriver Optionally enable/disable automatic kernel driver detachment before claiming
+     */
+    public openAndClaimAsync(this: usb.Device, interfaces: number[] = [], autoDetachKernelDriver?: boolean): Promise<void> {
+        const autoDetach = autoDetachKernelDriver === undefined ? -1 : autoDetachKernelDriver ? 1 : 0;
+        return new Promise((resolve, reject) => {
+            this.__openAndClaim(interfaces, autoDetach, error => {
+                if (error) {
+                    return reject(error);
+                }
+                if (!this.interfaces) {
+                    this.refreshInterfaces(true);
+                }
+                resolve();
+            });
+        });
     }
 
     /**
@@ -96,6 +178,24 @@ export class ExtendedDevice {
         this.interfaces = undefined;
     }
 
+    /**
+     * Close the device without blocking the event loop. `libusb_close` runs on the thread pool.
+     *
+     * The device must be open to use this method.
+     */
+    public closeAsync(this: usb.Device): Promise<void> {
+        return new Promise((resolve, reject) => {
+            this.__close(error => {
+                if (error) {
+                    return reject(error);
+                }
+                resolve();
+            });
+            // The handle is detached synchronously, so the device is already closed from here on
+            this.interfaces = undefined;
+        });
+    }
+
     /**
      * Set the device configuration to something other than the default (0). To use this, first call `.open(false)` (which tells it not to auto configure),
      * then before claiming an interface, call this method.
@@ -107,11 +207,7 @@ export class ExtendedDevice {
     public setConfiguration(this: usb.Device, desired: number, callback?: (error: usb.LibUSBException | undefined) => void): void {
         this.__setConfiguration(desired, error => {
             if (!error) {
-                this.interfaces = [];
-                const len = this.configDescriptor ? this.configDescriptor.interfaces.length : 0;
-                for (let i = 0; i < len; i++) {
-                    this.interfaces[i] = new Interface(this, i);
-                }
+                this.refreshInterfaces(true);
             }
             if (callback) {
                 callback.call(this, error);
@@ -129,12 +225,36 @@ export class ExtendedDevice {
         return (this as unknown as usb.Device).__setAutoDetachKernelDriver(enable ? 1 : 0);
     }
 
+    /**
+     * Enable/disable libusb's automatic kernel driver detachment on the thread pool.
+     *
+     * The device must be open to use this method.
+     */
+    public setAutoDetachKernelDriverAsync(enable: boolean): Promise<void> {
+        return new Promise((resolve, reject) => {
+            (this as unknown as usb.Device).__setAutoDetachKernelDriver(enable ? 1 : 0, error => error ? reject(error) : resolve());
+        });
+    }
+
+    // The presence of interfaces is used to determine if the device is open
+    protected refreshInterfaces(this: usb.Device, defaultConfig: boolean): void {
+        this.interfaces = [];
+        if (defaultConfig === false) {
+            return;
+        }
+        const len = this.configDescriptor ? this.configDescriptor.interfaces.length : 0;
+        for (let i = 0; i < len; i++) {
+            this.interfaces[i] = new Interface(this, i);
+        }
+    }
+
     /**
      * Perform a control transfer with `libusb_control_transfer`.
      *
      * Parameter `data_or_length` can be an integer length for an IN transfer, or a `Buffer` for an OUT transfer. The type must match the direction specified in the MSB of bmRequestType.
      *
      * The `data` parameter of the callback is actual transferred for OUT transfers, or will be passed a Buffer for IN transfers.
+     * It is followed by the completion and submission times of the transfer, in milliseconds on the `process.hrtime()` clock.
      *
      * The device must be open to use this method.
      * @param bmRequestType
@@ -145,7 +265,7 @@ export class ExtendedDevice {
      * @param callback
      */
     public controlTransfer(this: usb.Device, bmRequestType: number, bRequest: number, wValue: number, wIndex: number, data_or_length: number | Buffer,
-        callback?: (error: usb.LibUSBException | undefined, buffer: Buffer | number | undefined) => void): usb.Device {
+        callback?: (error: usb.LibUSBException | undefined, buffer: Buffer | number | undefined, completeTime?: number, submitTime?: number) => void): usb.Device {
         const isIn = !!(bmRequestType & usb.LIBUSB_ENDPOINT_IN);
         const wLength = isIn ? data_or_length as number : (data_or_length as Buffer).length;
 
@@ -172,20 +292,20 @@ export class ExtendedDevice {
             buf.set(data_or_length as Buffer, usb.LIBUSB_CONTROL_SETUP_SIZE);
         }
 
-        const transfer = new usb.Transfer(this, 0, usb.LIBUSB_TRANSFER_TYPE_CONTROL, this.timeout,
-            (error, buf, actual) => {
+        if (!this._controlTransferPool) {
+            this._controlTransferPool = new TransferPool(this, 0, usb.LIBUSB_TRANSFER_TYPE_CONTROL);
+        }
+
+        try {
+            this._controlTransferPool.submit(this.timeout, buf, (error, buf, actual, completeTime, submitTime) => {
                 if (callback) {
                     if (isIn) {
-                        callback.call(this, error, buf.slice(usb.LIBUSB_CONTROL_SETUP_SIZE, usb.LIBUSB_CONTROL_SETUP_SIZE + actual));
+                        callback.call(this, error, buf.slice(usb.LIBUSB_CONTROL_SETUP_SIZE, usb.LIBUSB_CONTROL_SETUP_SIZE + actual), completeTime, submitTime);
                     } else {
-                        callback.call(this, error, actual);
+                        callback.call(this, error, actual, completeTime, submitTime);
                     }
                 }
-            }
-        );
-
-        try {
-            transfer.submit(buf);
+            });
         } catch (e) {
             if (callback) {
                 process.nextTick(() => callback.call(this, e as usb.LibUSBException, undefined));
@@ -194,6 +314,89 @@ export class ExtendedDevice {
         return this;
     }
 
+    /**
+     * Perform a sequence of control transfers back to back, e.g. a run of register writes and reads.
+     *
+     * The requests are packed into one buffer and run one after another by the libusb event thread, with a single callback
+     * once they have all finished, so a long sequence costs one round trip through the event loop instead of one per request.
+     * `results` has an entry for each request that ran, in order; IN data is a view of the shared result buffer.
+     *
+     * By default the first failed request ends the batch and its status is passed as `error`. With `continueOnError`, failed
+     * requests only show in their `status` and the rest still run. Each request uses the device's `timeout`.
+     *
+     * The device must be open to use this method.
+     * @param requests
+     * @param options
+     * @param callback
+     */
+    public controlTransferBatch(this: usb.Device, requests: usb.ControlRequest[], options: { continueOnError?: boolean },
+        callback: (error: usb.LibUSBException | undefined, results: usb.ControlResult[], completeTime?: number, submitTime?: number) => void): usb.Device {
+        if (requests.length === 0) {
+            process.nextTick(() => callback.call(this, undefined, []));
+            return this;
+        }
+
+        const wLengths = requests.map(request => {
+            if (request.bmRequestType & usb.LIBUSB_ENDPOINT_IN) {
+                if (typeof request.length !== 'number' || request.length < 0) {
+                    throw new TypeError('Expected length for IN request (based on bmRequestType)');
+                }
+                return request.length;
+            }
+            if (!isBuffer(request.data)) {
+                throw new TypeError('Expected data for OUT request (based on bmRequestType)');
+            }
+            return request.data.length;
+        });
+
+        // Each request is a result header, filled in natively, then the setup packet and data
+        const headerSize = 8;
+        const offsets: number[] = [];
+        let size = 0;
+        for (const wLength of wLengths) {
+            offsets.push(size);
+            size += headerSize + usb.LIBUSB_CONTROL_SETUP_SIZE + wLength;
+        }
+
+        const buf = Buffer.alloc(size);
+        requests.forEach((request, i) => {
+            const setup = offsets[i] + headerSize;
+            buf.writeUInt8(request.bmRequestType, setup);
+            buf.writeUInt8(request.bRequest, setup + 1);
+            buf.writeUInt16LE(request.wValue, setup + 2);
+            buf.writeUInt16LE(request.wIndex, setup + 4);
+            buf.writeUInt16LE(wLengths[i], setup + 6);
+            if (request.data && !(request.bmRequestType & usb.LIBUSB_ENDPOINT_IN)) {
+                buf.set(request.data, setup + usb.LIBUSB_CONTROL_SETUP_SIZE);
+            }
+        });
+
+        if (!this._controlTransferPool) {
+            this._controlTransferPool = new TransferPool(this, 0, usb.LIBUSB_TRANSFER_TYPE_CONTROL);
+        }
+
+        try {
+            this._controlTransferPool.submitControlBatch(this.timeout, buf, !options.continueOnError, (error, buf, count, completeTime, submitTime) => {
+                const results: usb.ControlResult[] = [];
+                for (let i = 0; i < count; i++) {
+                    const start = offsets[i];
+                    const status = buf.readInt32LE(start);
+                    const actualLength = buf.readInt32LE(start + 4);
+                    const result: usb.ControlResult = { status, actualLength };
+                    if (buf[start + headerSize] & usb.LIBUSB_ENDPOINT_IN) {
+                        const data = start + headerSize + usb.LIBUSB_CONTROL_SETUP_SIZE;
+                        result.data = buf.slice(data, data + actualLength);
+                    }
+                    results.push(result);
+                }
+                callback.call(this, error, results, completeTime, submitTime);
+            });
+        } catch (e) {
+            process.nextTick(() => callback.call(this, e as usb.LibUSBException, []));
+        }
+        return this;
+    }
+
     /**
      * Return the interface with the specified interface number.
      *
@@ -1,10 +1,31 @@
 import { EventEmitter } from 'events';
-import { LibUSBException, LIBUSB_TRANSFER_CANCELLED, Transfer, Device } from './bindings';
+import { LibUSBException, LIBUSB_TRANSFER_CANCELLED, LIBUSB_TRANSFER_TYPE_BULK, LIBUSB_TRANSFER_TYPE_ISOCHRONOUS, Transfer, Device, RecoveryPolicy, RecoveryStats, LatestPoll, LatestReport, FramedPoll, FramingOptions, FramingStats, FdPump, PumpOptions, PumpStats, TransferPriority, HidDecoder, HidPoll, HidReport, HidPollStats } from './bindings';
 import { EndpointDescriptor } from './descriptors';
+import { TransferPool, SplitTransferOptions, PRIORITIES } from './transfer-pool';
+import { PollTuner, AdaptivePollOptions, AdaptivePollStats } from './poll-tuner';
 import { promisify } from 'util';
 
 const isBuffer = (obj: ArrayBuffer | Buffer): obj is Buffer => obj && obj instanceof Buffer;
 
+// View (not copy) any buffer source as a Buffer
+const asBuffer = (obj: ArrayBuffer | ArrayBufferView): Buffer => {
+    if (obj instanceof Buffer) {
+        return obj;
+    }
+    if (ArrayBuffer.isView(obj)) {
+        return Buffer.from(obj.buffer, obj.byteOffset, obj.byteLength);
+    }
+    return Buffer.from(obj);
+};
+
+const addRecoveryStats = (total: RecoveryStats, stats: RecoveryStats): void => {
+    total.stalls += stats.stalls;
+    total.timeouts += stats.timeouts;
+    total.errors += stats.errors;
+    total.retries += stats.retries;
+    total.exhausted += stats.exhausted;
+};
+
 /** Common base for InEndpoint and OutEndpoint. */
 export abstract class Endpoint extends EventEmitter {
     public address: number;
@@ -21,11 +42,51 @@ export abstract class Endpoint extends EventEmitter {
     /** Object with fields from the endpoint descriptor -- see libusb documentation or USB spec. */
     public descriptor: EndpointDescriptor;
 
+    /** Pool of reusable transfers backing `transfer()` on this endpoint. */
+    public transferPool: TransferPool;
+
+    /**
+     * When set, `transfer()` calls larger than `chunkSize` are split into chunks with `concurrency` of them in flight at once,
+     * refilled from the libusb event thread. This keeps very large reads and writes under per-request OS limits and avoids gaps
+     * between requests. The default, `undefined`, submits each transfer as a single request.
+     */
+    public splitTransfers: SplitTransferOptions | undefined;
+
     constructor(protected device: Device, descriptor: EndpointDescriptor) {
         super();
         this.descriptor = descriptor;
         this.address = descriptor.bEndpointAddress;
         this.transferType = descriptor.bmAttributes & 0x03;
+        this.transferPool = new TransferPool(device, this.address, this.transferType);
+    }
+
+    /**
+     * Scheduler priority class for transfers on this endpoint, e.g. `'background'` for a bulk download that should give way to
+     * other bulk traffic. The default, `undefined`, uses the class of the endpoint's transfer type. Applies to transfers and polls
+     * started afterwards. See `Device.setSchedulerLimits()`.
+     */
+    public get priority(): TransferPriority | undefined {
+        return this.transferPool.priority;
+    }
+    public set priority(value: TransferPriority | undefined) {
+        this.transferPool.priority = value;
+    }
+
+    /**
+     * Maximum packet size of this endpoint in the active configuration, as reported by libusb. For isochronous endpoints this is the
+     * number of bytes per service interval, including additional transactions per microframe and SuperSpeed bursts.
+     */
+    public get maxPacketSize(): number {
+        return this.device.__getMaxPacketSize(this.address, this.transferType === LIBUSB_TRANSFER_TYPE_ISOCHRONOUS);
+    }
+
+    /**
+     * Bytes the endpoint can move in one burst: `wMaxPacketSize` times the number of packets per burst from the SuperSpeed endpoint
+     * companion descriptor, or `wMaxPacketSize` for endpoints without one.
+     */
+    public get burstSize(): number {
+        const maxPacketSize = (this.descriptor.wMaxPacketSize & 0x7ff) || 1;
+        return maxPacketSize * ((this.descriptor.companion?.bMaxBurst ?? 0) + 1);
     }
 
     /** Clear the halt/stall condition for this endpoint. */
@@ -33,17 +94,64 @@ export abstract class Endpoint extends EventEmitter {
         return this.device.__clearHalt(this.address, callback);
     }
 
+    // Chunk options for a transfer of `length` bytes, or undefined to submit it whole
+    protected splitOptions(length: number): SplitTransferOptions | undefined {
+        if (!this.splitTransfers) {
+            return undefined;
+        }
+        const maxPacketSize = (this.descriptor.wMaxPacketSize & 0x7ff) || 1;
+        const chunkSize = Math.max(maxPacketSize, this.splitTransfers.chunkSize - (this.splitTransfers.chunkSize % maxPacketSize));
+        if (length <= chunkSize) {
+            return undefined;
+        }
+        return { chunkSize, concurrency: Math.max(1, this.splitTransfers.concurrency) };
+    }
+
     /**
      * Create a new `Transfer` object for this endpoint.
      *
-     * The passed callback will be called when the transfer is submitted and finishes. Its arguments are the error (if any), the submitted buffer, and the amount of data actually written (for
-     * OUT transfers) or read (for IN transfers).
+     * The passed callback will be called when the transfer is submitted and finishes. Its arguments are the error (if any), the submitted buffer, the amount of data actually written (for
+     * OUT transfers) or read (for IN transfers), and the completion and submission times taken on the libusb event thread (see `Transfer`).
      *
      * @param timeout Timeout for the transfer (0 means unlimited).
      * @param callback Transfer completion callback.
      */
-    public makeTransfer(timeout: number, callback: (error: LibUSBException | undefined, buffer: Buffer, actualLength: number) => void): Transfer {
-        return new Transfer(this.device, this.address, this.transferType, timeout, callback);
+    public makeTransfer(timeout: number, callback: (error: LibUSBException | undefined, buffer: Buffer, actualLength: number, completeTime: number, submitTime: number) => void): Transfer {
+        const transfer = new Transfer(this.device, this.address, this.transferType, timeout, callback);
+        if (this.priority !== undefined) {
+            transfer.setPriority(PRIORITIES.indexOf(this.priority));
+        }
+        return transfer;
+    }
+
+    /**
+     * Stream between this endpoint and a file descriptor (a file, pipe or socket) without passing the data through JavaScript.
+     *
+     * Transfers run on the libusb event thread and a native thread reads or writes the file descriptor. For IN endpoints, data is
+     * written to `fd` in order and each transfer is only resubmitted once its data has been written, so a slow consumer holds back
+     * the endpoint rather than filling memory. For OUT endpoints, `fd` is read until the end of the file.
+     *
+     * Except on Windows, `fd` is put in non-blocking mode while pumping and restored afterwards. `stop()` on the returned pump cancels the transfers and
+     * wakes the native thread, also while it waits to read or write `fd`; IN data not yet written when `fd` is not writable is dropped.
+     * The callback is called once the pump has finished, with its final counters. The file descriptor is not closed.
+     *
+     * @param fd File descriptor, e.g. from `fs.openSync()`
+     * @param options
+     * @param callback
+     */
+    public pump(fd: number, options: PumpOptions = {}, callback?: (error: LibUSBException | undefined, stats: PumpStats) => void): FdPump {
+        const maxPacketSize = (this.descriptor.wMaxPacketSize & 0x7ff) || 1;
+        const transferSize = options.transferSize ?? 16384;
+        const size = Math.max(maxPacketSize, transferSize - (transferSize % maxPacketSize));
+        const pump = new FdPump(this.device, this.address, this.transferType, fd, options.nTransfers ?? 4, size, options.length ?? 0, (error, stats) => {
+            if (callback) {
+                callback.call(this, error, stats);
+            } else if (error) {
+                this.emit('error', error);
+            }
+        });
+        pump.start();
+        return pump;
     }
 }
 
@@ -56,8 +164,30 @@ export class InEndpoint extends Endpoint {
     protected pollTransfers: Transfer[] = [];
     protected pollTransferSize = 0;
     protected pollPending = 0;
+    protected pollTuner: PollTuner | undefined;
     public pollActive = false;
 
+    /**
+     * Recovery policy for polling transfers. When set, STALLs, timeouts and transfer errors are retried on the libusb event thread
+     * (clearing a STALL first) instead of emitting `error` and stopping the poll, which only happens once `maxRetries` consecutive
+     * retries have failed. Applies from the next `startPoll()`.
+     */
+    public recovery: RecoveryPolicy | undefined;
+
+    protected latestPoll: LatestPoll | undefined;
+    protected latestTimer: ReturnType<typeof setTimeout> | undefined;
+    protected framedPoll: FramedPoll | undefined;
+    protected hidPoll: HidPoll | undefined;
+
+    protected recoveryTotals: RecoveryStats = { stalls: 0, timeouts: 0, errors: 0, retries: 0, exhausted: 0 };
+
+    /** Recovery counters for polling on this endpoint, over all polls so far. */
+    public get recoveryStats(): RecoveryStats {
+        const stats = { ...this.recoveryTotals };
+        this.pollTransfers.forEach(transfer => addRecoveryStats(stats, transfer.getRecoveryStats()));
+        return stats;
+    }
+
     public transferAsync: (length: number) => Promise<Buffer | undefined>;
 
     constructor(device: Device, descriptor: EndpointDescriptor) {
@@ -69,22 +199,24 @@ export class InEndpoint extends Endpoint {
      * Perform a transfer to read data from the endpoint.
      *
      * If length is greater than maxPacketSize, libusb will automatically split the transfer in multiple packets, and you will receive one callback with all data once all packets are complete.
+     * Set `splitTransfers` to also split very large transfers into several concurrent requests.
      *
-     * `this` in the callback is the InEndpoint object.
+     * `this` in the callback is the InEndpoint object. The callback also receives the completion and submission times, in milliseconds
+     * on the `process.hrtime()` clock, taken on the libusb event thread.
      *
      * The device must be open to use this method.
      * @param length
      * @param callback
      */
-    public transfer(length: number, callback: (error: LibUSBException | undefined, data?: Buffer) => void): InEndpoint {
+    public transfer(length: number, callback: (error: LibUSBException | undefined, data?: Buffer, completeTime?: number, submitTime?: number) => void): InEndpoint {
         const buffer = Buffer.alloc(length);
 
-        const cb = (error: LibUSBException | undefined, _buffer?: Buffer, actualLength?: number) => {
-            callback.call(this, error, buffer.slice(0, actualLength));
+        const cb = (error: LibUSBException | undefined, _buffer?: Buffer, actualLength?: number, completeTime?: number, submitTime?: number) => {
+            callback.call(this, error, buffer.slice(0, actualLength), completeTime, submitTime);
         };
 
         try {
-            this.makeTransfer(this.timeout, cb).submit(buffer);
+            this.transferPool.submit(this.timeout, buffer, cb, this.splitOptions(buffer.length));
         } catch (e) {
             process.nextTick(() => callback.call(this, e as LibUSBException));
         }
@@ -103,9 +235,12 @@ export class InEndpoint extends Endpoint {
      * @param callback
      */
     public startPoll(nTransfers?: number, transferSize?: number, callback?: (error: LibUSBException | undefined, buffer: Buffer, actualLength: number, cancelled: boolean) => void): Transfer[] {
-        const transferDone = (error: LibUSBException | undefined, transfer: Transfer, buffer: Buffer, actualLength: number) => {
+        const transferDone = (error: LibUSBException | undefined, transfer: Transfer, buffer: Buffer, actualLength: number, completeTime: number, submitTime: number) => {
             if (!error) {
-                this.emit('data', buffer.slice(0, actualLength));
+                if (this.pollTuner && this.pollTuner.record(buffer.length, actualLength, completeTime, submitTime)) {
+                    this.pollTransferSize = this.pollTuner.transferSize;
+                }
+                this.emit('data', buffer.slice(0, actualLength), completeTime);
             } else if (error.errno !== LIBUSB_TRANSFER_CANCELLED) {
                 if (this.pollActive) {
                     this.emit('error', error);
@@ -114,11 +249,22 @@ export class InEndpoint extends Endpoint {
             }
 
             if (this.pollActive) {
-                startTransfer(transfer);
+                if (this.pollTuner && this.pollTransfers.length > this.pollTuner.nTransfers) {
+                    retireTransfer(transfer);
+                } else {
+                    startTransfer(transfer);
+                }
+                while (this.pollActive && this.pollTuner && this.pollTransfers.length < this.pollTuner.nTransfers) {
+                    const added = this.makePollTransfer(pollCallback);
+                    this.pollTransfers.push(added);
+                    this.pollPending++;
+                    startTransfer(added);
+                }
             } else {
                 this.pollPending--;
 
                 if (this.pollPending === 0) {
+                    this.pollTransfers.forEach(item => addRecoveryStats(this.recoveryTotals, item.getRecoveryStats()));
                     this.pollTransfers = [];
                     this.pollActive = false;
                     this.emit('end');
@@ -132,8 +278,8 @@ export class InEndpoint extends Endpoint {
 
         const startTransfer = (transfer: Transfer) => {
             try {
-                transfer.submit(Buffer.alloc(this.pollTransferSize), (error, buffer, actualLength) => {
-                    transferDone(error, transfer, buffer, actualLength);
+                transfer.submit(Buffer.alloc(this.pollTransferSize), (error, buffer, actualLength, completeTime, submitTime) => {
+                    transferDone(error, transfer, buffer, actualLength, completeTime, submitTime);
                 });
             } catch (e) {
                 this.emit('error', e);
@@ -141,15 +287,25 @@ export class InEndpoint extends Endpoint {
             }
         };
 
-        this.pollTransfers = this.startPollTransfers(nTransfers, transferSize, function (this: Transfer, error, buffer, actualLength) {
-            transferDone(error, this, buffer, actualLength);
-        });
+        // A transfer no longer needed after the queue depth was lowered
+        const retireTransfer = (transfer: Transfer) => {
+            addRecoveryStats(this.recoveryTotals, transfer.getRecoveryStats());
+            this.pollTransfers = this.pollTransfers.filter(item => item !== transfer);
+            this.pollPending--;
+        };
+
+        const pollCallback = function (this: Transfer, error: LibUSBException | undefined, buffer: Buffer, actualLength: number, completeTime: number, submitTime: number) {
+            transferDone(error, this, buffer, actualLength, completeTime, submitTime);
+        };
+
+        this.pollTransfers = this.startPollTransfers(nTransfers, transferSize, pollCallback);
+        this.pollTuner = undefined;
         this.pollTransfers.forEach(startTransfer);
         this.pollPending = this.pollTransfers.length;
         return this.pollTransfers;
     }
 
-    protected startPollTransfers(nTransfers = 3, transferSize = this.descriptor.wMaxPacketSize, callback: (error: LibUSBException | undefined, buffer: Buffer, actualLength: number) => void): Transfer[] {
+    protected startPollTransfers(nTransfers = 3, transferSize = this.descriptor.wMaxPacketSize, callback: (error: LibUSBException | undefined, buffer: Buffer, actualLength: number, completeTime: number, submitTime: number) => void): Transfer[] {
         if (this.pollActive) {
             throw new Error('Polling already active');
         }
@@ -160,12 +316,208 @@ export class InEndpoint extends Endpoint {
 
         const transfers: Transfer[] = [];
         for (let i = 0; i < nTransfers; i++) {
-            const transfer = this.makeTransfer(0, callback);
-            transfers[i] = transfer;
+            transfers[i] = this.makePollTransfer(callback);
+        }
+        return transfers;
+    }
+
+    protected makePollTransfer(callback: (error: LibUSBException | undefined, buffer: Buffer, actualLength: number, completeTime: number, submitTime: number) => void): Transfer {
+        const transfer = this.makeTransfer(0, callback);
+        if (this.recovery) {
+            transfer.setRecovery(this.recovery.maxRetries, this.recovery.retryDelay ?? 0, this.recovery.backoff ?? 2, this.recovery.retryTimeouts ?? true);
+        }
+        return transfer;
+    }
+
+    /**
+     * Start polling the endpoint with a transfer size and queue depth chosen by the library.
+     *
+     * Polling starts from settings suited to the device speed and the endpoint's burst size, e.g. 8 transfers of 4 bursts at
+     * SuperSpeed, and is then tuned every `interval` milliseconds from the measured throughput and completion latency: transfers grow
+     * while the device streams full transfers faster than `targetLatency`, more are queued when completions show the queue running
+     * dry, and both shrink again when the device only sends short messages. Events are the same as for `startPoll()`; the current
+     * settings are in `adaptivePollStats`.
+     *
+     * The device must be open to use this method.
+     * @param options
+     * @param callback
+     */
+    public startAdaptivePoll(options: AdaptivePollOptions = {}, callback?: (error: LibUSBException | undefined, buffer: Buffer, actualLength: number, cancelled: boolean) => void): Transfer[] {
+        if (this.pollActive) {
+            throw new Error('Polling already active');
         }
+        const tuner = new PollTuner(this.burstSize, this.device.speed, this.transferType === LIBUSB_TRANSFER_TYPE_BULK, options);
+        const transfers = this.startPoll(tuner.nTransfers, tuner.transferSize, callback);
+        this.pollTuner = tuner;
         return transfers;
     }
 
+    /** Current settings and last measurements of polling started by `startAdaptivePoll()`, or `undefined` if it is not active. */
+    public get adaptivePollStats(): AdaptivePollStats | undefined {
+        return this.pollActive ? this.pollTuner?.stats() : undefined;
+    }
+
+    /**
+     * Start polling the endpoint, keeping only the newest report.
+     *
+     * `nTransfers` transfers are kept pending and resubmitted from the libusb event thread, which overwrites a single "latest report"
+     * slot rather than handing each report to JS. Read the slot at any time with `readLatest()`; in addition the `data` event is emitted
+     * with the newest report at most once every `interval` milliseconds (or after each report if `0`), and only when a new one has
+     * arrived. This suits high-rate interrupt endpoints where only the current state matters.
+     *
+     * Stop with `stopPoll()`. The device must be open to use this method.
+     * @param nTransfers
+     * @param transferSize
+     * @param interval Minimum time in milliseconds between `data` events
+     */
+    public startLatestPoll(nTransfers = 3, transferSize = this.descriptor.wMaxPacketSize, interval = 0): void {
+        if (this.pollActive) {
+            throw new Error('Polling already active');
+        }
+
+        const poll = new LatestPoll(this.device, this.address, this.transferType, nTransfers, transferSize, (error, ended) => {
+            if (ended) {
+                if (this.latestTimer) {
+                    clearTimeout(this.latestTimer);
+                    this.latestTimer = undefined;
+                }
+                this.latestPoll = undefined;
+                this.pollActive = false;
+                if (error && error.errno !== LIBUSB_TRANSFER_CANCELLED) {
+                    this.emit('error', error);
+                }
+                this.emit('end');
+                return;
+            }
+
+            const latest = poll.read();
+            if (latest.data) {
+                this.emit('data', latest.data, latest.completeTime);
+            }
+            if (this.latestPoll !== poll) {
+                return;
+            }
+            if (interval > 0) {
+                this.latestTimer = setTimeout(() => {
+                    this.latestTimer = undefined;
+                    poll.arm();
+                }, interval);
+            } else {
+                poll.arm();
+            }
+        });
+
+        poll.start();
+        this.latestPoll = poll;
+        this.pollActive = true;
+        poll.arm();
+    }
+
+    /**
+     * Return the newest report received by `startLatestPoll()`, with counts of reports received and dropped (overwritten unread),
+     * or `undefined` if that kind of polling is not active.
+     */
+    public readLatest(): LatestReport | undefined {
+        return this.latestPoll?.read();
+    }
+
+    /**
+     * Start polling the endpoint, splitting the data into frames on the libusb event thread.
+     *
+     * `nTransfers` transfers are kept pending and resubmitted from the libusb event thread, which runs the received bytes through the
+     * framer described by `framing` and holds on to any partial frame. Only complete frames (that pass the CRC check, if any) reach JS:
+     * the `frames` event is emitted with an array of the frames completed since the last one, and the time the newest of them completed.
+     * The frames are views into one buffer per event.
+     *
+     * Stop with `stopPoll()`. The device must be open to use this method.
+     * @param framing
+     * @param nTransfers
+     * @param transferSize
+     */
+    public startFramedPoll(framing: FramingOptions, nTransfers = 3, transferSize = this.descriptor.wMaxPacketSize): void {
+        if (this.pollActive) {
+            throw new Error('Polling already active');
+        }
+
+        const options = typeof framing.delimiter === 'string' ? { ...framing, delimiter: Buffer.from(framing.delimiter) } : framing;
+        const poll = new FramedPoll(this.device, this.address, this.transferType, nTransfers, transferSize, options, (error, ended, data, ends, completeTime) => {
+            if (data && ends) {
+                const frames = new Array<Buffer>(ends.length);
+                let start = 0;
+                for (let i = 0; i < ends.length; i++) {
+                    frames[i] = data.subarray(start, ends[i]);
+                    start = ends[i];
+                }
+                this.emit('frames', frames, completeTime);
+            }
+            if (ended) {
+                this.framedPoll = undefined;
+                this.pollActive = false;
+                if (error && error.errno !== LIBUSB_TRANSFER_CANCELLED) {
+                    this.emit('error', error);
+                }
+                this.emit('end');
+            }
+        });
+
+        poll.start();
+        this.framedPoll = poll;
+        this.pollActive = true;
+    }
+
+    /** Counters for polling started by `startFramedPoll()`, or `undefined` if that kind of polling is not active. */
+    public get framingStats(): FramingStats | undefined {
+        return this.framedPoll?.stats();
+    }
+
+    /**
+     * Start polling the endpoint, decoding HID Input reports on the libusb event thread.
+     *
+     * `nTransfers` transfers are kept pending and resubmitted from the libusb event thread, which extracts the values of each report
+     * with `decoder` (see `Interface.getHidDecoder()`). Only the values reach JS: the `reports` event is emitted with an array of the
+     * reports decoded since the last one, each with its report ID and an `Int32Array` of values laid out as described by
+     * `decoder.reports()`, and the time the newest of them completed. The value arrays are views into one buffer per event.
+     *
+     * Stop with `stopPoll()`. The device must be open to use this method.
+     * @param decoder
+     * @param nTransfers
+     * @param transferSize
+     */
+    public startHidPoll(decoder: HidDecoder, nTransfers = 3, transferSize = this.descriptor.wMaxPacketSize): void {
+        if (this.pollActive) {
+            throw new Error('Polling already active');
+        }
+
+        const poll = new HidPoll(this.device, this.address, this.transferType, nTransfers, transferSize, decoder, (error, ended, values, ids, ends, completeTime) => {
+            if (values && ids && ends) {
+                const reports = new Array<HidReport>(ends.length);
+                let start = 0;
+                for (let i = 0; i < ends.length; i++) {
+                    reports[i] = { reportId: ids[i], values: values.subarray(start, ends[i]) };
+                    start = ends[i];
+                }
+                this.emit('reports', reports, completeTime);
+            }
+            if (ended) {
+                this.hidPoll = undefined;
+                this.pollActive = false;
+                if (error && error.errno !== LIBUSB_TRANSFER_CANCELLED) {
+                    this.emit('error', error);
+                }
+                this.emit('end');
+            }
+        });
+
+        poll.start();
+        this.hidPoll = poll;
+        this.pollActive = true;
+    }
+
+    /** Counters for polling started by `startHidPoll()`, or `undefined` if that kind of polling is not active. */
+    public get hidStats(): HidPollStats | undefined {
+        return this.hidPoll?.stats();
+    }
+
     /**
      * Stop polling.
      *
@@ -178,6 +530,19 @@ export class InEndpoint extends Endpoint {
         if (!this.pollActive) {
             throw new Error('Polling is not active.');
         }
+        if (this.latestPoll) {
+            if (this.latestTimer) {
+                clearTimeout(this.latestTimer);
+                this.latestTimer = undefined;
+            }
+            this.latestPoll.stop();
+        }
+        if (this.framedPoll) {
+            this.framedPoll.stop();
+        }
+        if (this.hidPoll) {
+            this.hidPoll.stop();
+        }
         for (let i = 0; i < this.pollTransfers.length; i++) {
             try {
                 this.pollTransfers[i].cancel();
@@ -197,16 +562,19 @@ export class OutEndpoint extends Endpoint {
     public direction: 'in' | 'out' = 'out';
 
     public transferAsync: (buffer: Buffer) => Promise<number>;
+    public transfervAsync: (buffers: Array<Buffer | ArrayBuffer | ArrayBufferView>) => Promise<number>;
 
     public constructor(device: Device, descriptor: EndpointDescriptor) {
         super(device, descriptor);
         this.transferAsync = promisify(this.transfer).bind(this);
+        this.transfervAsync = promisify(this.transferv).bind(this);
     }
 
     /**
      * Perform a transfer to write `data` to the endpoint.
      *
      * If length is greater than maxPacketSize, libusb will automatically split the transfer in multiple packets, and you will receive one callback once all packets are complete.
+     * Set `splitTransfers` to also split very large transfers into several concurrent requests.
      *
      * `this` in the callback is the OutEndpoint object.
      *
@@ -214,21 +582,21 @@ export class OutEndpoint extends Endpoint {
      * @param buffer
      * @param callback
      */
-    public transfer(buffer: Buffer, callback?: (error: LibUSBException | undefined, actual: number) => void): OutEndpoint {
+    public transfer(buffer: Buffer, callback?: (error: LibUSBException | undefined, actual: number, completeTime?: number, submitTime?: number) => void): OutEndpoint {
         if (!buffer) {
             buffer = Buffer.alloc(0);
         } else if (!isBuffer(buffer)) {
             buffer = Buffer.from(buffer);
         }
 
-        const cb = (error: LibUSBException | undefined, _buffer?: Buffer, actual?: number) => {
+        const cb = (error: LibUSBException | undefined, _buffer?: Buffer, actual?: number, completeTime?: number, submitTime?: number) => {
             if (callback) {
-                callback.call(this, error, actual || 0);
+                callback.call(this, error, actual || 0, completeTime, submitTime);
             }
         };
 
         try {
-            this.makeTransfer(this.timeout, cb).submit(buffer);
+            this.transferPool.submit(this.timeout, buffer, cb, this.splitOptions(buffer.length));
         } catch (e) {
             process.nextTick(() => cb(e as LibUSBException));
         }
@@ -236,6 +604,138 @@ export class OutEndpoint extends Endpoint {
         return this;
     }
 
+    /**
+     * Perform a gather write of several buffers to the endpoint as one logical transfer, without concatenating them first.
+     *
+     * The data is split at `wMaxPacketSize` boundaries into back-to-back transfers that reference the caller's buffers directly,
+     * so the bytes on the bus are the same as for a single transfer of the concatenated data. Only where a buffer boundary falls
+     * inside a packet is that one packet staged in a small copy.
+     *
+     * The callback receives the total bytes written and, for each input buffer, how many of its bytes were written. On error
+     * or a short write, transfers not yet completed are cancelled.
+     *
+     * `this` in the callback is the OutEndpoint object.
+     *
+     * The device must be open to use this method.
+     * @param buffers
+     * @param callback
+     */
+    public transferv(buffers: Array<Buffer | ArrayBuffer | ArrayBufferView>, callback?: (error: LibUSBException | undefined, actual: number, segmentBytes: number[]) => void): OutEndpoint {
+        const segments = buffers.map(asBuffer);
+        const chunks = this.packetAlignedChunks(segments);
+
+        const transfers: Transfer[] = [];
+        const actuals: number[] = new Array(chunks.length).fill(0);
+        const completed: boolean[] = new Array(chunks.length).fill(false);
+        let firstError: LibUSBException | undefined;
+        let pending = 0;
+        let stopped = false;
+
+        const stop = () => {
+            if (stopped) return;
+            stopped = true;
+            // Completed transfers are back in the pool and may already be in use elsewhere
+            transfers.forEach((transfer, index) => {
+                if (completed[index]) return;
+                try {
+                    transfer.cancel();
+                } catch {
+                    // Already completed
+                }
+            });
+        };
+
+        const finish = () => {
+            // Only bytes up to the first short or failed chunk are known to have reached the device in order
+            let written = 0;
+            for (let i = 0; i < chunks.length; i++) {
+                written += actuals[i];
+                if (actuals[i] < chunks[i].length) break;
+            }
+
+            const segmentBytes: number[] = [];
+            let offset = 0;
+            for (const segment of segments) {
+                segmentBytes.push(Math.max(0, Math.min(segment.length, written - offset)));
+                offset += segment.length;
+            }
+
+            if (callback) {
+                callback.call(this, firstError, written, segmentBytes);
+            }
+        };
+
+        chunks.forEach((chunk, index) => {
+            if (stopped) return;
+            try {
+                transfers.push(this.transferPool.submit(this.timeout, chunk, (error, _buffer, actual) => {
+                    actuals[index] = actual;
+                    completed[index] = true;
+                    if (error && error.errno !== LIBUSB_TRANSFER_CANCELLED && !firstError) {
+                        firstError = error;
+                    }
+                    if (error || actual < chunk.length) {
+                        stop();
+                    }
+                    if (--pending === 0) {
+                        finish();
+                    }
+                }));
+                pending++;
+            } catch (e) {
+                firstError = firstError || e as LibUSBException;
+                stop();
+            }
+        });
+
+        if (pending === 0) {
+            process.nextTick(finish);
+        }
+
+        return this;
+    }
+
+    // Split segments into transfers that each end on a packet boundary (except the last),
+    // staging only the packets which straddle two segments.
+    protected packetAlignedChunks(segments: Buffer[]): Buffer[] {
+        const maxPacketSize = (this.descriptor.wMaxPacketSize & 0x7ff) || 1;
+        const chunks: Buffer[] = [];
+        let partial: Buffer[] = [];
+        let partialLength = 0;
+
+        for (let segment of segments) {
+            if (partialLength > 0) {
+                const take = Math.min(maxPacketSize - partialLength, segment.length);
+                partial.push(segment.subarray(0, take));
+                partialLength += take;
+                segment = segment.subarray(take);
+                if (partialLength < maxPacketSize) {
+                    continue;
+                }
+                chunks.push(Buffer.concat(partial, partialLength));
+                partial = [];
+                partialLength = 0;
+            }
+
+            const aligned = segment.length - (segment.length % maxPacketSize);
+            if (aligned > 0) {
+                chunks.push(segment.subarray(0, aligned));
+            }
+            if (aligned < segment.length) {
+                partial.push(segment.subarray(aligned));
+                partialLength = segment.length - aligned;
+            }
+        }
+
+        if (partialLength > 0) {
+            chunks.push(partial.length === 1 ? partial[0] : Buffer.concat(partial, partialLength));
+        }
+        if (chunks.length === 0) {
+            chunks.push(Buffer.alloc(0));
+        }
+        return chunks;
+    }
+
     public transferWithZLP(buffer: Buffer, callback: (error: LibUSBException | undefined) => void): void {
         if (buffer.length % this.descriptor.wMaxPacketSize === 0) {
             this.transfer(buffer);
@@ -2,11 +2,6 @@ import { EventEmitter } from 'events';
 import { ExtendedDevice } from './device';
 import * as usb from './bindings';
 
-if (usb.INIT_ERROR) {
-    /* eslint-disable no-console */
-    console.warn('Failed to initialize libusb.');
-}
-
 Object.setPrototypeOf(usb, EventEmitter.prototype);
 Object.defineProperty(usb, 'pollHotplug', {
     value: false,
@@ -18,24 +13,74 @@ Object.defineProperty(usb, 'pollHotplugDelay', {
     writable: true
 });
 
-// `usb.Device` is not defined when `usb.INIT_ERROR` is true
-if (usb.Device) {
-    Object.getOwnPropertyNames(ExtendedDevice.prototype).forEach(name => {
-        Object.defineProperty(usb.Device.prototype, name, Object.getOwnPropertyDescriptor(ExtendedDevice.prototype, name) || Object.create(null));
-    });
-}
+let hotplugSettleTime = 0;
+Object.defineProperty(usb, 'hotplugSettleTime', {
+    get: (): number => hotplugSettleTime,
+    set: (settleMs: number): void => {
+        usb._setHotplugSettleTime(settleMs);
+        hotplugSettleTime = settleMs;
+    }
+});
+
+Object.defineProperty(usb, 'setTransferBudget', {
+    value: (budget: Partial<usb.TransferBudget>): void => {
+        const current = usb._getTransferBudget();
+        usb._setTransferBudget(budget.maxTransfers ?? current.maxTransfers, budget.maxBytes ?? current.maxBytes, budget.queue ?? current.queue);
+    }
+});
+
+Object.defineProperty(usb, 'getTransferBudget', {
+    value: (): usb.TransferBudgetUsage => usb._getTransferBudget()
+});
+
+Object.defineProperty(usb, 'startCapture', {
+    value: (path: string, options: usb.CaptureOptions = {}): void => {
+        usb._startCapture(path, options.snaplen ?? 65536, options.bufferSize ?? 4 * 1024 * 1024);
+    }
+});
+
+Object.defineProperty(usb, 'stopCapture', {
+    value: (): usb.CaptureStats | undefined => usb._stopCapture()
+});
+
+Object.defineProperty(usb, 'getDeviceListAsync', {
+    value: (): Promise<usb.Device[]> => new Promise((resolve, reject) => {
+        usb._getDeviceListAsync((error, devices) => error ? reject(error) : resolve(devices || []));
+    })
+});
+
+Object.defineProperty(usb, 'wrapSysDevice', {
+    value: (fd: number, defaultConfig = true): usb.Device => {
+        const device = usb._wrapSysDevice(fd);
+        // Already open on the wrapped handle, this sets up the interfaces
+        device.open(defaultConfig);
+        return device;
+    }
+});
+
+Object.getOwnPropertyNames(ExtendedDevice.prototype).forEach(name => {
+    Object.defineProperty(usb.Device.prototype, name, Object.getOwnPropertyDescriptor(ExtendedDevice.prototype, name) || Object.create(null));
+});
 
 // Devices delta support for non-libusb hotplug events
 let hotPlugDevices = new Set<usb.Device>();
 
 // This method needs to be used for attach/detach IDs (hotplugSupportType === 2) rather than a lookup because vid/pid are not unique
-const emitHotplugEvents = () => {
-    // Collect current devices
-    const devices = new Set(usb.getDeviceList());
+const emitHotplugEvents = async () => {
+    // Collect current devices off the main thread
+    const devices = new Set(await usb.getDeviceListAsync());
+
+    // Polling may have been stopped while enumerating
+    if (!pollingHotplug) {
+        return;
+    }
+
+    const change: usb.HotplugChange = { attached: [], detached: [] };
 
     // Find attached devices
     for (const device of devices) {
         if (!hotPlugDevices.has(device)) {
+            change.attached.push(device);
             usb.emit('attach', device);
         }
     }
@@ -43,22 +88,30 @@ const emitHotplugEvents = () => {
     // Find detached devices
     for (const device of hotPlugDevices) {
         if (!devices.has(device)) {
+            change.detached.push(device);
             usb.emit('detach', device);
         }
     }
 
     hotPlugDevices = devices;
+    if (change.attached.length || change.detached.length) {
+        usb.emit('change', change);
+    }
 };
 
 // Polling mechanism for checking device changes where hotplug detection is not available
 let pollingHotplug = false;
-const pollHotplug = (start = false) => {
+const pollHotplug = async (start = false) => {
     if (start) {
         pollingHotplug = true;
     } else if (!pollingHotplug) {
         return;
     } else {
-        emitHotplugEvents();
+        try {
+            await emitHotplugEvents();
+        } catch {
+            // Ignore enumeration errors, the next poll will retry
+        }
     }
 
     setTimeout(() => pollHotplug(), usb.pollHotplugDelay);
@@ -91,20 +144,20 @@ const stopHotplug = () => {
 };
 
 usb.on('newListener', event => {
-    if (event !== 'attach' && event !== 'detach') {
+    if (event !== 'attach' && event !== 'detach' && event !== 'change') {
         return;
     }
-    const listenerCount = usb.listenerCount('attach') + usb.listenerCount('detach');
+    const listenerCount = usb.listenerCount('attach') + usb.listenerCount('detach') + usb.listenerCount('change');
     if (listenerCount === 0) {
         startHotplug();
     }
 });
 
 usb.on('removeListener', event => {
-    if (event !== 'attach' && event !== 'detach') {
+    if (event !== 'attach' && event !== 'detach' && event !== 'change') {
         return;
     }
-    const listenerCount = usb.listenerCount('attach') + usb.listenerCount('detach');
+    const listenerCount = usb.listenerCount('attach') + usb.listenerCount('detach') + usb.listenerCount('change');
     if (listenerCount === 0) {
         stopHotplug();
     }
@@ -1,4 +1,4 @@
-import { LibUSBException, LIBUSB_ENDPOINT_IN, Device } from './bindings';
+import { LibUSBException, LIBUSB_ENDPOINT_IN, LIBUSB_RECIPIENT_INTERFACE, LIBUSB_REQUEST_GET_DESCRIPTOR, LIBUSB_DT_HID, LIBUSB_DT_REPORT, Device, HidDecoder } from './bindings';
 import { InterfaceDescriptor } from './descriptors';
 import { Endpoint, InEndpoint, OutEndpoint } from './endpoint';
 import { promisify } from 'util';
@@ -16,6 +16,8 @@ export class Interface {
     /** List of endpoints on this interface: InEndpoint and OutEndpoint objects. */
     public endpoints!: Endpoint[];
 
+    protected hidDecoder: HidDecoder | undefined;
+
     public releaseAsync: () => Promise<void>;
     public setAltSettingAsync: (alternateSetting: number) => Promise<void>;
 
@@ -31,6 +33,7 @@ export class Interface {
         }
 
         this.descriptor = this.device.configDescriptor.interfaces[this.id][this.altSetting];
+        this.hidDecoder = undefined;
         this.interfaceNumber = this.descriptor.bInterfaceNumber;
         this.endpoints = [];
         const len = this.descriptor.endpoints.length;
@@ -50,6 +53,17 @@ export class Interface {
         this.device.__claimInterface(this.id);
     }
 
+    /**
+     * Claims the interface on the thread pool, without blocking the event loop.
+     *
+     * The device must be open to use this method.
+     */
+    public claimAsync(): Promise<void> {
+        return new Promise((resolve, reject) => {
+            this.device.__claimInterface(this.id, error => error ? reject(error) : resolve());
+        });
+    }
+
     /**
      * Releases the interface and resets the alternate setting. Calls callback when complete.
      *
@@ -133,6 +147,17 @@ export class Interface {
         return this.device.__detachKernelDriver(this.id);
     }
 
+    /**
+     * Detaches the kernel driver from the interface on the thread pool, without blocking the event loop.
+     *
+     * The device must be open to use this method.
+     */
+    public detachKernelDriverAsync(): Promise<void> {
+        return new Promise((resolve, reject) => {
+            this.device.__detachKernelDriver(this.id, error => error ? reject(error) : resolve());
+        });
+    }
+
     /**
      * Re-attaches the kernel driver for the interface.
      *
@@ -161,6 +186,76 @@ export class Interface {
         });
     }
 
+    /**
+     * Read the HID report descriptor of this interface, with its length taken from the HID class descriptor in `descriptor.extra`.
+     * Throws if the interface has no HID class descriptor.
+     *
+     * The device must be open to use this method.
+     * @param callback
+     */
+    public getHidReportDescriptor(callback: (error: LibUSBException | undefined, descriptor?: Buffer) => void): void {
+        const length = this.hidReportDescriptorLength();
+        if (length === undefined) {
+            throw new Error('Interface has no HID report descriptor');
+        }
+
+        this.device.controlTransfer(
+            LIBUSB_ENDPOINT_IN | LIBUSB_RECIPIENT_INTERFACE,
+            LIBUSB_REQUEST_GET_DESCRIPTOR,
+            LIBUSB_DT_REPORT << 8,
+            this.interfaceNumber,
+            length,
+            (error, buffer) => callback.call(this, error, error ? undefined : buffer as Buffer)
+        );
+    }
+
+    /**
+     * Read and compile the HID report descriptor of this interface, for `InEndpoint.startHidPoll()` or decoding reports one at a time.
+     * The descriptor is only read and compiled once; later calls return the same decoder until the alternate setting changes.
+     * Throws if the interface has no HID class descriptor.
+     *
+     * The device must be open to use this method.
+     * @param callback
+     */
+    public getHidDecoder(callback: (error: LibUSBException | undefined, decoder?: HidDecoder) => void): void {
+        if (this.hidDecoder) {
+            const decoder = this.hidDecoder;
+            process.nextTick(() => callback.call(this, undefined, decoder));
+            return;
+        }
+
+        this.getHidReportDescriptor((error, descriptor) => {
+            if (error || !descriptor) {
+                return callback.call(this, error);
+            }
+            let decoder: HidDecoder;
+            try {
+                decoder = new HidDecoder(descriptor);
+            } catch (e) {
+                return callback.call(this, e as LibUSBException);
+            }
+            this.hidDecoder = decoder;
+            callback.call(this, undefined, decoder);
+        });
+    }
+
+    // wDescriptorLength of the report descriptor listed in the HID class descriptor
+    protected hidReportDescriptorLength(): number | undefined {
+        const extra = this.descriptor.extra;
+        for (let i = 0; i + 1 < extra.length && extra[i] > 0; i += extra[i]) {
+            if (extra[i + 1] !== LIBUSB_DT_HID || i + 6 > extra.length) {
+                continue;
+            }
+            const count = extra[i + 5];
+            for (let k = 0; k < count && i + 9 + 3 * k <= extra.length; k++) {
+                if (extra[i + 6 + 3 * k] === LIBUSB_DT_REPORT) {
+                    return extra.readUInt16LE(i + 7 + 3 * k);
+                }
+            }
+        }
+        return undefined;
+    }
+
     /**
      * Return the InEndpoint or OutEndpoint with the specified address.
      *
@@ -0,0 +1,369 @@
+import { platform } from 'os';
+import * as usb from './index';
+import { BotEngine, BotEngineStats, LIBUSB_ENDPOINT_IN, LIBUSB_RECIPIENT_INTERFACE, LIBUSB_REQUEST_TYPE_CLASS, LIBUSB_TRANSFER_TYPE_BULK } from './bindings';
+import { InEndpoint, OutEndpoint } from './endpoint';
+import { Interface } from './interface';
+
+// USB Mass Storage Class, SCSI transparent command set over Bulk-Only Transport
+const MSC_CLASS = 0x08;
+const MSC_SUBCLASS_SCSI = 0x06;
+const MSC_PROTOCOL_BOT = 0x50;
+const GET_MAX_LUN = 0xfe;
+
+const TEST_UNIT_READY = 0x00;
+const INQUIRY = 0x12;
+const READ_CAPACITY_10 = 0x25;
+const READ_10 = 0x28;
+const WRITE_10 = 0x2a;
+const SYNCHRONIZE_CACHE_10 = 0x35;
+const READ_16 = 0x88;
+const WRITE_16 = 0x8a;
+const SERVICE_ACTION_IN_16 = 0x9e;
+const READ_CAPACITY_16 = 0x10;
+
+const SENSE_NOT_READY = 0x02;
+const SENSE_UNIT_ATTENTION = 0x06;
+
+/** Options for `MassStorage.open()`. */
+export interface MassStorageOptions {
+    /** Number of the mass storage interface, if the device has more than one (default: the first one). */
+    interface?: number;
+    /** Largest transfer the data phase of a command is split into, in bytes (default 131072). */
+    maxTransferSize?: number;
+    /** Data transfers kept in flight within a command (default 4). */
+    depth?: number;
+    /** Most bytes moved by one READ or WRITE command; longer requests are split into several queued commands (default 1 MiB). */
+    maxCommandSize?: number;
+    /** Timeout in milliseconds for each transfer, 0 for none (default 20000). */
+    timeout?: number;
+    /** Detach a kernel driver such as `usb-storage` from the interface (default `true`). */
+    detachKernelDriver?: boolean;
+}
+
+/** Result of a command that completed its status phase, see `MassStorage.command()`. */
+export interface ScsiResult {
+    /** CSW status: 0 passed, 1 failed, 2 phase error. */
+    status: number;
+    /** Bytes of the data phase that were not transferred. */
+    residue: number;
+    /** Sense data fetched after a failed command. */
+    sense?: Buffer;
+}
+
+/** Block size and count of a logical unit. */
+export interface BlockCapacity {
+    blockSize: number;
+    blocks: number;
+}
+
+/** A SCSI command that the device failed, with its sense data if it had any. */
+export class ScsiError extends Error {
+    public senseKey?: number;
+    public asc?: number;
+    public ascq?: number;
+
+    constructor(public readonly opcode: number, public readonly status: number, public readonly sense?: Buffer) {
+        super(`SCSI command 0x${opcode.toString(16)} failed` + (sense && sense.length >= 14
+            ? `: sense key 0x${(sense[2] & 0x0f).toString(16)}, ASC 0x${sense[12].toString(16)}, ASCQ 0x${sense[13].toString(16)}`
+            : status === 2 ? ': phase error' : ''));
+        if (sense && sense.length >= 14) {
+            this.senseKey = sense[2] & 0x0f;
+            this.asc = sense[12];
+            this.ascq = sense[13];
+        }
+    }
+}
+
+const isMassStorage = (iface: Interface): boolean =>
+    iface.descriptor.bInterfaceClass === MSC_CLASS
+    && iface.descriptor.bInterfaceSubClass === MSC_SUBCLASS_SCSI
+    && iface.descriptor.bInterfaceProtocol === MSC_PROTOCOL_BOT;
+
+const delay = (ms: number): Promise<void> => new Promise(resolve => setTimeout(resolve, ms));
+
+// READ/WRITE (10) while the LBA and block count fit, (16) beyond
+const readWriteCdb = (write: boolean, lba: number, blocks: number): Buffer => {
+    if (lba + blocks <= 0x100000000 && blocks <= 0xffff) {
+        const cdb = Buffer.alloc(10);
+        cdb[0] = write ? WRITE_10 : READ_10;
+        cdb.writeUInt32BE(lba, 2);
+        cdb.writeUInt16BE(blocks, 7);
+        return cdb;
+    }
+    const cdb = Buffer.alloc(16);
+    cdb[0] = write ? WRITE_16 : READ_16;
+    cdb.writeUInt32BE(Math.floor(lba / 0x100000000), 2);
+    cdb.writeUInt32BE(lba % 0x100000000, 6);
+    cdb.writeUInt32BE(blocks, 10);
+    return cdb;
+};
+
+/**
+ * Raw block access to a USB mass storage device (SCSI over Bulk-Only Transport), without a kernel driver.
+ *
+ * Commands run in a native `BotEngine` on the libusb event thread: the CBW, data and CSW phases of each command follow each other
+ * there, data phases are split into several concurrent transfers, failed commands are followed by REQUEST SENSE, and STALLs and
+ * transport errors are recovered from with clear halt or reset recovery as the Bulk-Only Transport specification describes. Block
+ * reads and writes longer than `maxCommandSize` are split into commands that are all queued at once, so the device is kept busy
+ * without a round trip through JS between them, and the data moves straight into or out of the caller's buffer.
+ */
+export class MassStorage {
+    /** The mass storage interface. */
+    public readonly interface: Interface;
+    /** Highest logical unit number. */
+    public readonly maxLun: number;
+
+    protected readonly engine: BotEngine;
+    protected readonly maxCommandSize: number;
+    protected capacities = new Map<number, BlockCapacity>();
+    protected outstanding = 0;
+    protected idle: Array<() => void> = [];
+    protected closed = false;
+
+    /**
+     * Open `device` (if it is not already open), claim its mass storage interface and wait for logical unit 0 to be ready.
+     * On failure the interface is released, and the device closed again if this opened it.
+     * @param device
+     * @param options
+     */
+    public static async open(device: usb.Device, options: MassStorageOptions = {}): Promise<MassStorage> {
+        const opened = !device.interfaces;
+        if (opened) {
+            await device.openAsync();
+        }
+        try {
+            const iface = (device.interfaces || []).find(iface => isMassStorage(iface) && (options.interface === undefined || iface.interfaceNumber === options.interface));
+            if (!iface) {
+                throw new Error('No Bulk-Only mass storage interface found');
+            }
+            if (options.detachKernelDriver !== false && platform() === 'linux' && iface.isKernelDriverActive()) {
+                await iface.detachKernelDriverAsync();
+            }
+            await iface.claimAsync();
+
+            let storage: MassStorage | undefined;
+            try {
+                const maxLun = await MassStorage.getMaxLun(device, iface);
+                storage = new MassStorage(device, iface, maxLun, options);
+                await storage.waitReady(0);
+                return storage;
+            } catch (error) {
+                if (storage) {
+                    await storage.close().catch(() => undefined);
+                } else {
+                    await iface.releaseAsync().catch(() => undefined);
+                }
+                throw error;
+            }
+        } catch (error) {
+            // Leave the device as we found it
+            if (opened) {
+                await device.closeAsync().catch(() => undefined);
+            }
+            throw error;
+        }
+    }
+
+    // GET MAX LUN; devices with a single LUN may STALL it
+    protected static getMaxLun(device: usb.Device, iface: Interface): Promise<number> {
+        return new Promise(resolve => {
+            device.controlTransfer(LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE | LIBUSB_ENDPOINT_IN, GET_MAX_LUN, 0, iface.interfaceNumber, 1, (error, data) => {
+                resolve(!error && data instanceof Buffer && data.length === 1 ? Math.min(15, data[0]) : 0);
+            });
+        });
+    }
+
+    protected constructor(public readonly device: usb.Device, iface: Interface, maxLun: number, options: MassStorageOptions) {
+        this.interface = iface;
+        this.maxLun = maxLun;
+        this.maxCommandSize = options.maxCommandSize ?? 1024 * 1024;
+
+        const bulkIn = iface.endpoints.find(endpoint => endpoint instanceof InEndpoint && endpoint.transferType === LIBUSB_TRANSFER_TYPE_BULK);
+        const bulkOut = iface.endpoints.find(endpoint => endpoint instanceof OutEndpoint && endpoint.transferType === LIBUSB_TRANSFER_TYPE_BULK);
+        if (!bulkIn || !bulkOut) {
+            throw new Error('Mass storage interface has no bulk endpoints');
+        }
+        this.engine = new BotEngine(device, iface.interfaceNumber, bulkIn.address, bulkOut.address, options.maxTransferSize ?? 128 * 1024,
+            options.depth ?? 4, options.timeout ?? 20000);
+    }
+
+    /**
+     * Queue a SCSI command. Resolves once the command has completed its status phase, whatever its status; rejects on a transport
+     * error, after reset recovery.
+     * @param lun Logical unit number
+     * @param cdb Command descriptor block, 6 to 16 bytes
+     * @param dataIn Whether the data phase is from the device
+     * @param data Buffer to read into or write from, if the command has a data phase
+     */
+    public command(lun: number, cdb: Buffer, dataIn = false, data?: Buffer): Promise<ScsiResult> {
+        if (this.closed) {
+            return Promise.reject(new Error('Mass storage device is closed'));
+        }
+        return new Promise((resolve, reject) => {
+            this.engine.submit(lun, cdb, dataIn, data, (error, status, residue, sense) => {
+                if (--this.outstanding === 0) {
+                    this.idle.splice(0).forEach(callback => callback());
+                }
+                if (error) {
+                    reject(error);
+                } else {
+                    resolve({ status, residue, sense });
+                }
+            });
+            this.outstanding++;
+        });
+    }
+
+    /**
+     * Send INQUIRY.
+     * @param lun
+     */
+    public async inquiry(lun = 0): Promise<{ peripheralType: number, removable: boolean, vendor: string, product: string, revision: string }> {
+        const data = Buffer.alloc(36);
+        await this.checked(lun, Buffer.from([INQUIRY, 0, 0, 0, data.length, 0]), true, data);
+        const text = (start: number, end: number) => data.toString('latin1', start, end).trim();
+        return {
+            peripheralType: data[0] & 0x1f,
+            removable: !!(data[1] & 0x80),
+            vendor: text(8, 16),
+            product: text(16, 32),
+            revision: text(32, 36)
+        };
+    }
+
+    /**
+     * Send TEST UNIT READY, rejecting with a `ScsiError` if the unit is not ready.
+     * @param lun
+     */
+    public async testUnitReady(lun = 0): Promise<void> {
+        await this.checked(lun, Buffer.from([TEST_UNIT_READY, 0, 0, 0, 0, 0]));
+    }
+
+    /**
+     * Read the block size and count of a logical unit, with READ CAPACITY (16) if it has more than 2^32 - 1 blocks.
+     * @param lun
+     */
+    public async readCapacity(lun = 0): Promise<BlockCapacity> {
+        const data = Buffer.alloc(8);
+        await this.checked(lun, Buffer.from([READ_CAPACITY_10, 0, 0, 0, 0, 0, 0, 0, 0, 0]), true, data);
+        let capacity: BlockCapacity = { blockSize: data.readUInt32BE(4), blocks: data.readUInt32BE(0) + 1 };
+
+        if (data.readUInt32BE(0) === 0xffffffff) {
+            const data16 = Buffer.alloc(32);
+            const cdb = Buffer.alloc(16);
+            cdb[0] = SERVICE_ACTION_IN_16;
+            cdb[1] = READ_CAPACITY_16;
+            cdb.writeUInt32BE(data16.length, 10);
+            await this.checked(lun, cdb, true, data16);
+            capacity = { blockSize: data16.readUInt32BE(8), blocks: data16.readUInt32BE(0) * 0x100000000 + data16.readUInt32BE(4) + 1 };
+        }
+        if (!capacity.blockSize) {
+            throw new Error('Logical unit reports a block size of 0');
+        }
+        this.capacities.set(lun, capacity);
+        return capacity;
+    }
+
+    /**
+     * Read `count` blocks starting at `lba` into `buffer`, or a new Buffer.
+     * @param lba
+     * @param count
+     * @param lun
+     * @param buffer At least `count` blocks long
+     */
+    public async readBlocks(lba: number, count: number, lun = 0, buffer?: Buffer): Promise<Buffer> {
+        const { blockSize } = await this.capacity(lun);
+        const data = buffer ? buffer.subarray(0, count * blockSize) : Buffer.allocUnsafe(count * blockSize);
+        if (data.length < count * blockSize) {
+            throw new RangeError('Buffer is smaller than the blocks to read');
+        }
+        await this.blockCommands(false, lun, lba, count, blockSize, data);
+        return data;
+    }
+
+    /**
+     * Write whole blocks from `data` starting at `lba`.
+     * @param lba
+     * @param data A multiple of the block size long
+     * @param lun
+     */
+    public async writeBlocks(lba: number, data: Buffer, lun = 0): Promise<void> {
+        const { blockSize } = await this.capacity(lun);
+        if (data.length % blockSize) {
+            throw new RangeError(`Data is not a multiple of the block size (${blockSize})`);
+        }
+        await this.blockCommands(true, lun, lba, data.length / blockSize, blockSize, data);
+    }
+
+    /**
+     * Send SYNCHRONIZE CACHE, so that written blocks reach the medium.
+     * @param lun
+     */
+    public async synchronizeCache(lun = 0): Promise<void> {
+        await this.checked(lun, Buffer.from([SYNCHRONIZE_CACHE_10, 0, 0, 0, 0, 0, 0, 0, 0, 0]));
+    }
+
+    /** Counters of the native engine. */
+    public stats(): BotEngineStats {
+        return this.engine.stats();
+    }
+
+    /** Wait for queued commands to finish and release the interface. The device stays open. */
+    public async close(): Promise<void> {
+        this.closed = true;
+        if (this.outstanding) {
+            await new Promise<void>(resolve => this.idle.push(resolve));
+        }
+        if (this.device.interfaces) {
+            await this.interface.releaseAsync().catch(() => undefined);
+        }
+    }
+
+    protected async capacity(lun: number): Promise<BlockCapacity> {
+        return this.capacities.get(lun) || this.readCapacity(lun);
+    }
+
+    // Run a command, rejecting unless it passed and moved all of its data
+    protected async checked(lun: number, cdb: Buffer, dataIn = false, data?: Buffer): Promise<void> {
+        const result = await this.command(lun, cdb, dataIn, data);
+        if (result.status !== 0) {
+            throw new ScsiError(cdb[0], result.status, result.sense);
+        }
+        if (result.residue && cdb[0] !== INQUIRY) {
+            throw new Error(`SCSI command 0x${cdb[0].toString(16)} left ${result.residue} bytes of ${data ? data.length : 0} untransferred`);
+        }
+    }
+
+    // Queue one command per maxCommandSize of blocks, all at once
+    protected async blockCommands(write: boolean, lun: number, lba: number, count: number, blockSize: number, data: Buffer): Promise<void> {
+        const capacity = this.capacities.get(lun);
+        if (lba < 0 || count < 0 || (capacity && lba + count > capacity.blocks)) {
+            throw new RangeError('Blocks are outside the logical unit');
+        }
+        const blocksPerCommand = Math.max(1, Math.min(0xffff, Math.floor(this.maxCommandSize / blockSize)));
+        const commands: Array<Promise<void>> = [];
+        for (let block = 0; block < count; block += blocksPerCommand) {
+            const blocks = Math.min(blocksPerCommand, count - block);
+            commands.push(this.checked(lun, readWriteCdb(write, lba + block, blocks), !write, data.subarray(block * blockSize, (block + blocks) * blockSize)));
+        }
+        await Promise.all(commands);
+    }
+
+    // The first commands after power-on or reset commonly report UNIT ATTENTION or NOT READY
+    protected async waitReady(lun: number, attempts = 10): Promise<void> {
+        for (let attempt = 1; ; attempt++) {
+            try {
+                await this.testUnitReady(lun);
+                return;
+            } catch (error) {
+                const senseKey = (error as ScsiError).senseKey;
+                if (attempt >= attempts || (senseKey !== SENSE_UNIT_ATTENTION && senseKey !== SENSE_NOT_READY)) {
+                    throw error;
+                }
+                if (senseKey === SENSE_NOT_READY) {
+                    await delay(100);
+                }
+            }
+        }
+    }
+}
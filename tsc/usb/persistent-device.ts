@@ -0,0 +1,289 @@
+import { EventEmitter } from 'events';
+import * as usb from './index';
+import { InEndpoint } from './endpoint';
+
+/** Options for `PersistentDevice.open()`. */
+export interface PersistentDeviceOptions {
+    /** Only reattach a device with the same serial number, if the device has one (default `true`) */
+    matchSerial?: boolean;
+
+    /** Attempts to open the device when it comes back, e.g. while udev is still applying permissions (default 5) */
+    reopenAttempts?: number;
+
+    /** Delay in milliseconds between those attempts (default 100) */
+    reopenDelay?: number;
+
+    /** Enable automatic kernel driver detachment on each open */
+    autoDetachKernelDriver?: boolean;
+}
+
+interface PollSettings {
+    nTransfers?: number;
+    transferSize?: number;
+}
+
+// Bus and port path, which stay the same when a device re-enumerates on the same port
+const deviceLocation = (device: usb.Device): string => `${device.busNumber}-${(device.portNumbers || []).join('.')}`;
+
+const readSerialNumber = (device: usb.Device): Promise<string | undefined> => new Promise(resolve => {
+    if (!device.deviceDescriptor.iSerialNumber) {
+        resolve(undefined);
+        return;
+    }
+    device.getStringDescriptor(device.deviceDescriptor.iSerialNumber, (error, value) => resolve(error ? undefined : value));
+});
+
+const delay = (ms: number): Promise<void> => new Promise(resolve => setTimeout(resolve, ms));
+
+/**
+ * An open device which survives re-enumeration (a firmware reset or a brief disconnect).
+ *
+ * The device is identified by its bus and port path plus its serial number. When it is detached and a matching device is attached,
+ * it is reopened straight from the `attach` event, the interfaces claimed through this object are claimed again with their alternate
+ * settings, and the polls started through this object are restarted. Data from polls is emitted as `data` events on this object, so
+ * listeners carry over.
+ *
+ * Events: `detach` when the device goes, `reattach(device)` once it is back and restored, `data(address, data, completeTime)` from
+ * polls, and `error(error, address?)`. Errors from transfers cut short by the disconnect itself are not emitted.
+ *
+ * This listens for hotplug events until `close()` is called.
+ */
+export class PersistentDevice extends EventEmitter {
+    /** The current device, or `undefined` while it is detached. */
+    public device: usb.Device | undefined;
+
+    /** Stable identity: bus and port path, and the serial number if the device has one. */
+    public readonly key: string;
+
+    protected readonly vendorId: number;
+    protected readonly productId: number;
+    protected readonly location: string;
+    protected claimed = new Map<number, number>();
+    protected polls = new Map<number, PollSettings>();
+    protected reattaching = false;
+    protected closed = false;
+
+    private onAttach = (device: usb.Device) => this.attached(device);
+    private onDetach = (device: usb.Device) => this.detached(device);
+
+    protected constructor(device: usb.Device, protected readonly serialNumber: string | undefined, protected options: PersistentDeviceOptions) {
+        super();
+        this.device = device;
+        this.vendorId = device.deviceDescriptor.idVendor;
+        this.productId = device.deviceDescriptor.idProduct;
+        this.location = deviceLocation(device);
+        this.key = serialNumber ? `${this.location}/${serialNumber}` : this.location;
+        usb.on('attach', this.onAttach);
+        usb.on('detach', this.onDetach);
+    }
+
+    /**
+     * Open `device` (if it is not already open) and start following it across re-enumeration.
+     * @param device
+     * @param options
+     */
+    public static async open(device: usb.Device, options: PersistentDeviceOptions = {}): Promise<PersistentDevice> {
+        if (!device.interfaces) {
+            await device.openAsync();
+        }
+        if (options.autoDetachKernelDriver !== undefined) {
+            await device.setAutoDetachKernelDriverAsync(options.autoDetachKernelDriver);
+        }
+        return new PersistentDevice(device, await readSerialNumber(device), options);
+    }
+
+    /**
+     * Claim an interface, selecting `alternateSetting`, now and whenever the device comes back.
+     * @param interfaceNumber
+     * @param alternateSetting
+     */
+    public async claimInterface(interfaceNumber: number, alternateSetting = 0): Promise<void> {
+        const iface = this.current().interface(interfaceNumber);
+        await iface.claimAsync();
+        if (alternateSetting) {
+            await iface.setAltSettingAsync(alternateSetting);
+        }
+        this.claimed.set(interfaceNumber, alternateSetting);
+    }
+
+    /**
+     * Release an interface, stopping any polls started on it.
+     * @param interfaceNumber
+     */
+    public async releaseInterface(interfaceNumber: number): Promise<void> {
+        this.claimed.delete(interfaceNumber);
+        const iface = this.current().interface(interfaceNumber);
+        for (const endpoint of iface.endpoints) {
+            this.polls.delete(endpoint.address);
+            if (endpoint instanceof InEndpoint && endpoint.pollActive) {
+                await new Promise<void>(resolve => endpoint.stopPoll(resolve));
+            }
+        }
+        await iface.releaseAsync();
+    }
+
+    /**
+     * Start polling an IN endpoint of a claimed interface, now and whenever the device comes back. See `InEndpoint.startPoll()`.
+     * @param address Endpoint address
+     * @param nTransfers
+     * @param transferSize
+     */
+    public startPoll(address: number, nTransfers?: number, transferSize?: number): void {
+        if (this.polls.has(address)) {
+            throw new Error('Polling already active');
+        }
+        this.startEndpointPoll(this.current(), address, { nTransfers, transferSize });
+        this.polls.set(address, { nTransfers, transferSize });
+    }
+
+    /**
+     * Stop polling an endpoint.
+     * @param address Endpoint address
+     */
+    public stopPoll(address: number): void {
+        if (!this.polls.delete(address) || !this.device) {
+            return;
+        }
+        const endpoint = this.findEndpoint(this.device, address);
+        if (endpoint && endpoint.pollActive) {
+            endpoint.stopPoll();
+        }
+    }
+
+    /** Stop following the device, and stop its polls, release its interfaces and close it if it is attached. */
+    public async close(): Promise<void> {
+        this.closed = true;
+        usb.removeListener('attach', this.onAttach);
+        usb.removeListener('detach', this.onDetach);
+
+        const device = this.device;
+        this.device = undefined;
+        if (!device) {
+            return;
+        }
+        for (const address of [...this.polls.keys()]) {
+            const endpoint = this.findEndpoint(device, address);
+            if (endpoint && endpoint.pollActive) {
+                await new Promise<void>(resolve => endpoint.stopPoll(resolve));
+            }
+        }
+        this.polls.clear();
+        for (const interfaceNumber of this.claimed.keys()) {
+            await device.interface(interfaceNumber).releaseAsync().catch(() => undefined);
+        }
+        this.claimed.clear();
+        await device.closeAsync();
+    }
+
+    protected current(): usb.Device {
+        if (!this.device) {
+            throw new Error('Device is detached');
+        }
+        return this.device;
+    }
+
+    protected findEndpoint(device: usb.Device, address: number): InEndpoint | undefined {
+        for (const iface of device.interfaces || []) {
+            const endpoint = iface.endpoint(address);
+            if (endpoint) {
+                return endpoint as InEndpoint;
+            }
+        }
+        return undefined;
+    }
+
+    protected startEndpointPoll(device: usb.Device, address: number, settings: PollSettings): void {
+        const endpoint = this.findEndpoint(device, address);
+        if (!(endpoint instanceof InEndpoint)) {
+            throw new Error(`Endpoint ${address} not found`);
+        }
+        const onData = (data: Buffer, completeTime: number) => this.emit('data', address, data, completeTime);
+        const onError = (error: usb.LibUSBException) => {
+            if (error.errno !== usb.LIBUSB_TRANSFER_NO_DEVICE && this.device === device) {
+                this.emit('error', error, address);
+            }
+        };
+        endpoint.on('data', onData);
+        endpoint.on('error', onError);
+        endpoint.once('end', () => {
+            endpoint.removeListener('data', onData);
+            endpoint.removeListener('error', onError);
+        });
+        endpoint.startPoll(settings.nTransfers, settings.transferSize);
+    }
+
+    protected detached(device: usb.Device): void {
+        if (device !== this.device) {
+            return;
+        }
+        this.device = undefined;
+        this.emit('detach');
+    }
+
+    protected matches(device: usb.Device): boolean {
+        return device.deviceDescriptor.idVendor === this.vendorId
+            && device.deviceDescriptor.idProduct === this.productId
+            && deviceLocation(device) === this.location;
+    }
+
+    protected attached(device: usb.Device): void {
+        if (this.device || this.reattaching || this.closed || !this.matches(device)) {
+            return;
+        }
+        this.reattaching = true;
+        this.restore(device)
+            .catch(error => this.emit('error', error))
+            .finally(() => this.reattaching = false);
+    }
+
+    protected async restore(device: usb.Device): Promise<void> {
+        const attempts = Math.max(1, this.options.reopenAttempts ?? 5);
+        for (let attempt = 1; ; attempt++) {
+            try {
+                await device.openAsync();
+                break;
+            } catch (error) {
+                if (attempt >= attempts) {
+                    throw error;
+                }
+                await delay(this.options.reopenDelay ?? 100);
+            }
+        }
+
+        try {
+            if (this.serialNumber !== undefined && this.options.matchSerial !== false && await readSerialNumber(device) !== this.serialNumber) {
+                // A different device on the same port
+                await device.closeAsync();
+                return;
+            }
+            if (this.options.autoDetachKernelDriver !== undefined) {
+                await device.setAutoDetachKernelDriverAsync(this.options.autoDetachKernelDriver);
+            }
+            for (const [interfaceNumber, alternateSetting] of this.claimed) {
+                const iface = device.interface(interfaceNumber);
+                await iface.claimAsync();
+                if (alternateSetting) {
+                    await iface.setAltSettingAsync(alternateSetting);
+                }
+            }
+        } catch (error) {
+            await device.closeAsync().catch(() => undefined);
+            throw error;
+        }
+
+        if (this.closed) {
+            await device.closeAsync();
+            return;
+        }
+
+        this.device = device;
+        for (const [address, settings] of this.polls) {
+            try {
+                this.startEndpointPoll(device, address, settings);
+            } catch (error) {
+                this.emit('error', error, address);
+            }
+        }
+        this.emit('reattach', device);
+    }
+}
@@ -0,0 +1,161 @@
+import { LIBUSB_SPEED_HIGH, LIBUSB_SPEED_SUPER } from './bindings';
+
+/** Options for `InEndpoint.startAdaptivePoll()`. */
+export interface AdaptivePollOptions {
+    /** Smallest transfer size in bytes (default: one burst, `Endpoint.burstSize`). */
+    minTransferSize?: number;
+    /** Largest transfer size in bytes (default 1 MiB). */
+    maxTransferSize?: number;
+    /** Fewest transfers kept in flight (default 2). */
+    minTransfers?: number;
+    /** Most transfers kept in flight (default 16). */
+    maxTransfers?: number;
+    /** Longest time in milliseconds data should wait in a filling transfer before reaching JS (default 20). */
+    targetLatency?: number;
+    /** Length in milliseconds of each measurement window (default 250). */
+    interval?: number;
+}
+
+/** Current settings and last measurements of an adaptive poll, see `InEndpoint.adaptivePollStats`. */
+export interface AdaptivePollStats {
+    /** Bytes per transfer submitted from now on. */
+    transferSize: number;
+    /** Transfers kept in flight. */
+    nTransfers: number;
+    /** Bytes per second received during the last window. */
+    throughput: number;
+    /** Mean time in milliseconds from submission to completion during the last window. */
+    latency: number;
+    /** Fraction of the submitted buffer space that was filled during the last window. */
+    fill: number;
+    /** Number of times the settings have been changed. */
+    adjustments: number;
+}
+
+// Transfers in flight and bursts per transfer to start with at each speed
+const initialSettings = (speed: number, bulk: boolean): { nTransfers: number, bursts: number } => {
+    if (!bulk || speed < LIBUSB_SPEED_HIGH) {
+        return { nTransfers: 3, bursts: 1 };
+    }
+    if (speed < LIBUSB_SPEED_SUPER) {
+        return { nTransfers: 4, bursts: 8 };
+    }
+    return { nTransfers: 8, bursts: 4 };
+};
+
+/**
+ * Picks the transfer size and queue depth for an adaptive poll, and adjusts them from the completions of each measurement window.
+ *
+ * Transfers that come back full mean the device is streaming: the transfer size grows while a transfer fills in well under
+ * `targetLatency` and shrinks when it takes longer, and more transfers are queued when completions show the queue running dry
+ * (each transfer completing in about the time it takes to fill, so nothing was waiting behind it). Mostly empty transfers mean
+ * the device sends short messages, which need neither large buffers nor a deep queue.
+ */
+export class PollTuner {
+    public transferSize: number;
+    public nTransfers: number;
+
+    private minTransferSize: number;
+    private maxTransferSize: number;
+    private minTransfers: number;
+    private maxTransfers: number;
+    private targetLatency: number;
+    private interval: number;
+
+    private windowStart = 0;
+    private bytes = 0;
+    private capacity = 0;
+    private completions = 0;
+    private latencySum = 0;
+    private last = { throughput: 0, latency: 0, fill: 0 };
+    private adjustments = 0;
+
+    /**
+     * @param granule Transfer sizes are multiples of this (the endpoint's burst size)
+     * @param speed Device speed, one of the `LIBUSB_SPEED_*` constants
+     * @param bulk Whether the endpoint is a bulk endpoint
+     * @param options
+     */
+    constructor(private granule: number, speed: number, bulk: boolean, options: AdaptivePollOptions = {}) {
+        this.minTransferSize = this.round(options.minTransferSize ?? granule);
+        this.maxTransferSize = Math.max(this.minTransferSize, this.round(options.maxTransferSize ?? 1024 * 1024));
+        this.minTransfers = Math.max(1, options.minTransfers ?? 2);
+        this.maxTransfers = Math.max(this.minTransfers, options.maxTransfers ?? 16);
+        this.targetLatency = options.targetLatency ?? 20;
+        this.interval = options.interval ?? 250;
+
+        const initial = initialSettings(speed, bulk);
+        this.transferSize = this.clampSize(granule * initial.bursts);
+        this.nTransfers = Math.min(this.maxTransfers, Math.max(this.minTransfers, initial.nTransfers));
+    }
+
+    // Round down to a multiple of the granule, at least one
+    private round(size: number): number {
+        return Math.max(this.granule, size - (size % this.granule));
+    }
+
+    private clampSize(size: number): number {
+        return Math.min(this.maxTransferSize, Math.max(this.minTransferSize, this.round(size)));
+    }
+
+    /**
+     * Record a completed transfer. Returns true when the window closed and the settings changed.
+     * @param size Size of the submitted buffer
+     * @param actualLength Bytes received
+     * @param completeTime
+     * @param submitTime
+     */
+    public record(size: number, actualLength: number, completeTime: number, submitTime: number): boolean {
+        if (this.windowStart === 0) {
+            this.windowStart = submitTime;
+        }
+        this.bytes += actualLength;
+        this.capacity += size;
+        this.completions++;
+        this.latencySum += completeTime - submitTime;
+
+        const elapsed = completeTime - this.windowStart;
+        if (elapsed < this.interval) {
+            return false;
+        }
+
+        const throughput = this.bytes / elapsed; // bytes per millisecond
+        const latency = this.latencySum / this.completions;
+        const fill = this.capacity ? this.bytes / this.capacity : 0;
+        this.last = { throughput: throughput * 1000, latency, fill };
+        this.windowStart = completeTime;
+        this.bytes = this.capacity = this.completions = this.latencySum = 0;
+
+        const { transferSize, nTransfers } = this;
+        if (fill >= 0.9 && throughput > 0) {
+            const fillTime = this.transferSize / throughput;
+            if (fillTime * 2 < this.targetLatency) {
+                this.transferSize = this.clampSize(this.transferSize * 2);
+            } else if (fillTime > this.targetLatency) {
+                this.transferSize = this.clampSize(this.transferSize / 2);
+            }
+            // Fewer than nTransfers - 1 fills ahead of a transfer means the queue was not kept full
+            if (latency < fillTime * (this.nTransfers - 1)) {
+                this.nTransfers = Math.min(this.maxTransfers, this.nTransfers + 1);
+            }
+        } else if (fill < 0.25) {
+            this.transferSize = this.clampSize(this.transferSize / 2);
+            this.nTransfers = Math.max(this.minTransfers, this.nTransfers - 1);
+        }
+
+        if (this.transferSize === transferSize && this.nTransfers === nTransfers) {
+            return false;
+        }
+        this.adjustments++;
+        return true;
+    }
+
+    public stats(): AdaptivePollStats {
+        return {
+            transferSize: this.transferSize,
+            nTransfers: this.nTransfers,
+            ...this.last,
+            adjustments: this.adjustments
+        };
+    }
+}
@@ -0,0 +1,125 @@
+import { LibUSBException, Transfer, Device, TransferPriority } from './bindings';
+
+type TransferCallback = (error: LibUSBException | undefined, buffer: Buffer, actualLength: number, completeTime: number, submitTime: number) => void;
+
+/** Options for splitting large transfers into concurrent chunks, see `Transfer.submitSplit()`. */
+export interface SplitTransferOptions {
+    /** Size in bytes of each chunk; rounded down to a multiple of the endpoint's maximum packet size. */
+    chunkSize: number;
+    /** Number of chunks to keep in flight. */
+    concurrency: number;
+}
+
+/** Scheduler priority classes in the order of the native enum. */
+export const PRIORITIES: TransferPriority[] = ['control', 'interrupt', 'bulk', 'background'];
+
+interface PooledTransfer {
+    transfer: Transfer;
+    callback?: TransferCallback;
+}
+
+/**
+ * Recycles `Transfer` objects for a single endpoint.
+ *
+ * Each `Transfer` owns a native `libusb_transfer` and its completion callback reference, so reusing them avoids
+ * allocating (and later garbage collecting) a new wrapper for every request/response.
+ */
+export class TransferPool {
+    /** Maximum number of idle transfers kept for reuse. */
+    public maxIdle = 16;
+
+    private idle: PooledTransfer[] = [];
+    private timeout: number | undefined;
+    private _priority: TransferPriority | undefined;
+
+    constructor(private device: Device, private endpoint: number, private type: number) {
+    }
+
+    /** Scheduler priority class of the pooled transfers, or `undefined` for the default of their type. */
+    public get priority(): TransferPriority | undefined {
+        return this._priority;
+    }
+    public set priority(value: TransferPriority | undefined) {
+        if (value !== undefined && PRIORITIES.indexOf(value) < 0) {
+            throw new TypeError(`Unknown transfer priority: ${value}`);
+        }
+        // Transfers get their priority when created
+        this._priority = value;
+        this.idle = [];
+    }
+
+    /**
+     * Submit `buffer` on a pooled transfer. The transfer is returned to the pool before `callback` is called.
+     * @param timeout Timeout for the transfer (0 means unlimited).
+     * @param buffer
+     * @param callback
+     * @param split Submit with `Transfer.submitSplit()` using these chunk options.
+     */
+    public submit(timeout: number, buffer: Buffer, callback: TransferCallback, split?: SplitTransferOptions): Transfer {
+        return this.run(timeout, callback, transfer => {
+            if (split) {
+                transfer.submitSplit(buffer, split.chunkSize, split.concurrency);
+            } else {
+                transfer.submit(buffer);
+            }
+        });
+    }
+
+    /**
+     * Submit a packed batch of control requests on a pooled transfer, see `Transfer.submitControlBatch()`.
+     * @param timeout Timeout for each request (0 means unlimited).
+     * @param buffer
+     * @param stopOnError
+     * @param callback
+     */
+    public submitControlBatch(timeout: number, buffer: Buffer, stopOnError: boolean, callback: TransferCallback): Transfer {
+        return this.run(timeout, callback, transfer => transfer.submitControlBatch(buffer, stopOnError));
+    }
+
+    /** Drop all idle transfers so they can be garbage collected. */
+    public clear(): void {
+        this.idle = [];
+    }
+
+    private run(timeout: number, callback: TransferCallback, submit: (transfer: Transfer) => void): Transfer {
+        if (timeout !== this.timeout) {
+            // The timeout is fixed when a native transfer is created, so start a fresh pool
+            this.idle = [];
+            this.timeout = timeout;
+        }
+
+        const entry = this.idle.pop() || this.create(timeout);
+        entry.callback = callback;
+
+        try {
+            submit(entry.transfer);
+        } catch (e) {
+            entry.callback = undefined;
+            this.release(entry, timeout);
+            throw e;
+        }
+        return entry.transfer;
+    }
+
+    private create(timeout: number): PooledTransfer {
+        const entry: PooledTransfer = {} as PooledTransfer;
+        entry.transfer = new Transfer(this.device, this.endpoint, this.type, timeout, (error, buffer, actualLength, completeTime, submitTime) => {
+            const callback = entry.callback;
+            entry.callback = undefined;
+            this.release(entry, timeout);
+            if (callback) {
+                callback(error, buffer, actualLength, completeTime, submitTime);
+            }
+        });
+        if (this._priority !== undefined) {
+            entry.transfer.setPriority(PRIORITIES.indexOf(this._priority));
+        }
+        return entry;
+    }
+
+    private release(entry: PooledTransfer, timeout: number): void {
+        if (timeout === this.timeout && this.idle.length < this.maxIdle) {
+            this.idle.push(entry);
+        }
+    }
+}
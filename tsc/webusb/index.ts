@@ -1,5 +1,6 @@
 import * as usb from '../usb';
 import { EventEmitter } from 'events';
+import { ConfigDescriptor } from '../usb/descriptors';
 import { WebUSBDevice } from './webusb-device';
 
 /**
@@ -30,6 +31,11 @@ export interface USBOptions {
      * Optional flag to enable/disable automatic kernal driver detaching (defaults to true)
      */
     autoDetachKernelDriver?: boolean;
+
+    /**
+     * Optional maximum number of devices to open at once while enumerating (defaults to 4)
+     */
+    concurrency?: number;
 }
 
 /**
@@ -56,6 +62,11 @@ export class WebUSB implements USB {
     protected knownDevices: Map<usb.Device, WebUSBDevice> = new Map();
     protected authorisedDevices = new Set<USBDeviceFilter>();
 
+    // Devices which could not be opened, not retried until the device list changes
+    protected failedDevices = new Set<usb.Device>();
+    protected initializingDevices = new Map<usb.Device, Promise<WebUSBDevice | undefined>>();
+    protected lastDevices = new Set<usb.Device>();
+
     constructor(private options: USBOptions = {}) {
         const deviceConnectCallback = async (device: usb.Device) => {
             const webDevice = await this.getWebDevice(device);
@@ -242,44 +253,77 @@ export class WebUSB implements USB {
     }
 
     private async loadDevices(preFilters?: USBDeviceFilter[]): Promise<USBDevice[]> {
-        let devices = usb.getDeviceList();
+        const allDevices = await usb.getDeviceListAsync();
+        this.refreshCache(allDevices);
 
         // Pre-filter devices
-        devices = this.quickFilter(devices, preFilters);
-
-        const refreshedKnownDevices = new Map<usb.Device, WebUSBDevice>();
+        const devices = this.quickFilter(allDevices, preFilters);
+
+        // Open the remaining new devices a few at a time
+        const pending = devices.filter(device => !this.knownDevices.has(device) && !this.failedDevices.has(device));
+        let next = 0;
+        const worker = async () => {
+            while (next < pending.length) {
+                await this.getWebDevice(pending[next++]);
+            }
+        };
+        const concurrency = Math.max(1, this.options.concurrency ?? 4);
+        await Promise.all(Array.from({ length: Math.min(concurrency, pending.length) }, worker));
 
+        const webDevices: WebUSBDevice[] = [];
         for (const device of devices) {
-            const webDevice = await this.getWebDevice(device);
-
+            const webDevice = this.knownDevices.get(device);
             if (webDevice) {
-                refreshedKnownDevices.set(device, webDevice);
+                webDevices.push(webDevice);
             }
         }
+        return webDevices;
+    }
 
-        // Refresh knownDevices to remove old devices from the map
-        this.knownDevices = refreshedKnownDevices;
+    // Forget devices which have gone, and retry failed ones whenever devices come or go
+    private refreshCache(devices: usb.Device[]): void {
+        const current = new Set(devices);
+        const changed = current.size !== this.lastDevices.size || devices.some(device => !this.lastDevices.has(device));
+        this.lastDevices = current;
+        if (!changed) {
+            return;
+        }
 
-        return [...this.knownDevices.values()];
+        this.failedDevices.clear();
+        for (const device of this.knownDevices.keys()) {
+            if (!current.has(device)) {
+                this.knownDevices.delete(device);
+            }
+        }
     }
 
     // Get a WebUSBDevice corresponding to underlying device.
     // Returns undefined the device was not found and could not be created.
     private async getWebDevice(device: usb.Device): Promise<WebUSBDevice | undefined> {
-        if (!this.knownDevices.has(device)) {
+        const known = this.knownDevices.get(device);
+        if (known) {
+            return known;
+        }
+
+        let initializing = this.initializingDevices.get(device);
+        if (!initializing) {
             if (this.options.deviceTimeout) {
                 device.timeout = this.options.deviceTimeout;
             }
 
-            try {
-                const webDevice = await WebUSBDevice.createInstance(device, this.options.autoDetachKernelDriver);
+            initializing = WebUSBDevice.createInstance(device, this.options.autoDetachKernelDriver).then(webDevice => {
                 this.knownDevices.set(device, webDevice);
-            } catch {
+                this.failedDevices.delete(device);
+                return webDevice;
+            }, () => {
                 // Ignore creation issues as this may be a system device
-            }
+                this.failedDevices.add(device);
+                return undefined;
+            }).finally(() => this.initializingDevices.delete(device));
+            this.initializingDevices.set(device, initializing);
         }
 
-        return this.knownDevices.get(device);
+        return initializing;
     }
 
     // Undertake quick filter on devices before creating WebUSB devices if possible
@@ -288,18 +332,48 @@ export class WebUSB implements USB {
             return devices;
         }
 
-        // Just pre-filter on vid/pid
-        return devices.filter(device => preFilters.some(filter => {
-            // Vendor
-            if (filter.vendorId && filter.vendorId !== device.deviceDescriptor.idVendor) return false;
+        return devices.filter(device => preFilters.some(filter => this.quickMatch(device, filter)));
+    }
 
-            // Product
-            if (filter.productId && filter.productId !== device.deviceDescriptor.idProduct) return false;
+    // Match a filter using only the descriptors libusb already holds, without opening the device.
+    // Criteria which cannot be checked yet are treated as matching.
+    private quickMatch(device: usb.Device, filter: USBDeviceFilter): boolean {
+        const descriptor = device.deviceDescriptor;
+
+        // Vendor
+        if (filter.vendorId && filter.vendorId !== descriptor.idVendor) return false;
+
+        // Product
+        if (filter.productId && filter.productId !== descriptor.idProduct) return false;
+
+        // Class, Subclass and Protocol of the device or any interface of the active configuration
+        if (filter.classCode) {
+            const matches = (classCode: number, subclassCode: number, protocolCode: number) =>
+                filter.classCode === classCode
+                && (!filter.subclassCode || filter.subclassCode === subclassCode)
+                && (!filter.protocolCode || filter.protocolCode === protocolCode);
+
+            if (!matches(descriptor.bDeviceClass, descriptor.bDeviceSubClass, descriptor.bDeviceProtocol)) {
+                let config: ConfigDescriptor | undefined;
+                try {
+                    config = device.configDescriptor;
+                } catch {
+                    // Some platforms need the device open to read it
+                }
+                if (config && !config.interfaces.some(iface => iface[0] && matches(iface[0].bInterfaceClass, iface[0].bInterfaceSubClass, iface[0].bInterfaceProtocol))) {
+                    return false;
+                }
+            }
+        }
 
-            // Ignore Class, Subclass and Protocol as these need to check interfaces, too
-            // Ignore serial number for node-usb as it requires device connection
-            return true;
-        }));
+        // Serial number needs the device open, unless it has none or we have already read it
+        if (filter.serialNumber) {
+            if (!descriptor.iSerialNumber) return false;
+            const known = this.knownDevices.get(device);
+            if (known && known.serialNumber !== filter.serialNumber) return false;
+        }
+
+        return true;
     }
 
     // Filter WebUSB devices
@@ -8,6 +8,17 @@ const ENDPOINT_NUMBER_MASK = 0x7f;
 const CLEAR_FEATURE = 0x01;
 const ENDPOINT_HALT = 0x00;
 
+/**
+ * Timing of a transfer, added to WebUSB transfer results. Both are in milliseconds on the `process.hrtime()` clock and are
+ * captured on the libusb event thread, so they do not include event loop delays.
+ */
+export interface USBTransferTimes {
+    /** When the transfer completed */
+    completeTime?: number;
+    /** When the transfer was submitted to libusb */
+    submitTime?: number;
+}
+
 /**
  * Wrapper to make a node-usb device look like a webusb device
  */
@@ -88,9 +99,9 @@ export class WebUSBDevice implements USBDevice {
                 return;
             }
 
-            this.device.open();
+            await this.device.openAsync();
             if (platform() !== 'win32') {
-                this.device.setAutoDetachKernelDriver(this.autoDetachKernelDriver);
+                await this.device.setAutoDetachKernelDriverAsync(this.autoDetachKernelDriver);
             }
         } catch (error) {
             throw new Error(`open error: ${error}`);
@@ -120,7 +131,7 @@ export class WebUSBDevice implements USBDevice {
                 // Ignore
             }
 
-            this.device.close();
+            await this.device.closeAsync();
         } catch (error) {
             throw new Error(`close error: ${error}`);
         }
@@ -166,7 +177,7 @@ export class WebUSBDevice implements USBDevice {
         }
 
         try {
-            this.device.interface(interfaceNumber).claim();
+            await this.device.interface(interfaceNumber).claimAsync();
 
             // Re-create the USBInterface to set the claimed attribute
             this.configuration.interfaces[this.configuration.interfaces.indexOf(iface)] = {
@@ -223,15 +234,17 @@ export class WebUSBDevice implements USBDevice {
         }
     }
 
-    public async controlTransferIn(setup: USBControlTransferParameters, length: number): Promise<USBInTransferResult> {
+    public async controlTransferIn(setup: USBControlTransferParameters, length: number): Promise<USBInTransferResult & USBTransferTimes> {
         try {
             this.checkDeviceOpen();
             const type = this.controlTransferParamsToType(setup, usb.LIBUSB_ENDPOINT_IN);
-            const result = await this.controlTransferAsync(type, setup.request, setup.value, setup.index, length);
-
+            const { result, completeTime, submitTime } = await this.timedTransfer<Buffer | number | undefined>(callback =>
+                this.device.controlTransfer(type, setup.request, setup.value, setup.index, length, callback));
             return {
                 data: result ? new DataView(new Uint8Array(result as Buffer).buffer) : undefined,
-                status: 'ok'
+                status: 'ok',
+                completeTime,
+                submitTime
             };
         } catch (error) {
             if ((error as usb.LibUSBException).errno === usb.LIBUSB_TRANSFER_STALL) {
@@ -250,16 +263,18 @@ export class WebUSBDevice implements USBDevice {
         }
     }
 
-    public async controlTransferOut(setup: USBControlTransferParameters, data?: ArrayBuffer): Promise<USBOutTransferResult> {
+    public async controlTransferOut(setup: USBControlTransferParameters, data?: ArrayBuffer): Promise<USBOutTransferResult & USBTransferTimes> {
         try {
             this.checkDeviceOpen();
             const type = this.controlTransferParamsToType(setup, usb.LIBUSB_ENDPOINT_OUT);
             const buffer = data ? Buffer.from(data) : Buffer.alloc(0);
-            const bytesWritten = <number>await this.controlTransferAsync(type, setup.request, setup.value, setup.index, buffer);
-
+            const { result, completeTime, submitTime } = await this.timedTransfer<Buffer | number | undefined>(callback =>
+                this.device.controlTransfer(type, setup.request, setup.value, setup.index, buffer, callback));
             return {
-                bytesWritten,
-                status: 'ok'
+                bytesWritten: result as number,
+                status: 'ok',
+                completeTime,
+                submitTime
             };
         } catch (error) {
             if ((error as usb.LibUSBException).errno === usb.LIBUSB_TRANSFER_STALL) {
@@ -282,15 +297,16 @@ export class WebUSBDevice implements USBDevice {
         }
     }
 
-    public async transferIn(endpointNumber: number, length: number): Promise<USBInTransferResult> {
+    public async transferIn(endpointNumber: number, length: number): Promise<USBInTransferResult & USBTransferTimes> {
         try {
             this.checkDeviceOpen();
             const endpoint = this.getEndpoint(endpointNumber | usb.LIBUSB_ENDPOINT_IN) as InEndpoint;
-            const result = await endpoint.transferAsync(length);
-
+            const { result, completeTime, submitTime } = await this.timedTransfer<Buffer | undefined>(callback => endpoint.transfer(length, callback));
             return {
                 data: result ? new DataView(new Uint8Array(result).buffer) : undefined,
-                status: 'ok'
+                status: 'ok',
+                completeTime,
+                submitTime
             };
         } catch (error) {
             if ((error as usb.LibUSBException).errno === usb.LIBUSB_TRANSFER_STALL) {
@@ -309,16 +325,17 @@ export class WebUSBDevice implements USBDevice {
         }
     }
 
-    public async transferOut(endpointNumber: number, data: ArrayBuffer): Promise<USBOutTransferResult> {
+    public async transferOut(endpointNumber: number, data: ArrayBuffer): Promise<USBOutTransferResult & USBTransferTimes> {
         try {
             this.checkDeviceOpen();
             const endpoint = this.getEndpoint(endpointNumber | usb.LIBUSB_ENDPOINT_OUT) as OutEndpoint;
             const buffer = Buffer.from(data);
-            const bytesWritten = await endpoint.transferAsync(buffer);
-
+            const { result, completeTime, submitTime } = await this.timedTransfer<number>(callback => endpoint.transfer(buffer, callback));
             return {
-                bytesWritten,
-                status: 'ok'
+                bytesWritten: result,
+                status: 'ok',
+                completeTime,
+                submitTime
             };
         } catch (error) {
             if ((error as usb.LibUSBException).errno === usb.LIBUSB_TRANSFER_STALL) {
@@ -355,7 +372,7 @@ export class WebUSBDevice implements USBDevice {
     private async initialize(): Promise<void> {
         try {
             if (!this.opened) {
-                this.device.open();
+                await this.device.openAsync();
 
                 // Explicitly set configuration for vendor-specific devices on macos
                 // https://github.com/node-usb/node-usb/issues/61
@@ -372,7 +389,7 @@ export class WebUSBDevice implements USBDevice {
             throw new Error(`initialize error: ${error}`);
         } finally {
             if (this.opened) {
-                this.device.close();
+                await this.device.closeAsync();
             }
         }
     }
@@ -505,6 +522,20 @@ export class WebUSBDevice implements USBDevice {
         }
     }
 
+    // Run a transfer that reports its timings, resolving with its result and those timings
+    private timedTransfer<T>(start: (callback: (error: usb.LibUSBException | undefined, result: T, completeTime?: number, submitTime?: number) => void) => void):
+        Promise<{ result: T } & USBTransferTimes> {
+        return new Promise((resolve, reject) => {
+            start((error, result, completeTime, submitTime) => {
+                if (error) {
+                    reject(error);
+                    return;
+                }
+                resolve({ result, completeTime, submitTime });
+            });
+        });
+    }
+
     private checkDeviceOpen(): void {
         if (!this.opened) {
             throw new Error('The device must be opened first');